@@ -0,0 +1,359 @@
+
+#include "helpers.hpp"
+#include "slab.hpp"
+#include "atom_table.hpp"
+#include "vm/heap_thing_inlines.hpp"
+#include "vm/string.hpp"
+
+#include <new>
+
+namespace Whisper {
+
+
+//
+// AtomTable
+//
+
+AtomTable::SlotArray::SlotArray(uint32_t size)
+  : size(size),
+    slots(new (std::nothrow) std::atomic<VM::LinearString *>[size])
+{
+    if (!slots)
+        return;
+
+    for (uint32_t i = 0; i < size; i++)
+        slots[i].store(nullptr, std::memory_order_relaxed);
+}
+
+AtomTable::SlotArray::~SlotArray()
+{
+    delete[] slots;
+}
+
+AtomTable::Shard::Shard()
+  : current(nullptr),
+    entries(0),
+    retired()
+{
+    pthread_mutex_init(&lock, nullptr);
+}
+
+template <typename... Args>
+VM::LinearString *
+AtomTable::createAtom(uint32_t size, Args... args)
+{
+    uint32_t allocSize = size + VM::HeapThingHeader::HeaderSize;
+    allocSize = AlignIntUp<uint32_t>(allocSize, Slab::AllocAlign);
+
+    uint32_t cardNo;
+    uint8_t *mem = allocate(allocSize, &cardNo);
+    if (!mem)
+        return nullptr;
+
+    typedef VM::HeapThingWrapper<VM::LinearString> WrappedType;
+    WrappedType *wrapped = new (mem) WrappedType(cardNo, size, args...);
+    return wrapped->payloadPointer();
+}
+
+AtomTable::Key::Key(const uint8_t *str, uint32_t length)
+  : chars_(str), heapStr_(nullptr), length_(length), eightBit_(true)
+{}
+
+AtomTable::Key::Key(const uint16_t *str, uint32_t length)
+  : chars_(str), heapStr_(nullptr), length_(length), eightBit_(false)
+{}
+
+AtomTable::Key::Key(const VM::HeapString *str)
+  : chars_(nullptr), heapStr_(str), length_(str->length()), eightBit_(false)
+{}
+
+uint32_t
+AtomTable::Key::hash(uint32_t spoiler) const
+{
+    if (heapStr_)
+        return VM::HashString(spoiler, heapStr_);
+
+    if (eightBit_) {
+        return VM::HashString(spoiler, static_cast<const uint8_t *>(chars_),
+                              length_);
+    }
+    return VM::HashString(spoiler, static_cast<const uint16_t *>(chars_),
+                          length_);
+}
+
+bool
+AtomTable::Key::matches(const VM::LinearString *atom) const
+{
+    if (heapStr_)
+        return VM::EqualStrings(atom, heapStr_);
+
+    if (eightBit_) {
+        return VM::EqualStrings(atom, static_cast<const uint8_t *>(chars_),
+                                length_);
+    }
+    return VM::EqualStrings(atom, static_cast<const uint16_t *>(chars_),
+                            length_);
+}
+
+VM::LinearString *
+AtomTable::Key::createAtom(AtomTable *table) const
+{
+    if (heapStr_) {
+        uint32_t size = VM::LinearString::CalculateSize(heapStr_);
+        return table->createAtom(size, heapStr_, /*interned=*/true);
+    }
+
+    if (eightBit_) {
+        const uint8_t *str = static_cast<const uint8_t *>(chars_);
+        uint32_t size = VM::LinearString::CalculateSize(str, length_);
+        return table->createAtom(size, str, /*interned=*/true);
+    }
+
+    const uint16_t *str = static_cast<const uint16_t *>(chars_);
+    uint32_t size = VM::LinearString::CalculateSize(str, length_);
+    return table->createAtom(size, str, length_, /*interned=*/true);
+}
+
+AtomTable::AtomTable()
+  : initialized_(false),
+    spoiler_(0),
+    shards_(),
+    slabs_(),
+    currentSlab_(nullptr)
+{
+    pthread_mutex_init(&slabLock_, nullptr);
+}
+
+AtomTable::~AtomTable()
+{
+    for (Shard &shard : shards_) {
+        delete shard.current.load(std::memory_order_relaxed);
+        for (SlotArray *array : shard.retired)
+            delete array;
+        pthread_mutex_destroy(&shard.lock);
+    }
+
+    for (Slab *slab : slabs_)
+        Slab::Destroy(slab);
+    pthread_mutex_destroy(&slabLock_);
+}
+
+bool
+AtomTable::initialize(uint32_t spoiler)
+{
+    WH_ASSERT(!initialized_);
+
+    spoiler_ = spoiler;
+
+    static_assert((INITIAL_SHARD_SIZE & (INITIAL_SHARD_SIZE - 1)) == 0,
+                  "AtomTable shard size must be a power of two.");
+    for (Shard &shard : shards_) {
+        SlotArray *array = new (std::nothrow) SlotArray(INITIAL_SHARD_SIZE);
+        if (!array || !array->slots) {
+            delete array;
+            return false;
+        }
+        shard.current.store(array, std::memory_order_release);
+    }
+
+    initialized_ = true;
+    return true;
+}
+
+uint32_t
+AtomTable::spoiler() const
+{
+    return spoiler_;
+}
+
+VM::LinearString *
+AtomTable::lookup(const uint8_t *str, uint32_t length) const
+{
+    return lookupKey(Key(str, length));
+}
+
+VM::LinearString *
+AtomTable::lookup(const uint16_t *str, uint32_t length) const
+{
+    return lookupKey(Key(str, length));
+}
+
+VM::LinearString *
+AtomTable::lookup(const VM::HeapString *str) const
+{
+    return lookupKey(Key(str));
+}
+
+VM::LinearString *
+AtomTable::add(const uint8_t *str, uint32_t length)
+{
+    return addKey(Key(str, length));
+}
+
+VM::LinearString *
+AtomTable::add(const uint16_t *str, uint32_t length)
+{
+    return addKey(Key(str, length));
+}
+
+VM::LinearString *
+AtomTable::add(const VM::HeapString *str)
+{
+    return addKey(Key(str));
+}
+
+/*static*/ uint32_t
+AtomTable::ShardIndex(uint32_t hash)
+{
+    // Slots within a shard are picked with the low bits.
+    return hash >> (32 - SHARD_COUNT_LOG2);
+}
+
+VM::LinearString *
+AtomTable::lookupKey(const Key &key) const
+{
+    WH_ASSERT(initialized_);
+
+    uint32_t hash = key.hash(spoiler_);
+    const Shard &shard = shards_[ShardIndex(hash)];
+    const SlotArray *array = shard.current.load(std::memory_order_acquire);
+
+    uint32_t emptySlot;
+    return probe(array, key, hash, &emptySlot);
+}
+
+VM::LinearString *
+AtomTable::addKey(const Key &key)
+{
+    WH_ASSERT(initialized_);
+
+    uint32_t hash = key.hash(spoiler_);
+    Shard &shard = shards_[ShardIndex(hash)];
+
+    pthread_mutex_lock(&shard.lock);
+
+    // Check again under the lock, since another thread may have added
+    // the atom since it was last looked up.
+    SlotArray *array = shard.current.load(std::memory_order_relaxed);
+    uint32_t slot;
+    VM::LinearString *atom = probe(array, key, hash, &slot);
+
+    if (!atom && shard.entries >= array->size * MAX_FILL_RATIO) {
+        if (!growShard(shard)) {
+            pthread_mutex_unlock(&shard.lock);
+            return nullptr;
+        }
+        array = shard.current.load(std::memory_order_relaxed);
+        probe(array, key, hash, &slot);
+    }
+
+    if (!atom) {
+        atom = key.createAtom(this);
+        if (atom) {
+            // Fill the hash cache before publishing, so that readers
+            // on other threads never write to the atom.
+            atom->hash(spoiler_);
+            array->slots[slot].store(atom, std::memory_order_release);
+            shard.entries++;
+        }
+    }
+
+    pthread_mutex_unlock(&shard.lock);
+    return atom;
+}
+
+VM::LinearString *
+AtomTable::probe(const SlotArray *array, const Key &key, uint32_t hash,
+                 uint32_t *emptySlot) const
+{
+    uint32_t mask = array->size - 1;
+    for (uint32_t i = 0; i < array->size; i++) {
+        uint32_t slot = (hash + i) & mask;
+        VM::LinearString *atom =
+            array->slots[slot].load(std::memory_order_acquire);
+
+        if (!atom) {
+            *emptySlot = slot;
+            return nullptr;
+        }
+
+        if (atom->hash(spoiler_) == hash && key.matches(atom))
+            return atom;
+    }
+
+    WH_UNREACHABLE("Completely full AtomTable shard should not happen!");
+    return nullptr;
+}
+
+bool
+AtomTable::growShard(Shard &shard)
+{
+    SlotArray *oldArray = shard.current.load(std::memory_order_relaxed);
+    SlotArray *newArray = new (std::nothrow) SlotArray(oldArray->size * 2);
+    if (!newArray || !newArray->slots) {
+        delete newArray;
+        return false;
+    }
+
+    // Atoms are distinct, so they are placed without comparisons.
+    uint32_t mask = newArray->size - 1;
+    for (uint32_t i = 0; i < oldArray->size; i++) {
+        VM::LinearString *atom =
+            oldArray->slots[i].load(std::memory_order_relaxed);
+        if (!atom)
+            continue;
+
+        uint32_t slot = atom->hash(spoiler_) & mask;
+        while (newArray->slots[slot].load(std::memory_order_relaxed))
+            slot = (slot + 1) & mask;
+        newArray->slots[slot].store(atom, std::memory_order_relaxed);
+    }
+
+    // Readers may still be probing the old array, so it is kept
+    // until the table is destroyed.
+    try {
+        shard.retired.push_back(oldArray);
+    } catch (std::bad_alloc &err) {
+        delete newArray;
+        return false;
+    }
+
+    shard.current.store(newArray, std::memory_order_release);
+    return true;
+}
+
+uint8_t *
+AtomTable::allocate(uint32_t size, uint32_t *cardNo)
+{
+    pthread_mutex_lock(&slabLock_);
+
+    Slab *slab = currentSlab_;
+    uint8_t *mem = slab ? slab->allocateTail(size) : nullptr;
+
+    if (!mem) {
+        // Large atoms get a slab of their own.  Otherwise, start a new
+        // standard slab.
+        bool singleton = size > Slab::StandardSlabMaxObjectSize();
+        slab = singleton ? Slab::AllocateSingleton(size, Slab::Tenured)
+                         : Slab::AllocateStandard(Slab::Tenured);
+        if (slab) {
+            try {
+                slabs_.push_back(slab);
+                mem = slab->allocateTail(size);
+                if (!singleton)
+                    currentSlab_ = slab;
+            } catch (std::bad_alloc &err) {
+                Slab::Destroy(slab);
+            }
+        }
+    }
+
+    if (mem)
+        *cardNo = slab->calculateCardNumber(mem);
+
+    pthread_mutex_unlock(&slabLock_);
+    return mem;
+}
+
+
+} // namespace Whisper
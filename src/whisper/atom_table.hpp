@@ -0,0 +1,132 @@
+#ifndef WHISPER__ATOM_TABLE_HPP
+#define WHISPER__ATOM_TABLE_HPP
+
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+
+#include "common.hpp"
+#include "debug.hpp"
+
+namespace Whisper {
+
+class Slab;
+
+namespace VM
+{
+    class HeapString;
+    class LinearString;
+}
+
+//
+// AtomTable keeps the interned strings (atoms) shared by every thread
+// of a runtime.
+//
+// Atoms are immutable LinearStrings, allocated in tenured slabs owned
+// by the table rather than by any thread, so an atom pointer names the
+// same string on every thread.  Each atom's hash is computed with the
+// runtime-wide spoiler before the atom is published, so threads only
+// ever read its cached hash.
+//
+// The table is split into shards, chosen by the high bits of the hash.
+// Lookups are lock-free: they load the shard's current slot array and
+// probe it with acquire loads.  Inserts take the shard's lock.  A
+// growing shard publishes a new slot array and keeps the old one
+// alive until the table is destroyed, so concurrent readers never see
+// freed memory.  A reader may miss an atom which is being added at the
+// same time, which is harmless: adds always re-check under the lock.
+//
+
+class AtomTable
+{
+  private:
+    static constexpr uint32_t SHARD_COUNT_LOG2 = 4;
+    static constexpr uint32_t SHARD_COUNT = 1u << SHARD_COUNT_LOG2;
+    static constexpr uint32_t INITIAL_SHARD_SIZE = 64;
+    static constexpr float MAX_FILL_RATIO = 0.75;
+
+    // Open-addressed array of atoms.  Slots are only ever filled once.
+    struct SlotArray {
+        uint32_t size;
+        std::atomic<VM::LinearString *> *slots;
+
+        explicit SlotArray(uint32_t size);
+        ~SlotArray();
+    };
+
+    struct Shard {
+        pthread_mutex_t lock;
+        std::atomic<SlotArray *> current;
+
+        // Guarded by lock.
+        uint32_t entries;
+        std::vector<SlotArray *> retired;
+
+        Shard();
+    };
+
+    // A string to look up or add: either chars or a heap string.
+    class Key
+    {
+      private:
+        const void *chars_;
+        const VM::HeapString *heapStr_;
+        uint32_t length_;
+        bool eightBit_;
+
+      public:
+        Key(const uint8_t *str, uint32_t length);
+        Key(const uint16_t *str, uint32_t length);
+        explicit Key(const VM::HeapString *str);
+
+        uint32_t hash(uint32_t spoiler) const;
+        bool matches(const VM::LinearString *atom) const;
+        VM::LinearString *createAtom(AtomTable *table) const;
+    };
+
+    bool initialized_;
+    uint32_t spoiler_;
+    Shard shards_[SHARD_COUNT];
+
+    // Slabs holding atoms.  Guarded by slabLock_.
+    pthread_mutex_t slabLock_;
+    std::vector<Slab *> slabs_;
+    Slab *currentSlab_;
+
+  public:
+    AtomTable();
+    ~AtomTable();
+
+    bool initialize(uint32_t spoiler);
+
+    uint32_t spoiler() const;
+
+    VM::LinearString *lookup(const uint8_t *str, uint32_t length) const;
+    VM::LinearString *lookup(const uint16_t *str, uint32_t length) const;
+    VM::LinearString *lookup(const VM::HeapString *str) const;
+
+    // Return the atom for a string, adding it if necessary.  Returns
+    // null if the atom could not be allocated.
+    VM::LinearString *add(const uint8_t *str, uint32_t length);
+    VM::LinearString *add(const uint16_t *str, uint32_t length);
+    VM::LinearString *add(const VM::HeapString *str);
+
+  private:
+    static uint32_t ShardIndex(uint32_t hash);
+
+    VM::LinearString *lookupKey(const Key &key) const;
+    VM::LinearString *addKey(const Key &key);
+
+    VM::LinearString *probe(const SlotArray *array, const Key &key,
+                            uint32_t hash, uint32_t *emptySlot) const;
+    bool growShard(Shard &shard);
+
+    template <typename... Args>
+    VM::LinearString *createAtom(uint32_t size, Args... args);
+    uint8_t *allocate(uint32_t size, uint32_t *cardNo);
+};
+
+
+} // namespace Whisper
+
+#endif // WHISPER__ATOM_TABLE_HPP
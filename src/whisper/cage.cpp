@@ -0,0 +1,160 @@
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <vector>
+#include <new>
+
+#include "spew.hpp"
+#include "helpers.hpp"
+#include "memalloc.hpp"
+#include "cage.hpp"
+
+#if defined(ENABLE_POINTER_COMPRESSION)
+
+namespace Whisper {
+
+struct CageRegion
+{
+    uint8_t *start;
+    size_t size;
+
+    CageRegion(uint8_t *start, size_t size) : start(start), size(size) {}
+};
+
+// The cage is shared by all runtimes and threads.  The base pointer
+// is written once, before any slab is allocated.  Everything else is
+// protected by CageLock.
+/*static*/ uint8_t *HeapCage::Base_ = nullptr;
+static pthread_mutex_t CageLock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *CageCursor = nullptr;
+static std::vector<CageRegion> *CageFreeRegions = nullptr;
+
+// Size of the region at the start of the cage which is never handed out.
+static constexpr size_t CageNullRegionSize = 1 << 16;
+
+/*static*/ bool
+HeapCage::Initialize()
+{
+    pthread_mutex_lock(&CageLock);
+    if (Base_) {
+        pthread_mutex_unlock(&CageLock);
+        return true;
+    }
+
+    // Reserve twice the cage size, and trim to an aligned cage.  The
+    // reservation is inaccessible until regions are committed.
+    size_t reserveSize = CageSize * 2;
+    void *reservation = mmap(nullptr, reserveSize, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                             -1, 0);
+    if (reservation == MAP_FAILED) {
+        pthread_mutex_unlock(&CageLock);
+        SpewMemoryError("HeapCage failed to reserve %ld bytes",
+                        (long)reserveSize);
+        return false;
+    }
+
+    uint8_t *region = reinterpret_cast<uint8_t *>(reservation);
+    uint8_t *base = AlignPtrUp(region, CageSize);
+    size_t prefix = base - region;
+    size_t suffix = CageSize - prefix;
+    if (prefix > 0)
+        munmap(region, prefix);
+    if (suffix > 0)
+        munmap(base + CageSize, suffix);
+
+    try {
+        CageFreeRegions = new std::vector<CageRegion>();
+    } catch (std::bad_alloc &err) {
+        munmap(base, CageSize);
+        pthread_mutex_unlock(&CageLock);
+        return false;
+    }
+
+    Base_ = base;
+    CageCursor = base + CageNullRegionSize;
+    pthread_mutex_unlock(&CageLock);
+
+    SpewMemoryNote("HeapCage reserved %ld bytes at %p", (long)CageSize, base);
+    return true;
+}
+
+/*static*/ void *
+HeapCage::AllocateRegion(size_t bytes, size_t align)
+{
+    WH_ASSERT(IsPowerOfTwo(align));
+
+    if (!Initialize())
+        return nullptr;
+
+    pthread_mutex_lock(&CageLock);
+
+    // Look for a released region of the same size first.
+    uint8_t *result = nullptr;
+    for (size_t i = 0; i < CageFreeRegions->size(); i++) {
+        CageRegion &region = (*CageFreeRegions)[i];
+        if (region.size == bytes && IsPtrAligned(region.start, align)) {
+            result = region.start;
+            (*CageFreeRegions)[i] = CageFreeRegions->back();
+            CageFreeRegions->pop_back();
+            break;
+        }
+    }
+
+    // Otherwise, bump allocate.
+    if (!result) {
+        uint8_t *start = AlignPtrUp(CageCursor, align);
+        if (start + bytes <= Base_ + CageSize) {
+            result = start;
+            CageCursor = start + bytes;
+        }
+    }
+
+    pthread_mutex_unlock(&CageLock);
+
+    if (!result) {
+        SpewMemoryError("HeapCage exhausted allocating %ld bytes",
+                        (long)bytes);
+        return nullptr;
+    }
+
+    if (mprotect(result, bytes, PROT_READ | PROT_WRITE) != 0) {
+        SpewMemoryError("HeapCage failed to commit %ld bytes at %p",
+                        (long)bytes, result);
+        ReleaseRegion(result, bytes);
+        return nullptr;
+    }
+
+    SpewMemoryNote("HeapCage allocated %ld bytes at %p (offset=%x)",
+                   (long)bytes, result, Compress(result));
+    return result;
+}
+
+/*static*/ void
+HeapCage::ReleaseRegion(void *ptr, size_t bytes)
+{
+    WH_ASSERT(Contains(ptr));
+
+    // Decommit the region by mapping fresh inaccessible pages over it.
+    void *result = mmap(ptr, bytes, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                        MAP_FIXED, -1, 0);
+    if (result == MAP_FAILED)
+        SpewMemoryError("HeapCage failed to decommit %p", ptr);
+
+    SpewMemoryNote("HeapCage released %ld bytes at %p", (long)bytes, ptr);
+
+    pthread_mutex_lock(&CageLock);
+    try {
+        CageFreeRegions->push_back(
+            CageRegion(reinterpret_cast<uint8_t *>(ptr), bytes));
+    } catch (std::bad_alloc &err) {
+        // Leak the region.
+    }
+    pthread_mutex_unlock(&CageLock);
+}
+
+
+} // namespace Whisper
+
+#endif // defined(ENABLE_POINTER_COMPRESSION)
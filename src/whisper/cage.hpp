@@ -0,0 +1,92 @@
+#ifndef WHISPER__CAGE_HPP
+#define WHISPER__CAGE_HPP
+
+#include "common.hpp"
+#include "debug.hpp"
+
+#if defined(ENABLE_POINTER_COMPRESSION)
+
+namespace Whisper {
+
+
+//
+// HeapCage
+//
+// In builds with ENABLE_POINTER_COMPRESSION, the entire garbage-collected
+// heap lives within a single reservation of address space called the
+// cage.  All slabs are carved out of the cage, and heap pointers stored
+// in Heap<T *> fields are compressed to 32-bit offsets from the cage
+// base.
+//
+//  +-----------------------+   <--- Base - aligned to CageSize
+//  | Reserved (null)       |
+//  +-----------------------+
+//  | Slab                  |
+//  +-----------------------+
+//  | Slab                  |
+//  +-----------------------+
+//  | ...                   |
+//  |                       |
+//  | Unused reservation    |
+//  |                       |
+//  +-----------------------+   <--- Base + CageSize
+//
+// The first region of the cage is never handed out, so a compressed
+// offset of zero always represents the null pointer.
+//
+// Regions are never returned to the system.  Released regions are
+// decommitted and kept on a free list for reuse by later requests of
+// the same size.
+//
+class HeapCage
+{
+  public:
+    static constexpr uint64_t CageSizeLog2 = 32;
+    static constexpr uint64_t CageSize = ToUInt64(1) << CageSizeLog2;
+
+  private:
+    static uint8_t *Base_;
+
+  public:
+    // Reserve the cage.  Safe to call multiple times.
+    static bool Initialize();
+
+    static uint8_t *Base() {
+        WH_ASSERT(Base_);
+        return Base_;
+    }
+
+    static bool Contains(const void *ptr) {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(ptr);
+        return p >= Base_ && p < Base_ + CageSize;
+    }
+
+    // Allocate a region of committed memory within the cage,
+    // aligned to |align| bytes.
+    //
+    // Returns NULL on failure.
+    static void *AllocateRegion(size_t bytes, size_t align);
+    static void ReleaseRegion(void *ptr, size_t bytes);
+
+    static uint32_t Compress(const void *ptr) {
+        if (!ptr)
+            return 0;
+        WH_ASSERT(Contains(ptr));
+        return static_cast<uint32_t>(
+                reinterpret_cast<const uint8_t *>(ptr) - Base_);
+    }
+
+    template <typename T>
+    static T *Decompress(uint32_t offset) {
+        if (!offset)
+            return nullptr;
+        return reinterpret_cast<T *>(Base_ + offset);
+    }
+};
+
+
+} // namespace Whisper
+
+#endif // defined(ENABLE_POINTER_COMPRESSION)
+
+#endif // WHISPER__CAGE_HPP
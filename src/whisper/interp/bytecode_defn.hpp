@@ -23,6 +23,9 @@ _(Push,         V,      0,      0,1,            OPF_None           )\
 _(Ret_S,        E,      0,      1,0,            OPF_Control        )\
 _(Ret_V,        V,      0,      0,0,            OPF_Control        )\
 \
+_(GetProp,      VV,     0,      1,1,            OPF_None           )\
+_(SetProp,      VV,     0,      2,1,            OPF_None           )\
+\
 _(Add_SSS,      E,      0,      2,1,            OPF_None           )\
 _(Add_SSV,      V,      0,      2,0,            OPF_None           )\
 _(Add_SVS,      V,      0,      1,1,            OPF_None           )\
@@ -5,11 +5,15 @@
 #include "runtime_inlines.hpp"
 #include "rooting_inlines.hpp"
 #include "vm/heap_thing_inlines.hpp"
+#include "vm/string.hpp"
+#include "vm/script.hpp"
 
 namespace Whisper {
 namespace Interp {
 
 
+/*static*/ constexpr uint32_t BytecodeGenerator::NoStringConstant;
+
 BytecodeGenerator::BytecodeGenerator(
         RunContext *cx,
         const STLBumpAllocator<uint8_t> &allocator,
@@ -22,7 +26,8 @@ BytecodeGenerator::BytecodeGenerator(
     annotator_(annotator),
     strict_(strict),
     bytecode_(cx_),
-    constantPool_(cx_)
+    constantPool_(cx_),
+    stringConstants_(annotator.numStrings(), NoStringConstant)
 {
     WH_ASSERT(node_);
 }
@@ -58,6 +63,8 @@ BytecodeGenerator::generateBytecode()
     WH_ASSERT(currentBytecodeSize_ > 0);
     bytecodeSize_ = currentBytecodeSize_;
     currentBytecodeSize_ = 0;
+    numPropertyCaches_ = currentPropertyCaches_;
+    currentPropertyCaches_ = 0;
 
     // Bytecode scanning worked out.  Allocate a bytecode object.
     bytecode_ = cx_->inHatchery().createSized<VM::Bytecode>(bytecodeSize_);
@@ -87,6 +94,22 @@ BytecodeGenerator::constants(VM::Tuple *&tuple)
     return true;
 }
 
+bool
+BytecodeGenerator::propertyCaches(VM::Tuple *&tuple)
+{
+    if (numPropertyCaches_ == 0) {
+        tuple = nullptr;
+        return true;
+    }
+
+    // Property caches start out empty.
+    uint32_t size = numPropertyCaches_ * VM::Script::PropertyCacheSize;
+    if (!cx_->inHatchery().createTuple(size, tuple))
+        return false;
+
+    return true;
+}
+
 uint32_t
 BytecodeGenerator::maxStackDepth() const
 {
@@ -125,6 +148,41 @@ BytecodeGenerator::generateExpressionStatement(
     emitPop();
 }
 
+// Check if |expr| always evaluates to a primitive value.  The interpreter
+// only handles property accesses on objects, so accesses on these are
+// rejected when generating code rather than failing when run.  The
+// binary and unary operators handled here are all arithmetic.
+static bool
+IsPrimitiveExpression(AST::ExpressionNode *expr)
+{
+    if (expr->isParenthesizedExpression()) {
+        return IsPrimitiveExpression(
+                    expr->toParenthesizedExpression()->subexpression());
+    }
+
+    return expr->isNumericLiteral() || expr->isStringLiteral() ||
+           expr->isBinaryExpression() || expr->isUnaryExpression();
+}
+
+// Check if |expr| always evaluates to a string.  The only arithmetic
+// the interpreter handles on strings is adding two of them.
+static bool
+IsStringExpression(AST::ExpressionNode *expr)
+{
+    if (expr->isParenthesizedExpression()) {
+        return IsStringExpression(
+                    expr->toParenthesizedExpression()->subexpression());
+    }
+
+    if (expr->isAddExpression()) {
+        AST::BaseBinaryExpressionNode *add = expr->toBinaryExpression();
+        return IsStringExpression(add->lhs()) &&
+               IsStringExpression(add->rhs());
+    }
+
+    return expr->isStringLiteral();
+}
+
 void
 BytecodeGenerator::generateExpression(AST::ExpressionNode *expr,
                                       const OperandLocation &outputLocation)
@@ -132,6 +190,12 @@ BytecodeGenerator::generateExpression(AST::ExpressionNode *expr,
     // Handle binary expression.
     if (expr->isBinaryExpression()) {
         AST::BaseBinaryExpressionNode *binExpr = expr->toBinaryExpression();
+        if ((IsStringExpression(binExpr->lhs()) ||
+             IsStringExpression(binExpr->rhs())) &&
+            !IsStringExpression(expr))
+        {
+            emitError("Cannot handle arithmetic on strings yet.");
+        }
 
         // See if LHS and RHS are addressable.
         OperandLocation lhsLocation = OperandLocation::StackTop();
@@ -157,6 +221,8 @@ BytecodeGenerator::generateExpression(AST::ExpressionNode *expr,
     // Handle unary expression.
     } else if (expr->isUnaryExpression()) {
         AST::BaseUnaryExpressionNode *unExpr = expr->toUnaryExpression();
+        if (IsStringExpression(unExpr->subexpression()))
+            emitError("Cannot handle arithmetic on strings yet.");
 
         // See if input is addressable.
         OperandLocation inputLocation = OperandLocation::StackTop();
@@ -178,8 +244,10 @@ BytecodeGenerator::generateExpression(AST::ExpressionNode *expr,
         AST::NumericLiteralAnnotation *annot = lit->annotation();
 
         // Int32s are just always emitted inline.
-        if (annot->isInt32())
+        if (annot->isInt32()) {
             emitPushInt32(annot->int32Value());
+            return;
+        }
 
         WH_ASSERT(annot->isDouble());
 
@@ -190,6 +258,39 @@ BytecodeGenerator::generateExpression(AST::ExpressionNode *expr,
         uint32_t constIdx = addConstant(dval);
         emitPush(OperandLocation::Constant(constIdx));
 
+    // Handle string literals.
+    } else if (expr->isStringLiteral()) {
+        AST::StringLiteralNode *lit = expr->toStringLiteral();
+        WH_ASSERT(lit->hasAnnotation());
+
+        uint32_t constIdx = addStringConstant(lit->annotation());
+        emitPush(OperandLocation::Constant(constIdx));
+
+    // Handle property accesses.
+    } else if (expr->isGetPropertyExpression()) {
+        AST::GetPropertyExpressionNode *getProp =
+            expr->toGetPropertyExpression();
+        if (IsPrimitiveExpression(getProp->object()))
+            emitError("Cannot handle properties of primitive values yet.");
+
+        generateExpression(getProp->object(), OperandLocation::StackTop());
+        emitPropertyOp(Opcode::GetProp, getProp);
+
+    // Handle assignments to properties.
+    } else if (expr->isAssignExpression()) {
+        AST::AssignExpressionNode *assign = expr->toAssignExpression();
+        if (!assign->lhs()->isGetPropertyExpression())
+            emitError("Cannot handle this assignment target yet.");
+
+        AST::GetPropertyExpressionNode *getProp =
+            assign->lhs()->toGetPropertyExpression();
+        if (IsPrimitiveExpression(getProp->object()))
+            emitError("Cannot handle properties of primitive values yet.");
+
+        generateExpression(getProp->object(), OperandLocation::StackTop());
+        generateExpression(assign->rhs(), OperandLocation::StackTop());
+        emitPropertyOp(Opcode::SetProp, getProp);
+
     // Handle parenthesized expressions.
     } else if (expr->isParenthesizedExpression()) {
         return generateExpression(
@@ -249,48 +350,51 @@ BytecodeGenerator::getAddressableLocation(AST::ExpressionNode *expr,
         return true;
     }
 
+    // String literals are always addressable as constants.
+    if (expr->isStringLiteral()) {
+        AST::StringLiteralNode *lit = expr->toStringLiteral();
+        WH_ASSERT(lit->hasAnnotation());
+        location = OperandLocation::Constant(
+                        addStringConstant(lit->annotation()));
+        return true;
+    }
+
     // Handle parenthesized expressions.
     if (expr->isParenthesizedExpression()) {
         auto subExpr = expr->toParenthesizedExpression()->subexpression();
         return getAddressableLocation(subExpr, location);
     }
 
-    // Handle negative literals.
+    // Handle negative literals.  The literal's value is negated
+    // directly instead of addressing the literal and patching its
+    // constant, since constants may be shared.
     if (expr->isNegativeExpression()) {
         auto subExpr = expr->toNegativeExpression()->subexpression();
         if (!subExpr->isNumericLiteral())
             return false;
 
-        if (!getAddressableLocation(subExpr, location))
-            return false;
-
-        if (location.isImmediate()) {
-            if (location.signedValue() < 0)
-                return false;
-
-            if (-location.signedValue() < OperandMinSignedValue)
-                return false;
-
-            location = OperandLocation::Immediate(-location.signedValue());
+        AST::NumericLiteralNode *lit = subExpr->toNumericLiteral();
+        WH_ASSERT(lit->hasAnnotation());
+        AST::NumericLiteralAnnotation *annot = lit->annotation();
 
-        } else if (location.isConstant()) {
-            // Negativize the constant.
-            Value constVal = getConstant(location.constantIndex());
-            WH_ASSERT(constVal.isNumber());
-            WH_ASSERT(!constVal.isInt32());
-            double dbl = -constVal.numberValue();
-            Root<Value> dval(cx_);
-            if (!cx_->inHatchery().createNumber(dbl, dval))
+        // Negated int32s are addressable if they fit in an immediate.
+        // Note that -0 is not an int32.
+        if (annot->isInt32()) {
+            int32_t i = annot->int32Value();
+            if (i <= 0 || -i < OperandMinSignedValue)
                 return false;
 
-            // If constant was created, it MUST have been newly added.
-            WH_ASSERT(location.constantIndex() == constantPool_.size() - 1);
-
-            replaceConstant(location.constantIndex(), dval);
+            location = OperandLocation::Immediate(-i);
             return true;
         }
 
-        return false;
+        WH_ASSERT(annot->isDouble());
+        Root<Value> dval(cx_);
+        if (!cx_->inHatchery().createNumber(-annot->doubleValue(), dval))
+            emitError("Could not allocate number.");
+
+        location = OperandLocation::Constant(addConstant(dval));
+        return true;
     }
 
     // TODO: Handle other cases.
@@ -418,6 +522,25 @@ BytecodeGenerator::emitBinaryOp(AST::BaseBinaryExpressionNode *expr,
     emitOperandLocation(outputLocation);
 }
 
+void
+BytecodeGenerator::emitPropertyOp(Opcode op,
+                                  AST::GetPropertyExpressionNode *expr)
+{
+    WH_ASSERT(op == Opcode::GetProp || op == Opcode::SetProp);
+    WH_ASSERT(expr->hasAnnotation());
+
+    uint32_t nameIdx = addStringConstant(expr->annotation());
+
+    // Each property access op gets its own cache.
+    uint32_t cacheIdx = currentPropertyCaches_++;
+    if (cacheIdx > ToUInt32(OperandMaxSignedValue))
+        emitError("Too many property accesses.");
+
+    emitOp(op);
+    emitConstantOperand(nameIdx);
+    emitImmediateSignedOperand(cacheIdx);
+}
+
 void
 BytecodeGenerator::emitPop(uint16_t num)
 {
@@ -645,25 +768,52 @@ BytecodeGenerator::emitByte(uint8_t byte)
 uint32_t
 BytecodeGenerator::addConstant(Value val)
 {
+    // Identical double constants share a single pool entry.  Doubles
+    // are keyed by bit pattern, so 0.0 and -0.0 (and distinct NaNs)
+    // are kept apart.
+    bool isDouble = val.isNumber() && !val.isInt32();
+    uint64_t bits = 0;
+    if (isDouble) {
+        bits = DoubleToInt(val.numberValue());
+        auto iter = doubleConstants_.find(bits);
+        if (iter != doubleConstants_.end())
+            return iter->second;
+    }
+
     uint32_t constIdx = constantPool_.size();
     if (constIdx > OperandMaxIndex)
         emitError("Too many constant values in script.");
     constantPool_.append(val);
+
+    if (isDouble)
+        doubleConstants_[bits] = constIdx;
     return constIdx;
 }
 
-Value
-BytecodeGenerator::getConstant(uint32_t idx)
+uint32_t
+BytecodeGenerator::addStringConstant(AST::StringAnnotation *annot)
 {
-    WH_ASSERT(idx <= OperandMaxIndex);
-    return constantPool_[idx];
+    // The annotator has already folded strings with identical text
+    // together, so each distinct string is interned once, and every
+    // use of it shares a single pool entry.
+    WH_ASSERT(annot->index() < stringConstants_.size());
+    uint32_t &constIdx = stringConstants_[annot->index()];
+    if (constIdx != NoStringConstant)
+        return constIdx;
+
+    Root<Value> strval(cx_);
+    if (!VM::NormalizeString(cx_, annot->chars(), annot->length(), &strval))
+        emitError("Could not allocate string constant.");
+
+    constIdx = addConstant(strval);
+    return constIdx;
 }
 
-void
-BytecodeGenerator::replaceConstant(uint32_t idx, Value val)
+Value
+BytecodeGenerator::getConstant(uint32_t idx)
 {
     WH_ASSERT(idx <= OperandMaxIndex);
-    constantPool_[idx] = val;
+    return constantPool_[idx];
 }
 
 void
@@ -1,6 +1,9 @@
 #ifndef WHISPER__INTERP__BYTECODEGEN_HPP
 #define WHISPER__INTERP__BYTECODEGEN_HPP
 
+#include <unordered_map>
+#include <vector>
+
 #include "common.hpp"
 #include "debug.hpp"
 #include "allocators.hpp"
@@ -61,6 +64,18 @@ class BytecodeGenerator
     // Rooted vector of all generated constants.
     VectorRoot<Value> constantPool_;
 
+    // Map from the bit patterns of double constants to their index
+    // in the constant pool.
+    std::unordered_map<uint64_t, uint32_t> doubleConstants_;
+
+    // Map from the annotator's string indices to their index in the
+    // constant pool, or NoStringConstant if not yet added.
+    static constexpr uint32_t NoStringConstant = UINT32_MAX;
+    std::vector<uint32_t> stringConstants_;
+
+    // The number of property caches used by property access ops.
+    uint32_t numPropertyCaches_ = 0;
+
 
     /// Intermediate state. ///
 
@@ -73,6 +88,9 @@ class BytecodeGenerator
     // The current stack depth.
     uint32_t currentStackDepth_ = 0;
 
+    // The number of property caches allocated so far.
+    uint32_t currentPropertyCaches_ = 0;
+
   public:
     BytecodeGenerator(RunContext *cx,
                       const STLBumpAllocator<uint8_t> &allocator,
@@ -85,6 +103,7 @@ class BytecodeGenerator
 
     VM::Bytecode *generateBytecode();
     bool constants(VM::Tuple *&tup);
+    bool propertyCaches(VM::Tuple *&tup);
 
     uint32_t maxStackDepth() const;
 
@@ -109,6 +128,8 @@ class BytecodeGenerator
                       const OperandLocation &rhsLocation,
                       const OperandLocation &outputLocation);
 
+    void emitPropertyOp(Opcode op, AST::GetPropertyExpressionNode *expr);
+
     void emitPop(uint16_t num=1);
 
     void emitOperandLocation(const OperandLocation &location);
@@ -124,8 +145,8 @@ class BytecodeGenerator
     void emitByte(uint8_t byte);
 
     uint32_t addConstant(Value val);
+    uint32_t addStringConstant(AST::StringAnnotation *annot);
     Value getConstant(uint32_t idx);
-    void replaceConstant(uint32_t idx, Value val);
     
     void emitError(const char *msg);
 };
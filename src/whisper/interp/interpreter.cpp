@@ -10,6 +10,8 @@
 #include "vm/stack_frame.hpp"
 #include "vm/bytecode.hpp"
 #include "vm/arithmetic_ops.hpp"
+#include "vm/object.hpp"
+#include "vm/shape_tree.hpp"
 #include "interp/interpreter.hpp"
 
 namespace Whisper {
@@ -91,6 +93,11 @@ Interpreter::interpret()
                 return false;
             break;
 
+          case Opcode::Push:
+            if (!interpretPush(op, &opBytes))
+                return false;
+            break;
+
           case Opcode::Ret_S:
             // TODO: implement
             WH_UNREACHABLE("Unhandled op Ret_S.");
@@ -101,6 +108,16 @@ Interpreter::interpret()
             WH_UNREACHABLE("Unhandled op Ret_V.");
             break;
 
+          case Opcode::GetProp: // VV
+            if (!interpretGetProp(op, &opBytes))
+                return false;
+            break;
+
+          case Opcode::SetProp: // VV
+            if (!interpretSetProp(op, &opBytes))
+                return false;
+            break;
+
           case Opcode::Add_SSS: // E
           case Opcode::Add_SSV: // V
           case Opcode::Add_SVS: // V
@@ -178,42 +195,81 @@ Interpreter::interpret()
 }
 
 
-Value
-Interpreter::readOperand(const OperandLocation &loc)
+bool
+Interpreter::readOperand(const OperandLocation &loc, MutHandle<Value> out)
+{
+    // Raw doubles escaping the frame must be boxed.
+    double raw;
+    if (readOperandUnboxed(loc, out, &raw))
+        return boxRawDouble(raw, out);
+    return true;
+}
+
+//
+// Read an operand without boxing it.  If the operand is a raw double
+// slot, then |rawOut| is set to its value and true is returned.
+// Otherwise, |out| is set to the operand value and false is returned.
+//
+bool
+Interpreter::readOperandUnboxed(const OperandLocation &loc,
+                                MutHandle<Value> out,
+                                double *rawOut)
 {
+    uint32_t slot;
     switch (loc.space()) {
       case OperandSpace::Constant:
         WH_ASSERT(script_->constants());
-        return script_->constants()->get(0);
+        out = script_->constants()->get(loc.constantIndex());
+        return false;
 
       case OperandSpace::Argument:
-        return frame_->getArg(loc.argumentIndex());
+        slot = frame_->argSlot(loc.argumentIndex());
+        if (frame_->slotIsRawDouble(slot))
+            break;
+        out = frame_->getArg(loc.argumentIndex());
+        return false;
 
       case OperandSpace::Local:
-        return frame_->getLocal(loc.localIndex());
+        slot = frame_->localSlot(loc.localIndex());
+        if (frame_->slotIsRawDouble(slot))
+            break;
+        out = frame_->getLocal(loc.localIndex());
+        return false;
 
       case OperandSpace::Stack:
-        return frame_->peekStack(loc.stackIndex());
+        slot = frame_->stackSlot(loc.stackIndex());
+        if (frame_->slotIsRawDouble(slot))
+            break;
+        out = frame_->peekStack(loc.stackIndex());
+        return false;
 
       case OperandSpace::Immediate:
         if (loc.isSigned()) {
-            return Value::Int32(loc.signedValue());
+            out = Value::Int32(loc.signedValue());
         } else {
             WH_ASSERT(loc.unsignedValue() < 0xFu);
-            return Value::Int32(loc.unsignedValue());
+            out = Value::Int32(loc.unsignedValue());
         }
+        return false;
 
       case OperandSpace::StackTop:
-        {
-            Value result = frame_->peekStack(0);
+        slot = frame_->stackSlot(0);
+        if (frame_->slotIsRawDouble(slot)) {
+            *rawOut = frame_->getSlotRawDouble(slot);
             frame_->popStack();
-            return result;
+            return true;
         }
+        out = frame_->peekStack(0);
+        frame_->popStack();
+        return false;
 
       default:
         WH_UNREACHABLE("Invalid operand kind.");
+        return false;
     }
-    return Value::Undefined();
+
+    *rawOut = frame_->getSlotRawDouble(slot);
+    return true;
 }
 
 void
@@ -234,6 +290,7 @@ Interpreter::writeOperand(const OperandLocation &loc, const Value &val)
 
       case OperandSpace::Stack:
         frame_->pokeStack(loc.stackIndex(), val);
+        break;
 
       case OperandSpace::Immediate:
         WH_UNREACHABLE("Immediate is not a valid write location!");
@@ -248,6 +305,60 @@ Interpreter::writeOperand(const OperandLocation &loc, const Value &val)
     }
 }
 
+//
+// Write a number result.  Numbers which can be represented as immediate
+// values are written boxed.  Others are written to the frame as raw
+// doubles, instead of being boxed into newly allocated HeapDoubles.
+//
+void
+Interpreter::writeNumberOperand(const OperandLocation &loc, double d)
+{
+    if (Value::IsImmediateNumber(d)) {
+        writeOperand(loc, Value::Number(d));
+        return;
+    }
+
+    switch (loc.space()) {
+      case OperandSpace::Constant:
+        WH_UNREACHABLE("Constant is not a valid write location!");
+        break;
+
+      case OperandSpace::Argument:
+        frame_->setSlotRawDouble(frame_->argSlot(loc.argumentIndex()), d);
+        break;
+
+      case OperandSpace::Local:
+        frame_->setSlotRawDouble(frame_->localSlot(loc.localIndex()), d);
+        break;
+
+      case OperandSpace::Stack:
+        frame_->setSlotRawDouble(frame_->stackSlot(loc.stackIndex()), d);
+        break;
+
+      case OperandSpace::Immediate:
+        WH_UNREACHABLE("Immediate is not a valid write location!");
+        break;
+
+      case OperandSpace::StackTop:
+        frame_->pushStackRawDouble(d);
+        break;
+
+      default:
+        WH_UNREACHABLE("Invalid operand kind.");
+    }
+}
+
+bool
+Interpreter::boxRawDouble(double d, MutHandle<Value> out)
+{
+    Root<Value> result(cx_);
+    if (!cx_->inHatchery().createNumber(d, result))
+        return false;
+
+    out = result.get();
+    return true;
+}
+
 
 bool
 Interpreter::interpretStop(Opcode op, int32_t *opBytes)
@@ -300,90 +411,282 @@ Interpreter::interpretPushInt(Opcode op, int32_t *opBytes)
     return true;
 }
 
-
 bool
-Interpreter::interpretAdd(Opcode op, int32_t *opBytes)
+Interpreter::interpretPush(Opcode op, int32_t *opBytes)
 {
-    Root<Value> lhs(cx_, Value::Undefined());
-    Root<Value> rhs(cx_, Value::Undefined());
-    OperandLocation outLoc;
+    WH_ASSERT(op == Opcode::Push);
+    WH_ASSERT(GetOpcodeFormat(op) == OpcodeFormat::V);
 
-    readBinaryOperandValues(op, Opcode::Add_SSS, &lhs, &rhs, &outLoc, opBytes);
+    OperandLocation oploc;
+    *opBytes += ReadOperandLocation(pc_ + *opBytes, pcEnd_, OpcodeFormat::V,
+                                    0, &oploc);
 
-    Root<Value> result(cx_);
-    if (!VM::PerformAdd(cx_, lhs, rhs, &result))
+    Root<Value> val(cx_);
+    if (!readOperand(oploc, &val))
         return false;
 
-    writeOperand(outLoc, result);
+    frame_->pushStack(val);
     return true;
 }
 
 
 bool
-Interpreter::interpretSub(Opcode op, int32_t *opBytes)
+Interpreter::interpretGetProp(Opcode op, int32_t *opBytes)
 {
-    Root<Value> lhs(cx_, Value::Undefined());
-    Root<Value> rhs(cx_, Value::Undefined());
-    OperandLocation outLoc;
+    Root<Value> name(cx_);
+    uint32_t cacheIdx;
+    readPropertyOperands(op, &name, &cacheIdx, opBytes);
 
-    readBinaryOperandValues(op, Opcode::Sub_SSS, &lhs, &rhs, &outLoc, opBytes);
+    Root<Value> object(cx_);
+    if (!readOperand(OperandLocation::StackTop(), &object))
+        return false;
+
+    if (!object->isObject() || !object->objectPtr()->isShapedObject()) {
+        SpewInterpOpError("Can't get properties of this value yet.");
+        return false;
+    }
+    VM::ShapedObject *obj = object->objectPtr()->toShapedObject();
+
+    // Objects with a cached shape have the property in a known slot.
+    uint32_t slotIndex;
+    bool isDynamic;
+    if (script_->lookupPropertyCache(cacheIdx, obj->shape(), &slotIndex,
+                                     &isDynamic))
+    {
+        if (isDynamic)
+            frame_->pushStack(obj->dynamicSlotValue(slotIndex));
+        else
+            frame_->pushStack(obj->fixedSlotValue(slotIndex));
+        return true;
+    }
+
+    // Otherwise, look the property up, and cache its slot if it has one.
+    // Dictionary mode objects have no property shapes.
+    VM::Shape *propShape = nullptr;
+    if (!obj->inDictionaryMode()) {
+        if (!lookupPropertyShape(obj, name, &propShape))
+            return false;
+    }
+
+    if (propShape && propShape->hasValue() && propShape->isWritable()) {
+        VM::ValueShape *valueShape = propShape->toValueShape();
+        cachePropertySlot(cacheIdx, obj->shape(), valueShape);
+        frame_->pushStack(obj->slotValue(valueShape->slotIndex()));
+        return true;
+    }
 
     Root<Value> result(cx_);
-    if (!VM::PerformSub(cx_, lhs, rhs, &result))
+    if (!obj->getProperty(cx_, name, &result))
         return false;
 
-    writeOperand(outLoc, result);
+    frame_->pushStack(result);
     return true;
 }
 
 
 bool
-Interpreter::interpretMul(Opcode op, int32_t *opBytes)
+Interpreter::interpretSetProp(Opcode op, int32_t *opBytes)
 {
-    Root<Value> lhs(cx_, Value::Undefined());
-    Root<Value> rhs(cx_, Value::Undefined());
-    OperandLocation outLoc;
+    Root<Value> name(cx_);
+    uint32_t cacheIdx;
+    readPropertyOperands(op, &name, &cacheIdx, opBytes);
 
-    readBinaryOperandValues(op, Opcode::Mul_SSS, &lhs, &rhs, &outLoc, opBytes);
+    // The value is above the object on the stack.
+    Root<Value> value(cx_);
+    if (!readOperand(OperandLocation::StackTop(), &value))
+        return false;
 
-    Root<Value> result(cx_);
-    if (!VM::PerformMul(cx_, lhs, rhs, &result))
+    Root<Value> object(cx_);
+    if (!readOperand(OperandLocation::StackTop(), &object))
         return false;
 
-    writeOperand(outLoc, result);
+    if (!object->isObject() || !object->objectPtr()->isShapedObject()) {
+        SpewInterpOpError("Can't set properties of this value yet.");
+        return false;
+    }
+    VM::ShapedObject *obj = object->objectPtr()->toShapedObject();
+
+    // Objects with a cached shape have the property in a known slot.
+    uint32_t slotIndex;
+    bool isDynamic;
+    if (script_->lookupPropertyCache(cacheIdx, obj->shape(), &slotIndex,
+                                     &isDynamic))
+    {
+        if (isDynamic)
+            obj->setDynamicSlotValue(slotIndex, value);
+        else
+            obj->setFixedSlotValue(slotIndex, value);
+        frame_->pushStack(value);
+        return true;
+    }
+
+    // Otherwise, look the property up.  Writes to existing value
+    // properties are cached, while additions and writes to dictionary
+    // mode objects take the generic path.
+    VM::Shape *propShape = nullptr;
+    if (!obj->inDictionaryMode()) {
+        if (!lookupPropertyShape(obj, name, &propShape))
+            return false;
+    }
+
+    if (propShape && propShape->hasValue() && propShape->isWritable()) {
+        VM::ValueShape *valueShape = propShape->toValueShape();
+        cachePropertySlot(cacheIdx, obj->shape(), valueShape);
+        obj->setSlotValue(valueShape->slotIndex(), value);
+    } else {
+        if (!obj->setProperty(cx_, name, value))
+            return false;
+    }
+
+    frame_->pushStack(value);
     return true;
 }
 
 
+void
+Interpreter::readPropertyOperands(Opcode op, MutHandle<Value> name,
+                                  uint32_t *cacheIdx, int32_t *opBytes)
+{
+    WH_ASSERT(GetOpcodeFormat(op) == OpcodeFormat::VV);
+
+    const OpcodeFormat V = OpcodeFormat::V;
+
+    OperandLocation nameLoc;
+    *opBytes += ReadOperandLocation(pc_ + *opBytes, pcEnd_, V, 0, &nameLoc);
+    WH_ASSERT(nameLoc.isConstant());
+    name = script_->constants()->get(nameLoc.constantIndex());
+
+    OperandLocation cacheLoc;
+    *opBytes += ReadOperandLocation(pc_ + *opBytes, pcEnd_, V, 0, &cacheLoc);
+    WH_ASSERT(cacheLoc.isImmediate() && cacheLoc.isSigned());
+    WH_ASSERT(cacheLoc.signedValue() >= 0);
+    *cacheIdx = cacheLoc.signedValue();
+}
+
+
+// Look up a property for a property access op which missed in its
+// cache.  Sites which see many shapes keep missing in their own caches,
+// so the thread's shape property cache is checked before doing a full
+// lookup.
 bool
-Interpreter::interpretDiv(Opcode op, int32_t *opBytes)
+Interpreter::lookupPropertyShape(VM::ShapedObject *obj, Handle<Value> name,
+                                 VM::Shape **result)
 {
-    Root<Value> lhs(cx_, Value::Undefined());
-    Root<Value> rhs(cx_, Value::Undefined());
-    OperandLocation outLoc;
+    ThreadContext *threadCx = cx_->threadContext();
+    VM::Shape *objShape = obj->shape();
 
-    readBinaryOperandValues(op, Opcode::Div_SSS, &lhs, &rhs, &outLoc, opBytes);
+    if (VM::Shape *cached = threadCx->lookupShapeProperty(objShape, name)) {
+        *result = cached;
+        return true;
+    }
 
-    Root<Value> result(cx_);
-    if (!VM::PerformDiv(cx_, lhs, rhs, &result))
+    if (!obj->lookupProperty(cx_, name, result))
         return false;
 
-    writeOperand(outLoc, result);
+    if (*result)
+        threadCx->cacheShapeProperty(objShape, name, *result);
     return true;
 }
 
 
+void
+Interpreter::cachePropertySlot(uint32_t cacheIdx, VM::Shape *objShape,
+                               VM::ValueShape *propShape)
+{
+    // A full cache is left as is.
+    if (propShape->isDynamicSlot()) {
+        script_->addPropertyCacheEntry(cacheIdx, objShape,
+                                       propShape->dynamicSlotIndex(), true);
+    } else {
+        script_->addPropertyCacheEntry(cacheIdx, objShape,
+                                       propShape->slotIndex(), false);
+    }
+}
+
+
+bool
+Interpreter::interpretAdd(Opcode op, int32_t *opBytes)
+{
+    return interpretBinaryArith(op, Opcode::Add_SSS, VM::PerformNumberAdd,
+                                VM::PerformAdd, opBytes);
+}
+
+
+bool
+Interpreter::interpretSub(Opcode op, int32_t *opBytes)
+{
+    return interpretBinaryArith(op, Opcode::Sub_SSS, VM::PerformNumberSub,
+                                VM::PerformSub, opBytes);
+}
+
+
+bool
+Interpreter::interpretMul(Opcode op, int32_t *opBytes)
+{
+    return interpretBinaryArith(op, Opcode::Mul_SSS, VM::PerformNumberMul,
+                                VM::PerformMul, opBytes);
+}
+
+
+bool
+Interpreter::interpretDiv(Opcode op, int32_t *opBytes)
+{
+    return interpretBinaryArith(op, Opcode::Div_SSS, VM::PerformNumberDiv,
+                                VM::PerformDiv, opBytes);
+}
+
+
 bool
 Interpreter::interpretMod(Opcode op, int32_t *opBytes)
 {
+    return interpretBinaryArith(op, Opcode::Mod_SSS, VM::PerformNumberMod,
+                                VM::PerformMod, opBytes);
+}
+
+
+bool
+Interpreter::interpretNeg(Opcode op, int32_t *opBytes)
+{
+    return interpretUnaryArith(op, Opcode::Neg_SS, VM::PerformNumberNeg,
+                               VM::PerformNeg, opBytes);
+}
+
+
+bool
+Interpreter::interpretBinaryArith(Opcode op, Opcode baseOp,
+                                  NumberBinaryOp numberOp,
+                                  GenericBinaryOp genericOp,
+                                  int32_t *opBytes)
+{
+    OperandLocation lhsLoc;
+    OperandLocation rhsLoc;
+    OperandLocation outLoc;
+    readBinaryOperandLocations(op, baseOp, &lhsLoc, &rhsLoc, &outLoc, opBytes);
+
+    // Read the rhs first, see readBinaryOperandValues.
     Root<Value> lhs(cx_, Value::Undefined());
     Root<Value> rhs(cx_, Value::Undefined());
-    OperandLocation outLoc;
+    double lhsRaw = 0.0;
+    double rhsRaw = 0.0;
+    bool rhsIsRaw = readOperandUnboxed(rhsLoc, &rhs, &rhsRaw);
+    bool lhsIsRaw = readOperandUnboxed(lhsLoc, &lhs, &lhsRaw);
+
+    // If both operands are numbers, compute the result unboxed.
+    if ((lhsIsRaw || lhs->isNumber()) && (rhsIsRaw || rhs->isNumber())) {
+        double lhsVal = lhsIsRaw ? lhsRaw : lhs->numberValue();
+        double rhsVal = rhsIsRaw ? rhsRaw : rhs->numberValue();
+        writeNumberOperand(outLoc, numberOp(lhsVal, rhsVal));
+        return true;
+    }
 
-    readBinaryOperandValues(op, Opcode::Mod_SSS, &lhs, &rhs, &outLoc, opBytes);
+    // Otherwise, box any raw operand and use the generic operation.
+    if (lhsIsRaw && !boxRawDouble(lhsRaw, &lhs))
+        return false;
+    if (rhsIsRaw && !boxRawDouble(rhsRaw, &rhs))
+        return false;
 
     Root<Value> result(cx_);
-    if (!VM::PerformMod(cx_, lhs, rhs, &result))
+    if (!genericOp(cx_, lhs, rhs, &result))
         return false;
 
     writeOperand(outLoc, result);
@@ -392,15 +695,27 @@ Interpreter::interpretMod(Opcode op, int32_t *opBytes)
 
 
 bool
-Interpreter::interpretNeg(Opcode op, int32_t *opBytes)
+Interpreter::interpretUnaryArith(Opcode op, Opcode baseOp,
+                                 NumberUnaryOp numberOp,
+                                 GenericUnaryOp genericOp,
+                                 int32_t *opBytes)
 {
-    Root<Value> input(cx_, Value::Undefined());
+    OperandLocation inLoc;
     OperandLocation outLoc;
+    readUnaryOperandLocations(op, baseOp, &inLoc, &outLoc, opBytes);
 
-    readUnaryOperandValues(op, Opcode::Neg_SS, &input, &outLoc, opBytes);
+    Root<Value> input(cx_, Value::Undefined());
+    double inputRaw = 0.0;
+    bool inputIsRaw = readOperandUnboxed(inLoc, &input, &inputRaw);
+
+    if (inputIsRaw || input->isNumber()) {
+        double inputVal = inputIsRaw ? inputRaw : input->numberValue();
+        writeNumberOperand(outLoc, numberOp(inputVal));
+        return true;
+    }
 
     Root<Value> result(cx_);
-    if (!VM::PerformNeg(cx_, input, &result))
+    if (!genericOp(cx_, input, &result))
         return false;
 
     writeOperand(outLoc, result);
@@ -440,7 +755,7 @@ Interpreter::readBinaryOperandLocations(Opcode op, Opcode baseOp,
 }
 
 
-void
+bool
 Interpreter::readBinaryOperandValues(Opcode op, Opcode baseOp,
                                      MutHandle<Value> lhs,
                                      MutHandle<Value> rhs,
@@ -454,8 +769,9 @@ Interpreter::readBinaryOperandValues(Opcode op, Opcode baseOp,
     // Read the operands.  Read the rhs first because if both lhs and
     // rhs are read from the StackTop, then they should be popped in
     // the right order (rhs, then lhs).
-    rhs = readOperand(rhsLoc);
-    lhs = readOperand(lhsLoc);
+    if (!readOperand(rhsLoc, rhs))
+        return false;
+    return readOperand(lhsLoc, lhs);
 }
 
 
@@ -467,7 +783,7 @@ Interpreter::readUnaryOperandLocations(Opcode op, Opcode baseOp,
 {
     unsigned opcodeOffset = OpcodeNumber(op) - OpcodeNumber(baseOp);
     WH_ASSERT(opcodeOffset < 4);
-    bool inputIsValue = opcodeOffset & (1 << 2);
+    bool inputIsValue = opcodeOffset & (1 << 1);
     bool outIsValue = opcodeOffset & (1 << 0);
 
     const OpcodeFormat V = OpcodeFormat::V;
@@ -484,7 +800,7 @@ Interpreter::readUnaryOperandLocations(Opcode op, Opcode baseOp,
 }
 
 
-void
+bool
 Interpreter::readUnaryOperandValues(Opcode op, Opcode baseOp,
                                     MutHandle<Value> in,
                                     OperandLocation *outLoc,
@@ -493,10 +809,7 @@ Interpreter::readUnaryOperandValues(Opcode op, Opcode baseOp,
     OperandLocation inLoc;
     readUnaryOperandLocations(op, baseOp, &inLoc, outLoc, opBytes);
 
-    // Read the operands.  Read the rhs first because if both lhs and
-    // rhs are read from the StackTop, then they should be popped in
-    // the right order (rhs, then lhs).
-    in = readOperand(inLoc);
+    return readOperand(inLoc, in);
 }
 
 
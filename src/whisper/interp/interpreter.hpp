@@ -4,6 +4,7 @@
 #include "common.hpp"
 #include "runtime.hpp"
 #include "vm/script.hpp"
+#include "vm/shape_tree.hpp"
 #include "vm/stack_frame.hpp"
 #include "interp/bytecode_ops.hpp"
 
@@ -44,11 +45,28 @@ class Interpreter
     bool interpret();
 
   private:
-    Value readOperand(const OperandLocation &loc);
+    typedef bool (*GenericBinaryOp)(RunContext *cx,
+                                    Handle<Value> lhs, Handle<Value> rhs,
+                                    MutHandle<Value> out);
+    typedef double (*NumberBinaryOp)(double lhs, double rhs);
+
+    typedef bool (*GenericUnaryOp)(RunContext *cx, Handle<Value> in,
+                                   MutHandle<Value> out);
+    typedef double (*NumberUnaryOp)(double in);
+
+    bool readOperand(const OperandLocation &loc, MutHandle<Value> out);
+    bool readOperandUnboxed(const OperandLocation &loc, MutHandle<Value> out,
+                            double *rawOut);
     void writeOperand(const OperandLocation &loc, const Value &val);
+    void writeNumberOperand(const OperandLocation &loc, double d);
+
+    bool boxRawDouble(double d, MutHandle<Value> out);
 
     bool interpretStop(Opcode op, int32_t *opBytes);
     bool interpretPushInt(Opcode op, int32_t *opBytes);
+    bool interpretPush(Opcode op, int32_t *opBytes);
+    bool interpretGetProp(Opcode op, int32_t *opBytes);
+    bool interpretSetProp(Opcode op, int32_t *opBytes);
     bool interpretAdd(Opcode op, int32_t *opBytes);
     bool interpretSub(Opcode op, int32_t *opBytes);
     bool interpretMul(Opcode op, int32_t *opBytes);
@@ -57,13 +75,23 @@ class Interpreter
 
     bool interpretNeg(Opcode op, int32_t *opBytes);
 
+    bool interpretBinaryArith(Opcode op, Opcode baseOp,
+                              NumberBinaryOp numberOp,
+                              GenericBinaryOp genericOp,
+                              int32_t *opBytes);
+
+    bool interpretUnaryArith(Opcode op, Opcode baseOp,
+                             NumberUnaryOp numberOp,
+                             GenericUnaryOp genericOp,
+                             int32_t *opBytes);
+
     void readBinaryOperandLocations(Opcode op, Opcode baseOp,
                                     OperandLocation *lhsLoc,
                                     OperandLocation *rhsLoc,
                                     OperandLocation *outLoc,
                                     int32_t *opBytes);
 
-    void readBinaryOperandValues(Opcode op, Opcode baseOp,
+    bool readBinaryOperandValues(Opcode op, Opcode baseOp,
                                  MutHandle<Value> lhs,
                                  MutHandle<Value> rhs,
                                  OperandLocation *outLoc,
@@ -74,10 +102,19 @@ class Interpreter
                                    OperandLocation *outLoc,
                                    int32_t *opBytes);
 
-    void readUnaryOperandValues(Opcode op, Opcode baseOp,
+    bool readUnaryOperandValues(Opcode op, Opcode baseOp,
                                  MutHandle<Value> in,
                                  OperandLocation *outLoc,
                                  int32_t *opBytes);
+
+    void readPropertyOperands(Opcode op, MutHandle<Value> name,
+                              uint32_t *cacheIdx, int32_t *opBytes);
+
+    bool lookupPropertyShape(VM::ShapedObject *obj, Handle<Value> name,
+                             VM::Shape **result);
+
+    void cachePropertySlot(uint32_t cacheIdx, VM::Shape *objShape,
+                           VM::ValueShape *propShape);
 };
 
 
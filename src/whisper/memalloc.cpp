@@ -3,6 +3,7 @@
 #include <sys/mman.h>
 
 #include "spew.hpp"
+#include "helpers.hpp"
 #include "memalloc.hpp"
 
 namespace Whisper {
@@ -47,6 +48,33 @@ AllocateMappedMemory(size_t bytes, bool allowExec)
     return result;
 }
 
+void *
+AllocateAlignedMappedMemory(size_t bytes, size_t align)
+{
+    WH_ASSERT(IsPowerOfTwo(align));
+
+    // Over-allocate by the alignment, and trim off the unaligned
+    // prefix and the excess suffix.
+    uint8_t *region = reinterpret_cast<uint8_t *>(
+                        AllocateMappedMemory(bytes + align));
+    if (!region)
+        return nullptr;
+
+    uint8_t *result = AlignPtrUp(region, align);
+    size_t prefix = result - region;
+    size_t suffix = align - prefix;
+
+    if (prefix > 0)
+        munmap(region, prefix);
+    if (suffix > 0)
+        munmap(result + bytes, suffix);
+
+    SpewMemoryNote("AllocateAlignedMappedMemory mapped %ld bytes at %p "
+                   "(align=%ld)", (long)bytes, result, (long)align);
+
+    return result;
+}
+
 bool
 ReleaseMappedMemory(void *ptr, size_t bytes)
 {
@@ -23,6 +23,14 @@ void ReleaseMemory(void *ptr);
 void *AllocateMappedMemory(size_t bytes, bool allowExec=false);
 bool ReleaseMappedMemory(void *ptr, size_t bytes);
 
+// Allocates an amount of mmap-ed memory, with the start of the
+// mapping aligned to |align| bytes.  The |align| must be a power
+// of two multiple of the system page size.  The memory is released
+// with ReleaseMappedMemory.
+//
+// Returns NULL on failure.
+void *AllocateAlignedMappedMemory(size_t bytes, size_t align);
+
 
 
 } // namespace Whisper
@@ -4,11 +4,136 @@
 #include "parser/syntax_tree_inlines.hpp"
 
 #include <stdlib.h>
+#include <string.h>
 
 namespace Whisper {
 namespace AST {
 
 
+static constexpr uint32_t INITIAL_STRING_SLOTS = 64;
+
+// Hash the source text of a string with FNV-1a.  The text only needs
+// to be hashed consistently within one compile, so no spoiler is used.
+static uint32_t
+HashSourceText(const uint8_t *text, uint32_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < length; i++) {
+        hash ^= text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t
+HexDigitValue(uint8_t ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
+    WH_ASSERT(ch >= 'A' && ch <= 'F');
+    return ch - 'A' + 10;
+}
+
+static uint32_t
+ReadHexDigits(const uint8_t *text, uint32_t count)
+{
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < count; i++)
+        value = (value << 4) | HexDigitValue(text[i]);
+    return value;
+}
+
+// Read one UTF-8 encoded char at text[*pos], advancing *pos past it.
+// The tokenizer has already validated the encoding.
+static unic_t
+ReadSourceChar(const uint8_t *text, uint32_t *pos)
+{
+    unic_t ch = text[(*pos)++];
+    if (ch <= 0x7F)
+        return ch;
+
+    unsigned extra;
+    if (ch <= 0xDF) {
+        ch &= 0x1F;
+        extra = 1;
+    } else if (ch <= 0xEF) {
+        ch &= 0x0F;
+        extra = 2;
+    } else {
+        ch &= 0x07;
+        extra = 3;
+    }
+
+    for (unsigned i = 0; i < extra; i++)
+        ch = (ch << 6) | (text[(*pos)++] & 0x3F);
+    return ch;
+}
+
+// Decode the source text of an identifier name or string literal body
+// into UTF-16 chars, resolving escape sequences.  The output never
+// holds more chars than the text has bytes.  Returns the number of
+// chars written.
+static uint32_t
+DecodeSourceText(const uint8_t *text, uint32_t length, uint16_t *out)
+{
+    static constexpr unic_t LS = 0x2028;
+    static constexpr unic_t PS = 0x2029;
+
+    uint32_t pos = 0;
+    uint32_t outLength = 0;
+    while (pos < length) {
+        unic_t ch = ReadSourceChar(text, &pos);
+
+        if (ch == '\\') {
+            WH_ASSERT(pos < length);
+            unic_t esc = ReadSourceChar(text, &pos);
+            switch (esc) {
+              case 'n': ch = '\n'; break;
+              case 'r': ch = '\r'; break;
+              case 't': ch = '\t'; break;
+              case 'v': ch = '\v'; break;
+              case 'b': ch = '\b'; break;
+              case 'f': ch = '\f'; break;
+              case '0': ch = 0; break;
+              case 'x':
+                ch = ReadHexDigits(text + pos, 2);
+                pos += 2;
+                break;
+              case 'u':
+                ch = ReadHexDigits(text + pos, 4);
+                pos += 4;
+                break;
+              case '\r':
+                if (pos < length && text[pos] == '\n')
+                    pos++;
+                continue;
+              case '\n':
+              case LS:
+              case PS:
+                // Line continuations contribute no chars.
+                continue;
+              default:
+                ch = esc;
+                break;
+            }
+        }
+
+        if (ch > 0xFFFF) {
+            ch -= 0x10000;
+            out[outLength++] = 0xD800 | (ch >> 10);
+            out[outLength++] = 0xDC00 | (ch & 0x3FF);
+            continue;
+        }
+        out[outLength++] = ch;
+    }
+
+    WH_ASSERT(outLength <= length);
+    return outLength;
+}
+
+
 bool
 SyntaxAnnotator::annotate()
 {
@@ -45,6 +170,8 @@ SyntaxAnnotator::annotateThis(ThisNode *node, BaseNode *parent)
 void
 SyntaxAnnotator::annotateIdentifier(IdentifierNode *node, BaseNode *parent)
 {
+    const IdentifierNameToken &tok = node->token();
+    node->setAnnotation(internString(tok.text(source_), tok.length()));
 }
 
 void
@@ -92,7 +219,7 @@ SyntaxAnnotator::annotateNumericLiteral(NumericLiteralNode *node,
     bool failed = false;
     int32_t accum = 0;
     while (cur < text + length) {
-        uint8_t digit = *cur;
+        uint8_t digit = *cur++;
         accum *= 10;
         accum += (digit - '0');
         if (accum > LIMIT) {
@@ -125,7 +252,13 @@ SyntaxAnnotator::annotateNumericLiteral(NumericLiteralNode *node,
 void
 SyntaxAnnotator::annotateStringLiteral(StringLiteralNode *node,
                                        BaseNode *parent)
-{}
+{
+    // Strip the quotes from the literal's text.
+    const StringLiteralToken &tok = node->value();
+    WH_ASSERT(tok.length() >= 2);
+    node->setAnnotation(internString(tok.text(source_) + 1,
+                                     tok.length() - 2));
+}
 
 void
 SyntaxAnnotator::annotateRegularExpressionLiteral(
@@ -179,6 +312,9 @@ SyntaxAnnotator::annotateGetPropertyExpression(
         GetPropertyExpressionNode *node, BaseNode *parent)
 {
     annotate(node->object(), node);
+
+    const IdentifierNameToken &prop = node->property();
+    node->setAnnotation(internString(prop.text(source_), prop.length()));
 }
 
 void
@@ -510,6 +646,61 @@ SyntaxAnnotator::annotateFunctionDeclaration(FunctionDeclarationNode *node,
 }
 
 
+StringAnnotation *
+SyntaxAnnotator::internString(const uint8_t *text, uint32_t length)
+{
+    if (stringSlots_.empty())
+        stringSlots_.resize(INITIAL_STRING_SLOTS, 0);
+
+    // Look for an earlier string with the same source text.
+    uint32_t hash = HashSourceText(text, length);
+    uint32_t mask = stringSlots_.size() - 1;
+    uint32_t slot = hash & mask;
+    for (;;) {
+        uint32_t entry = stringSlots_[slot];
+        if (entry == 0)
+            break;
+
+        StringAnnotation *annot = strings_[entry - 1];
+        if (annot->textHash_ == hash && annot->textLength_ == length &&
+            memcmp(annot->text_, text, length) == 0)
+        {
+            return annot;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    // Decode a new string.
+    uint16_t *chars = allocatorFor<uint16_t>().allocate(length ? length : 1);
+    uint32_t charsLength = DecodeSourceText(text, length, chars);
+
+    uint32_t index = strings_.size();
+    StringAnnotation *annot = make<StringAnnotation>(
+        index, text, length, hash, chars, charsLength);
+    strings_.push_back(annot);
+    stringSlots_[slot] = index + 1;
+
+    // Keep the table at most half full.
+    if (strings_.size() * 2 > stringSlots_.size())
+        growStringSlots();
+
+    return annot;
+}
+
+void
+SyntaxAnnotator::growStringSlots()
+{
+    std::vector<uint32_t> newSlots(stringSlots_.size() * 2, 0);
+    uint32_t mask = newSlots.size() - 1;
+    for (uint32_t i = 0; i < strings_.size(); i++) {
+        uint32_t slot = strings_[i]->textHash_ & mask;
+        while (newSlots[slot] != 0)
+            slot = (slot + 1) & mask;
+        newSlots[slot] = i + 1;
+    }
+    stringSlots_.swap(newSlots);
+}
+
 void
 SyntaxAnnotator::emitError(const char *error)
 {
@@ -2,6 +2,7 @@
 #define WHISPER__PARSER__SYNTAX_ANNOTATIONS_HPP
 
 #include <list>
+#include <vector>
 #include "allocators.hpp"
 #include "parser/tokenizer.hpp"
 #include "parser/syntax_defn.hpp"
@@ -11,6 +12,7 @@ namespace Whisper {
 namespace AST {
 
 class BaseNode;
+class StringAnnotation;
 
 //
 // The syntax annotator applies annotations to syntax trees.
@@ -35,6 +37,14 @@ class SyntaxAnnotator
 
     const char *error_ = nullptr;
 
+    // Distinct strings (identifier names and string literal values)
+    // seen so far in this compile, by index.
+    std::vector<StringAnnotation *> strings_;
+
+    // Open-addressed table over the source text of strings_, holding
+    // index + 1 for each string, or 0 for an empty slot.
+    std::vector<uint32_t> stringSlots_;
+
   public:
     SyntaxAnnotator(STLBumpAllocator<uint8_t> allocator,
                     BaseNode *root, const CodeSource &source)
@@ -51,9 +61,21 @@ class SyntaxAnnotator
 
     bool annotate();
 
+    uint32_t numStrings() const {
+        return strings_.size();
+    }
+
+    StringAnnotation *string(uint32_t index) const {
+        WH_ASSERT(index < strings_.size());
+        return strings_[index];
+    }
+
   private:
     void annotate(BaseNode *node, BaseNode *parent);
 
+    StringAnnotation *internString(const uint8_t *text, uint32_t length);
+    void growStringSlots();
+
 #define DEF_ANNOT_(name) \
     void annotate##name(name##Node *node, BaseNode *parent);
       WHISPER_DEFN_SYNTAX_NODES(DEF_ANNOT_);
@@ -122,6 +144,56 @@ class NumericLiteralAnnotation
     }
 };
 
+//
+// Annotates IdentifierNodes, StringLiteralNodes and property names
+// with their string value.
+//
+// Strings with the same source text share a single annotation, so
+// the bytecode generator only has to intern each distinct string once
+// per compile.  The index numbers the distinct strings of the compile
+// in order of first appearance.
+//
+class StringAnnotation
+{
+  friend class SyntaxAnnotator;
+  private:
+    uint32_t index_;
+
+    // The source text of the string, with escapes and without quotes.
+    const uint8_t *text_;
+    uint32_t textLength_;
+    uint32_t textHash_;
+
+    // The decoded UTF-16 chars of the string.
+    const uint16_t *chars_;
+    uint32_t length_;
+
+    StringAnnotation(uint32_t index,
+                     const uint8_t *text, uint32_t textLength,
+                     uint32_t textHash,
+                     const uint16_t *chars, uint32_t length)
+      : index_(index),
+        text_(text),
+        textLength_(textLength),
+        textHash_(textHash),
+        chars_(chars),
+        length_(length)
+    {}
+
+  public:
+    uint32_t index() const {
+        return index_;
+    }
+
+    const uint16_t *chars() const {
+        return chars_;
+    }
+
+    uint32_t length() const {
+        return length_;
+    }
+};
+
 
 } // namespace AST
 } // namespace Whisper
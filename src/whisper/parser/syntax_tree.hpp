@@ -12,6 +12,7 @@ namespace AST {
 // Annotation forward declarations.
 //
 class NumericLiteralAnnotation;
+class StringAnnotation;
 
 //
 // Mixin class for syntax tree nodes which are annotated.
@@ -403,7 +404,8 @@ class ThisNode : public ExpressionNode
 //
 // IdentifierNode syntax element
 //
-class IdentifierNode : public ExpressionNode
+class IdentifierNode : public ExpressionNode,
+                       public Annotated<StringAnnotation>
 {
   private:
     IdentifierNameToken token_;
@@ -489,7 +491,8 @@ class NumericLiteralNode : public LiteralExpressionNode,
 //
 // StringLiteralNode syntax element
 //
-class StringLiteralNode : public LiteralExpressionNode
+class StringLiteralNode : public LiteralExpressionNode,
+                          public Annotated<StringAnnotation>
 {
   private:
     StringLiteralToken value_;
@@ -801,7 +804,8 @@ class GetElementExpressionNode : public ExpressionNode
 //
 // GetPropertyExpression syntax element
 //
-class GetPropertyExpressionNode : public ExpressionNode
+class GetPropertyExpressionNode : public ExpressionNode,
+                                  public Annotated<StringAnnotation>
 {
   private:
     ExpressionNode *object_;
@@ -146,6 +146,35 @@ class TypedHeapBase
     TypedHeapBase<T> &operator=(const TypedHeapBase<T> &ref) = delete;
 };
 
+#if defined(ENABLE_POINTER_COMPRESSION)
+
+//
+// With pointer compression, heap pointers are stored as 32-bit offsets
+// from the heap cage base (see cage.hpp).  There is no uncompressed
+// pointer in the heap for a handle to reference, so handles created
+// from heap pointers hold their own decompressed copy.
+//
+template <typename T>
+class PointerHeapBase
+{
+  protected:
+    uint32_t offset_;
+
+    inline PointerHeapBase(T *ptr);
+
+  public:
+    inline T *get() const;
+    inline void set(T *ptr, VM::HeapThing *holder);
+    inline operator T *() const;
+
+    inline T *operator ->() const;
+    inline explicit operator bool() const;
+
+    PointerHeapBase<T> &operator=(const PointerHeapBase<T> &ref) = delete;
+};
+
+#else
+
 template <typename T>
 class PointerHeapBase : public TypedHeapBase<T *>
 {
@@ -157,6 +186,8 @@ class PointerHeapBase : public TypedHeapBase<T *>
     inline explicit operator bool() const;
 };
 
+#endif // defined(ENABLE_POINTER_COMPRESSION)
+
 template <typename T>
 class Heap
 {
@@ -189,6 +220,36 @@ class TypedHandleBase
     inline bool operator == (const TypedMutHandleBase<T> &other) const;
 };
 
+#if defined(ENABLE_POINTER_COMPRESSION)
+
+template <typename T>
+class DecompressedPointerHolder
+{
+  protected:
+    T *decompressed_;
+
+    inline DecompressedPointerHolder(T *ptr) : decompressed_(ptr) {}
+};
+
+template <typename T>
+class PointerHandleBase : private DecompressedPointerHolder<T>,
+                          public TypedHandleBase<T *>
+{
+  protected:
+    inline PointerHandleBase(T * const &locn);
+    inline PointerHandleBase(TypedRootBase<T *> &base);
+    inline PointerHandleBase(const PointerHeapBase<T> &base);
+    inline PointerHandleBase(const PointerHandleBase<T> &other);
+
+    inline bool isDecompressed() const;
+
+  public:
+    inline T *operator ->() const;
+    inline explicit operator bool() const;
+};
+
+#else
+
 template <typename T>
 class PointerHandleBase : public TypedHandleBase<T *>
 {
@@ -202,6 +263,8 @@ class PointerHandleBase : public TypedHandleBase<T *>
     inline explicit operator bool() const;
 };
 
+#endif // defined(ENABLE_POINTER_COMPRESSION)
+
 template <typename T>
 class Handle
 {
@@ -3,6 +3,7 @@
 
 #include "rooting.hpp"
 #include "runtime.hpp"
+#include "cage.hpp"
 #include "vm/heap_thing.hpp"
 #include <type_traits>
 
@@ -281,6 +282,52 @@ TypedHeapBase<T>::operator == (const TypedMutHandleBase<T> &other) const
 // PointerHeapBase<typename T>
 //
 
+#if defined(ENABLE_POINTER_COMPRESSION)
+
+template <typename T>
+inline
+PointerHeapBase<T>::PointerHeapBase(T *ptr)
+  : offset_(HeapCage::Compress(ptr))
+{}
+
+template <typename T>
+inline T *
+PointerHeapBase<T>::get() const
+{
+    return HeapCage::Decompress<T>(offset_);
+}
+
+template <typename T>
+inline void
+PointerHeapBase<T>::set(T *ptr, VM::HeapThing *holder)
+{
+    // TODO: mark write barriers if needed.
+    offset_ = HeapCage::Compress(ptr);
+}
+
+template <typename T>
+inline
+PointerHeapBase<T>::operator T *() const
+{
+    return get();
+}
+
+template <typename T>
+inline T *
+PointerHeapBase<T>::operator ->() const
+{
+    return get();
+}
+
+template <typename T>
+inline
+PointerHeapBase<T>::operator bool() const
+{
+    return offset_ != 0;
+}
+
+#else
+
 template <typename T>
 inline
 PointerHeapBase<T>::PointerHeapBase(T *ptr)
@@ -301,6 +348,8 @@ PointerHeapBase<T>::operator bool() const
     return this->val_ != nullptr;
 }
 
+#endif // defined(ENABLE_POINTER_COMPRESSION)
+
 
 //
 // TypedHandleBase<typename T>
@@ -377,6 +426,46 @@ TypedHandleBase<T>::operator == (const TypedMutHandleBase<T> &other) const
 // PointerHandleBase<typename T>
 //
 
+#if defined(ENABLE_POINTER_COMPRESSION)
+
+template <typename T>
+inline
+PointerHandleBase<T>::PointerHandleBase(T * const &locn)
+  : DecompressedPointerHolder<T>(nullptr),
+    TypedHandleBase<T *>(locn)
+{}
+
+template <typename T>
+inline
+PointerHandleBase<T>::PointerHandleBase(TypedRootBase<T *> &base)
+  : DecompressedPointerHolder<T>(nullptr),
+    TypedHandleBase<T *>(base)
+{}
+
+template <typename T>
+inline
+PointerHandleBase<T>::PointerHandleBase(const PointerHeapBase<T> &base)
+  : DecompressedPointerHolder<T>(base.get()),
+    TypedHandleBase<T *>(this->decompressed_)
+{}
+
+template <typename T>
+inline
+PointerHandleBase<T>::PointerHandleBase(const PointerHandleBase<T> &other)
+  : DecompressedPointerHolder<T>(other.decompressed_),
+    TypedHandleBase<T *>(other.isDecompressed() ? this->decompressed_
+                                                : other.ref_)
+{}
+
+template <typename T>
+inline bool
+PointerHandleBase<T>::isDecompressed() const
+{
+    return &this->ref_ == &this->decompressed_;
+}
+
+#else
+
 template <typename T>
 inline
 PointerHandleBase<T>::PointerHandleBase(T * const &locn)
@@ -395,6 +484,8 @@ PointerHandleBase<T>::PointerHandleBase(TypedHeapBase<T *> &base)
   : TypedHandleBase<T *>(base)
 {}
 
+#endif // defined(ENABLE_POINTER_COMPRESSION)
+
 template <typename T>
 inline T *
 PointerHandleBase<T>::operator ->() const
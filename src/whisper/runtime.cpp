@@ -20,11 +20,15 @@ namespace Whisper {
 //
 
 Runtime::Runtime()
-  : threadContexts_()
+  : threadContexts_(),
+    atoms_()
 {}
 
 Runtime::~Runtime()
-{}
+{
+    for (ThreadContext *cx : threadContexts_)
+        cx->releaseExternalStrings();
+}
 
 bool
 Runtime::initialize()
@@ -38,6 +42,16 @@ Runtime::initialize()
         return false;
     }
 
+    // All threads hash strings with the same spoiler, so that atoms
+    // can be shared between them.
+    unsigned int seed = ThreadContext::NewRandSeed();
+    uint32_t spoiler = (rand_r(&seed) & 0xffffU) |
+                       ((rand_r(&seed) & 0xffffU) << 16);
+    if (!atoms_.initialize(spoiler)) {
+        error_ = "Could not allocate atom table.";
+        return false;
+    }
+
     initialized_ = true;
     return true;
 }
@@ -117,6 +131,18 @@ Runtime::threadContext()
     return ctx;
 }
 
+AtomTable &
+Runtime::atoms()
+{
+    return atoms_;
+}
+
+const AtomTable &
+Runtime::atoms() const
+{
+    return atoms_;
+}
+
 
 //
 // AllocationContext
@@ -131,20 +157,12 @@ bool
 AllocationContext::createString(uint32_t length, const uint8_t *bytes,
                                 Value &output)
 {
-    // Check for integer index.
-    int32_t idxVal = Value::ImmediateIndexValue(length, bytes);
-    if (idxVal >= 0) {
-        output = Value::ImmIndexString(idxVal);
+    // Check if fits in an immediate.
+    if (Value::MakeImmString(length, bytes, output))
         return true;
-    }
-
-    // Check if fits in immediate.
-    if (length < Value::ImmString8MaxLength) {
-        output = Value::ImmString8(length, bytes);
-        return true;
-    }
 
-    VM::LinearString *str = createSized<VM::LinearString>(length, bytes);
+    uint32_t size = VM::LinearString::CalculateSize(bytes, length);
+    VM::LinearString *str = createSized<VM::LinearString>(size, bytes);
     if (!str)
         return false;
 
@@ -156,38 +174,12 @@ bool
 AllocationContext::createString(uint32_t length, const uint16_t *bytes,
                                 Value &output)
 {
-    // Check for integer index.
-    int32_t idxVal = Value::ImmediateIndexValue(length, bytes);
-    if (idxVal >= 0) {
-        output = Value::ImmIndexString(idxVal);
-        return true;
-    }
-
-    // Check if this is really an 8-bit immediate string in 16-bit clothes.
-    if (length <= Value::ImmString8MaxLength) {
-        bool isEightBit = true;
-        for (unsigned i = 0; i < length; i++) {
-            if (bytes[i] >= 0xFFu) {
-                isEightBit = false;
-                break;
-            }
-        }
-        if (isEightBit) {
-            uint8_t buf[Value::ImmString8MaxLength];
-            for (unsigned i = 0; i < length; i++)
-                buf[i] = bytes[i];
-            output = Value::ImmString8(length, buf);
-            return true;
-        }
-    }
-
-    // Check if fits in 16-bit immediate string.
-    if (length < Value::ImmString16MaxLength) {
-        output = Value::ImmString16(length, bytes);
+    // Check if fits in an immediate.
+    if (Value::MakeImmString(length, bytes, output))
         return true;
-    }
 
-    VM::LinearString *str = createSized<VM::LinearString>(length, bytes);
+    uint32_t size = VM::LinearString::CalculateSize(bytes, length);
+    VM::LinearString *str = createSized<VM::LinearString>(size, bytes, length);
     if (!str)
         return false;
         
@@ -203,10 +195,23 @@ AllocationContext::createNumber(double d, Value &value)
         return true;
     }
 
+    // Boxes are only shared within the hatchery, so that older
+    // generations never point at a younger object through the cache.
+    bool inHatchery = (slab_->gen() == Slab::Hatchery);
+    if (inHatchery) {
+        if (VM::HeapDouble *cached = cx_->lookupDoubleBox(d)) {
+            value = Value::HeapDouble(cached);
+            return true;
+        }
+    }
+
     VM::HeapDouble *heapDouble = create<VM::HeapDouble>(d);
     if (!heapDouble)
         return false;
 
+    if (inHatchery)
+        cx_->cacheDoubleBox(d, heapDouble);
+
     value = Value::HeapDouble(heapDouble);
     return true;
 }
@@ -260,13 +265,15 @@ ThreadContext::ThreadContext(Runtime *runtime, Slab *hatchery, Slab *tenured)
     nursery_(nullptr),
     tenured_(tenured),
     tenuredList_(),
+    typedSlabs_(Slab::NumGenerations * ToUInt32(VM::HeapType::LIMIT), nullptr),
     activeRunContext_(nullptr),
     runContextList_(nullptr),
     roots_(nullptr),
     suppressGC_(false),
     randSeed_(NewRandSeed()),
     stringTable_(),
-    spoiler_((randInt() & 0xffffU) | ((randInt() & 0xffffU) << 16))
+    spoiler_(runtime->atoms().spoiler()),
+    externalStrings_()
 {
     WH_ASSERT(runtime != nullptr);
     WH_ASSERT(hatchery != nullptr);
@@ -274,6 +281,8 @@ ThreadContext::ThreadContext(Runtime *runtime, Slab *hatchery, Slab *tenured)
 
     tenuredList_.addSlab(tenured);
     stringTable_.initialize(this);
+    clearDoubleBoxCache();
+    clearShapePropertyCache();
 }
 
 Runtime *
@@ -312,6 +321,26 @@ ThreadContext::tenuredList()
     return tenuredList_;
 }
 
+Slab *
+ThreadContext::typedSlab(Slab::Generation gen, VM::HeapType type,
+                         uint32_t cellSize)
+{
+    WH_ASSERT(VM::IsValidHeapType(type));
+
+    uint32_t idx = (ToUInt32(gen) * ToUInt32(VM::HeapType::LIMIT)) +
+                   ToUInt32(type);
+    Slab *slab = typedSlabs_[idx];
+    if (slab)
+        return slab;
+
+    slab = Slab::AllocateTyped(ToUInt32(type), cellSize, gen);
+    if (!slab)
+        return nullptr;
+
+    typedSlabs_[idx] = slab;
+    return slab;
+}
+
 RootBase *
 ThreadContext::roots() const
 {
@@ -401,6 +430,112 @@ ThreadContext::inTenured()
     return AllocationContext(this, tenured_);
 }
 
+/*static*/ uint32_t
+ThreadContext::DoubleBoxCacheIndex(uint64_t bits)
+{
+    // Fibonacci hashing: the high bits of the product mix all the
+    // bits of the double, including the low mantissa bits.
+    uint64_t hash = bits * UINT64_C(0x9E3779B97F4A7C15);
+    return ToUInt32(hash >> (64 - DoubleBoxCacheSizeLog2));
+}
+
+VM::HeapDouble *
+ThreadContext::lookupDoubleBox(double d) const
+{
+    uint64_t bits = DoubleToInt(d);
+    const DoubleBoxCacheEntry &entry =
+        doubleBoxCache_[DoubleBoxCacheIndex(bits)];
+    if (entry.box && entry.bits == bits)
+        return entry.box;
+    return nullptr;
+}
+
+void
+ThreadContext::cacheDoubleBox(double d, VM::HeapDouble *box)
+{
+    WH_ASSERT(box);
+    uint64_t bits = DoubleToInt(d);
+    DoubleBoxCacheEntry &entry =
+        doubleBoxCache_[DoubleBoxCacheIndex(bits)];
+    entry.bits = bits;
+    entry.box = box;
+}
+
+void
+ThreadContext::clearDoubleBoxCache()
+{
+    for (DoubleBoxCacheEntry &entry : doubleBoxCache_) {
+        entry.bits = 0;
+        entry.box = nullptr;
+    }
+}
+
+/*static*/ uint32_t
+ThreadContext::ShapePropertyCacheIndex(VM::Shape *shape, uint64_t nameBits)
+{
+    // Heap things are 8-byte aligned, so drop the low bits of the shape
+    // pointer before mixing it with the name.
+    uint64_t key = (reinterpret_cast<uintptr_t>(shape) >> 3) ^ nameBits;
+    uint64_t hash = key * UINT64_C(0x9E3779B97F4A7C15);
+    return ToUInt32(hash >> (64 - ShapePropertyCacheSizeLog2));
+}
+
+VM::Shape *
+ThreadContext::lookupShapeProperty(VM::Shape *shape, const Value &name) const
+{
+    uint64_t nameBits = name.raw();
+    const ShapePropertyCacheEntry &entry =
+        shapePropertyCache_[ShapePropertyCacheIndex(shape, nameBits)];
+    if (entry.shape == shape && entry.nameBits == nameBits)
+        return entry.property;
+    return nullptr;
+}
+
+void
+ThreadContext::cacheShapeProperty(VM::Shape *shape, const Value &name,
+                                  VM::Shape *property)
+{
+    WH_ASSERT(shape);
+    WH_ASSERT(property);
+    uint64_t nameBits = name.raw();
+    ShapePropertyCacheEntry &entry =
+        shapePropertyCache_[ShapePropertyCacheIndex(shape, nameBits)];
+    entry.shape = shape;
+    entry.nameBits = nameBits;
+    entry.property = property;
+}
+
+void
+ThreadContext::clearShapePropertyCache()
+{
+    for (ShapePropertyCacheEntry &entry : shapePropertyCache_) {
+        entry.shape = nullptr;
+        entry.nameBits = 0;
+        entry.property = nullptr;
+    }
+}
+
+bool
+ThreadContext::registerExternalString(VM::ExternalString *str)
+{
+    try {
+        externalStrings_.push_back(str);
+    } catch (std::bad_alloc &err) {
+        return false;
+    }
+    return true;
+}
+
+void
+ThreadContext::releaseExternalStrings()
+{
+    for (VM::ExternalString *str : externalStrings_) {
+        if (!str->isReleased())
+            str->release();
+    }
+    externalStrings_.clear();
+}
+
 int
 ThreadContext::randInt()
 {
@@ -9,6 +9,7 @@
 #include "debug.hpp"
 #include "slab.hpp"
 #include "value.hpp"
+#include "atom_table.hpp"
 #include "string_table.hpp"
 
 namespace Whisper {
@@ -22,9 +23,13 @@ class RunContext;
 class RunActivationHelper;
 
 namespace VM {
+    enum class HeapType : uint32_t;
     class StackFrame;
     class HeapString;
+    class HeapDouble;
+    class ExternalString;
     class Tuple;
+    class Shape;
 }
 
 //
@@ -48,6 +53,9 @@ class Runtime
     std::vector<ThreadContext *> threadContexts_;
     pthread_key_t threadKey_;
 
+    // Interned strings shared by all threads.
+    AtomTable atoms_;
+
     // initialized flag.
     bool initialized_ = false;
 
@@ -69,6 +77,9 @@ class Runtime
     ThreadContext *maybeThreadContext();
     bool hasThreadContext();
     ThreadContext *threadContext();
+
+    AtomTable &atoms();
+    const AtomTable &atoms() const;
 };
 
 
@@ -108,6 +119,11 @@ class AllocationContext
     // in hatchery.
     template <typename ObjT>
     inline uint8_t *allocate(uint32_t size);
+
+    // Allocate a headerless cell for an object of a type which lives
+    // in typed slabs.  Return null if not enough space.
+    template <typename ObjT>
+    inline uint8_t *allocateCell();
 };
 
 
@@ -131,6 +147,7 @@ class ThreadContext
     Slab *nursery_;
     Slab *tenured_;
     SlabList tenuredList_;
+    std::vector<Slab *> typedSlabs_;
     RunContext *activeRunContext_;
     RunContext *runContextList_;
     RootBase *roots_;
@@ -140,7 +157,50 @@ class ThreadContext
     StringTable stringTable_;
     uint32_t spoiler_;
 
+    // Direct-mapped cache of recently created hatchery HeapDoubles,
+    // keyed by the bit pattern of the boxed double.  HeapDoubles are
+    // immutable, so one box can be shared by any number of values.
+    // The cache refers to hatchery objects, and must be cleared
+    // whenever the hatchery is collected.
+    struct DoubleBoxCacheEntry
+    {
+        uint64_t bits;
+        VM::HeapDouble *box;
+    };
+    static constexpr uint32_t DoubleBoxCacheSizeLog2 = 6;
+    static constexpr uint32_t DoubleBoxCacheSize =
+        ToUInt32(1) << DoubleBoxCacheSizeLog2;
+    DoubleBoxCacheEntry doubleBoxCache_[DoubleBoxCacheSize];
+
+    // Direct-mapped cache of property lookups, keyed by the shape of
+    // the object and the property name, holding the shape defining the
+    // property (which has its slot and attributes).  Property access
+    // sites which see too many shapes to cache themselves consult this
+    // before doing a full lookup.  Names are normalized, so they are
+    // compared by their raw bits.  Shapes are never changed once
+    // created, so entries stay valid for as long as their shapes are
+    // alive.  The cache refers to hatchery objects, and must be cleared
+    // whenever the hatchery is collected.
+    struct ShapePropertyCacheEntry
+    {
+        VM::Shape *shape;
+        uint64_t nameBits;
+        VM::Shape *property;
+    };
+    static constexpr uint32_t ShapePropertyCacheSizeLog2 = 8;
+    static constexpr uint32_t ShapePropertyCacheSize =
+        ToUInt32(1) << ShapePropertyCacheSizeLog2;
+    ShapePropertyCacheEntry shapePropertyCache_[ShapePropertyCacheSize];
+
+    // ExternalStrings created on this thread whose chars have not been
+    // released yet.  Without a collector to find dead ones, they are
+    // all released when the runtime is destroyed.
+    std::vector<VM::ExternalString *> externalStrings_;
+
     static unsigned int NewRandSeed();
+    static uint32_t DoubleBoxCacheIndex(uint64_t bits);
+    static uint32_t ShapePropertyCacheIndex(VM::Shape *shape,
+                                            uint64_t nameBits);
 
   public:
     ThreadContext(Runtime *runtime, Slab *hatchery, Slab *tenured);
@@ -151,6 +211,11 @@ class ThreadContext
     Slab *tenured() const;
     const SlabList &tenuredList() const;
     SlabList &tenuredList();
+
+    // Get the typed slab for a given generation and heap type,
+    // allocating it if necessary.
+    Slab *typedSlab(Slab::Generation gen, VM::HeapType type,
+                    uint32_t cellSize);
     RunContext *activeRunContext() const;
     RootBase *roots() const;
     bool suppressGC() const;
@@ -170,6 +235,18 @@ class ThreadContext
     const StringTable &stringTable() const;
 
     uint32_t spoiler() const;
+
+    VM::HeapDouble *lookupDoubleBox(double d) const;
+    void cacheDoubleBox(double d, VM::HeapDouble *box);
+    void clearDoubleBoxCache();
+
+    VM::Shape *lookupShapeProperty(VM::Shape *shape, const Value &name) const;
+    void cacheShapeProperty(VM::Shape *shape, const Value &name,
+                            VM::Shape *property);
+    void clearShapePropertyCache();
+
+    bool registerExternalString(VM::ExternalString *str);
+    void releaseExternalStrings();
 };
 
 
@@ -29,6 +29,17 @@ AllocationContext::allocate(uint32_t size)
                      : slab_->allocateTail(allocSize);
 }
 
+template <typename ObjT>
+inline uint8_t *
+AllocationContext::allocateCell()
+{
+    Slab *slab = cx_->typedSlab(slab_->gen(), ObjT::Type, sizeof(ObjT));
+    if (!slab)
+        return nullptr;
+
+    return slab->allocateCell();
+}
+
 template <typename ObjT, typename... Args>
 inline ObjT *
 AllocationContext::create(Args... args)
@@ -40,8 +51,11 @@ template <typename ObjT, typename... Args>
 inline ObjT *
 AllocationContext::createSized(uint32_t size, Args... args)
 {
+    bool typedSlab = VM::HeapTypeTraits<ObjT::Type>::TypedSlab;
+    WH_ASSERT_IF(typedSlab, size == sizeof(ObjT));
+
     // Allocate the space for the object.
-    uint8_t *mem = allocate<ObjT>(size);
+    uint8_t *mem = typedSlab ? allocateCell<ObjT>() : allocate<ObjT>(size);
     if (!mem) {
         if (cx_->suppressGC())
             return nullptr;
@@ -50,6 +64,10 @@ AllocationContext::createSized(uint32_t size, Args... args)
         return nullptr;
     }
 
+    // Objects in typed slabs have no header.
+    if (typedSlab)
+        return new (mem) ObjT(args...);
+
     // Figure out the card number.
     uint32_t cardNo = slab_->calculateCardNumber(mem);
 
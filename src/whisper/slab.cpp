@@ -4,6 +4,7 @@
 
 #include "spew.hpp"
 #include "memalloc.hpp"
+#include "cage.hpp"
 #include "slab.hpp"
 
 namespace Whisper {
@@ -13,6 +14,7 @@ static uint32_t CachedStandardSlabCards = 0;
 static uint32_t CachedStandardSlabHeaderCards = 0;
 static uint32_t CachedStandardSlabDataCards = 0;
 static uint32_t CachedStandardSlabMaxObjectSize = 0;
+static uint32_t CachedStandardSlabSize = 0;
 
 static void
 InitializeStandardSlabInfo()
@@ -58,6 +60,32 @@ InitializeStandardSlabInfo()
     CachedStandardSlabHeaderCards = headerCards;
     CachedStandardSlabDataCards = dataCards;
     CachedStandardSlabMaxObjectSize = maxObjectSize;
+    CachedStandardSlabSize = AlignIntUp<uint32_t>(slabCards * Slab::CardSize,
+                                                  pageSize);
+    WH_ASSERT(IsPowerOfTwo(CachedStandardSlabSize));
+}
+
+// Slab memory is aligned to the standard slab size.  With pointer
+// compression, it is carved out of the heap cage.
+static void *
+AllocateSlabMemory(size_t size)
+{
+#if defined(ENABLE_POINTER_COMPRESSION)
+    return HeapCage::AllocateRegion(size, Slab::StandardSlabSize());
+#else
+    return AllocateAlignedMappedMemory(size, Slab::StandardSlabSize());
+#endif // defined(ENABLE_POINTER_COMPRESSION)
+}
+
+static bool
+ReleaseSlabMemory(void *region, size_t size)
+{
+#if defined(ENABLE_POINTER_COMPRESSION)
+    HeapCage::ReleaseRegion(region, size);
+    return true;
+#else
+    return ReleaseMappedMemory(region, size);
+#endif // defined(ENABLE_POINTER_COMPRESSION)
 }
 
 /*static*/ uint32_t
@@ -110,6 +138,16 @@ Slab::StandardSlabMaxObjectSize()
     return CachedStandardSlabMaxObjectSize;
 }
 
+/*static*/ uint32_t
+Slab::StandardSlabSize()
+{
+    if (CachedStandardSlabSize == 0)
+        InitializeStandardSlabInfo();
+
+    WH_ASSERT(CachedStandardSlabSize > 0);
+    return CachedStandardSlabSize;
+}
+
 /*static*/ uint32_t
 Slab::NumDataCardsForObjectSize(uint32_t objectSize)
 {
@@ -139,12 +177,36 @@ Slab::NumHeaderCardsForDataCards(uint32_t dataCards)
     return AlignIntUp<uint32_t>(headerMinimum, CardSize) / CardSize;
 }
 
+/*static*/ uint32_t
+Slab::NumHeaderCardsForTypedSlab(uint32_t cellSize)
+{
+    WH_ASSERT(IsIntAligned(cellSize, AllocAlign));
+
+    uint32_t slabCards = StandardSlabCards();
+    for (uint32_t headerCards = 1; headerCards < slabCards; headerCards++) {
+        uint32_t dataCards = slabCards - headerCards;
+        uint32_t numCells = (dataCards * CardSize) / cellSize;
+
+        // Standard header contents, followed by the cell bitmap.
+        uint32_t headerSize = AlignIntUp<uint32_t>(sizeof(Slab), AllocAlign);
+        headerSize += AlienRefSpaceSize;
+        headerSize += AlignIntUp<uint32_t>(dataCards, AllocAlign);
+        headerSize += DivUp<uint32_t>(numCells, CellBitmapWordBits) *
+                      sizeof(uint64_t);
+
+        if (headerSize <= headerCards * CardSize)
+            return headerCards;
+    }
+
+    WH_UNREACHABLE("Typed slab cell size too large.");
+    return 0;
+}
+
 /*static*/ Slab *
 Slab::AllocateStandard(Generation gen)
 {
-    size_t size = AlignIntUp<size_t>(StandardSlabCards() * CardSize,
-                                     PageSize());
-    void *result = AllocateMappedMemory(size);
+    size_t size = StandardSlabSize();
+    void *result = AllocateSlabMemory(size);
     if (!result)
         return nullptr;
 
@@ -165,7 +227,7 @@ Slab::AllocateSingleton(uint32_t objectSize, Generation gen)
     size_t size = AlignIntUp<size_t>((dataCards + headerCards) * CardSize,
                                      PageSize());
 
-    void *result = AllocateMappedMemory(size);
+    void *result = AllocateSlabMemory(size);
     if (!result)
         return nullptr;
 
@@ -174,14 +236,36 @@ Slab::AllocateSingleton(uint32_t objectSize, Generation gen)
     SpewSlabNote("Allocated singleton slab at %p (hdr=%d, data=%d)",
                  result, dataCards, headerCards);
 
-    return new (result) Slab(result, size, dataCards, headerCards, gen);
+    return new (result) Slab(result, size, headerCards, dataCards, gen);
+}
+
+/*static*/ Slab *
+Slab::AllocateTyped(uint32_t cellType, uint32_t cellSize, Generation gen)
+{
+    WH_ASSERT(cellType != 0);
+    cellSize = AlignIntUp<uint32_t>(cellSize, AllocAlign);
+
+    uint32_t headerCards = NumHeaderCardsForTypedSlab(cellSize);
+    uint32_t dataCards = StandardSlabCards() - headerCards;
+
+    size_t size = StandardSlabSize();
+    void *result = AllocateSlabMemory(size);
+    if (!result)
+        return nullptr;
+
+    SpewSlabNote("Allocated typed slab at %p (type=%d, cellSize=%d)",
+                 result, cellType, cellSize);
+
+    Slab *slab = new (result) Slab(result, size, headerCards, dataCards, gen);
+    slab->initializeTyped(cellType, cellSize);
+    return slab;
 }
 
 /*static*/ void
 Slab::Destroy(Slab *slab)
 {
     SpewSlabNote("Destroying slab at %p", slab);
-    DebugVal<bool> r = ReleaseMappedMemory(slab->region_, slab->regionSize_);
+    DebugVal<bool> r = ReleaseSlabMemory(slab->region_, slab->regionSize_);
     if (!r)
         SpewSlabError("Failed to destroy slab at %p");
     WH_ASSERT(r);
@@ -206,5 +290,49 @@ Slab::Slab(void *region, uint32_t regionSize,
     tailAlloc_ = tailStartAlloc();
 }
 
+/*static*/ Slab *
+Slab::FromPointer(const void *ptr)
+{
+    WH_ASSERT(CachedStandardSlabSize > 0);
+    Slab *slab = reinterpret_cast<Slab *>(
+                    AlignIntDown<word_t>(PtrToWord(ptr),
+                                         CachedStandardSlabSize));
+    WH_ASSERT(reinterpret_cast<const uint8_t *>(ptr) >= slab->allocTop_);
+    WH_ASSERT(reinterpret_cast<const uint8_t *>(ptr) < slab->allocBottom_);
+    return slab;
+}
+
+void
+Slab::initializeTyped(uint32_t cellType, uint32_t cellSize)
+{
+    WH_ASSERT(cellType != 0);
+    WH_ASSERT(IsIntAligned(cellSize, AllocAlign));
+
+    cellType_ = cellType;
+    cellSize_ = cellSize;
+    numCells_ = (dataCards_ * CardSize) / cellSize;
+    cellCursor_ = 0;
+
+    // The cell bitmap follows the standard header contents.
+    uint8_t *slabBase = reinterpret_cast<uint8_t *>(this);
+    uint32_t bitmapOffset = AlignIntUp<uint32_t>(sizeof(Slab), AllocAlign) +
+                            AlienRefSpaceSize +
+                            AlignIntUp<uint32_t>(dataCards_, AllocAlign);
+    cellBitmap_ = reinterpret_cast<uint64_t *>(slabBase + bitmapOffset);
+
+    // Mark all cells free, but mark the bits past the last cell as
+    // allocated so that allocation never hands them out.
+    uint32_t words = DivUp<uint32_t>(numCells_, CellBitmapWordBits);
+    for (uint32_t i = 0; i < words; i++)
+        cellBitmap_[i] = 0;
+    uint32_t tailBits = numCells_ % CellBitmapWordBits;
+    if (tailBits > 0)
+        cellBitmap_[words - 1] = ~((ToUInt64(1) << tailBits) - 1);
+
+    // Typed slabs do not use head and tail allocation.
+    headAlloc_ = allocTop_;
+    tailAlloc_ = allocTop_;
+}
+
 
 } // namespace Whisper
@@ -59,6 +59,33 @@ namespace Whisper {
 // NOTE: The first 8 bytes of the allocation area are a pointer to the
 // slab structure.
 //
+// All slabs are aligned to the standard slab size, so the slab holding
+// any heap pointer can be found by masking off the low bits of the pointer
+// (see Slab::FromPointer).  The start of an object in a singleton slab
+// always lies within the first standard-slab-sized span of the slab.
+//
+// Typed Slabs
+// -----------
+//
+// Typed slabs (a "big bag of pages" scheme) are standard-sized slabs
+// which hold objects of a single fixed-size heap type.  The type and
+// size are recorded once in the slab, and objects allocated in them
+// carry no header word.  The data space is divided into equal cells,
+// and a bitmap in the slab header records which cells are allocated:
+//
+//      +-----------------------+   <--- Top - aligned to slab size
+//      | Slab                  |   }
+//      | Alien refs, cards     |   }-- Header
+//      | Cell bitmap           |   }
+//      +-----------------------+
+//      | Cell 0                |   }
+//      | Cell 1                |   }-- Data space
+//      | ...                   |   }
+//      +-----------------------+
+//
+// Allocation and sweeping in typed slabs are both scans over the
+// cell bitmap.
+//
 
 class Slab
 {
@@ -68,6 +95,7 @@ class Slab
     static constexpr uint32_t CardSizeLog2 = 10;
     static constexpr uint32_t CardSize = 1 << CardSizeLog2;
     static constexpr uint32_t AlienRefSpaceSize = 512;
+    static constexpr uint32_t CellBitmapWordBits = 64;
 
     enum Generation : uint8_t
     {
@@ -85,6 +113,7 @@ class Slab
         // Tenured generation is the oldest generation of objects.
         Tenured
     };
+    static constexpr uint32_t NumGenerations = 3;
 
     static uint32_t PageSize();
 
@@ -93,6 +122,9 @@ class Slab
     static uint32_t StandardSlabDataCards();
     static uint32_t StandardSlabMaxObjectSize();
 
+    // Size of a standard slab in bytes.  All slabs are aligned to this.
+    static uint32_t StandardSlabSize();
+
     // Calculate the number of data cards required to store an object
     // of a particular size.
     static uint32_t NumDataCardsForObjectSize(uint32_t objectSize);
@@ -101,11 +133,20 @@ class Slab
     // given number of data cards.
     static uint32_t NumHeaderCardsForDataCards(uint32_t dataCards);
 
+    // Calculate the number of header cards required in a standard-sized
+    // typed slab holding cells of the given size.
+    static uint32_t NumHeaderCardsForTypedSlab(uint32_t cellSize);
+
     // Allocate/destroy slabs.
     static Slab *AllocateStandard(Generation gen);
     static Slab *AllocateSingleton(uint32_t objectSize, Generation gen);
+    static Slab *AllocateTyped(uint32_t cellType, uint32_t cellSize,
+                               Generation gen);
     static void Destroy(Slab *slab);
 
+    // Get the slab containing a pointer to an allocated thing.
+    static Slab *FromPointer(const void *ptr);
+
   private:
     // Pointer to the actual system-allocated memory region containing
     // the slab.
@@ -133,10 +174,24 @@ class Slab
     // Slab generation.
     Generation gen_;
 
+    // For typed slabs, the type tag and size of the cells held in the
+    // slab.  The cell type is zero for untyped slabs.
+    uint32_t cellType_ = 0;
+    uint32_t cellSize_ = 0;
+    uint32_t numCells_ = 0;
+
+    // Index of the lowest bitmap word which may have a free cell.
+    uint32_t cellCursor_ = 0;
+
+    // Cell allocation bitmap of typed slabs, stored in the header.
+    uint64_t *cellBitmap_ = nullptr;
+
     Slab(void *region, uint32_t regionSize,
          uint32_t headerCards, uint32_t dataCards,
          Generation gen);
 
+    void initializeTyped(uint32_t cellType, uint32_t cellSize);
+
     ~Slab() {}
 
   public:
@@ -180,12 +235,12 @@ class Slab
     uint8_t *allocateHead(uint32_t amount) {
         WH_ASSERT(IsIntAligned(amount, AllocAlign));
 
-        uint8_t *oldTop = headAlloc_;
-        uint8_t *newTop = oldTop + amount;
-        if (newTop > allocBottom_)
+        // Head and tail allocations grow towards each other.
+        if (amount > ToUInt32(tailAlloc_ - headAlloc_))
             return nullptr;
 
-        headAlloc_ = newTop;
+        uint8_t *oldTop = headAlloc_;
+        headAlloc_ = oldTop + amount;
         return oldTop;
     }
 
@@ -193,20 +248,94 @@ class Slab
     uint8_t *allocateTail(uint32_t amount) {
         WH_ASSERT(IsIntAligned(amount, AllocAlign));
 
-        uint8_t *newBot = tailAlloc_ - amount;
-        if (newBot < allocTop_)
+        if (amount > ToUInt32(tailAlloc_ - headAlloc_))
             return nullptr;
 
+        uint8_t *newBot = tailAlloc_ - amount;
         tailAlloc_ = newBot;
         return newBot;
     }
 
-    uint32_t calculateCardNumber(uint8_t *ptr) const {
+    uint32_t calculateCardNumber(const uint8_t *ptr) const {
         WH_ASSERT(ptr >= allocTop_ && ptr < allocBottom_);
-        WH_ASSERT(ptr < headAlloc_ || ptr >= tailAlloc_);
+        WH_ASSERT(isTyped() || ptr < headAlloc_ || ptr >= tailAlloc_);
         uint32_t diff = ptr - allocTop_;
         return diff >> CardSizeLog2;
     }
+
+    //
+    // Typed slab methods.
+    //
+
+    bool isTyped() const {
+        return cellType_ != 0;
+    }
+
+    uint32_t cellType() const {
+        WH_ASSERT(isTyped());
+        return cellType_;
+    }
+
+    uint32_t cellSize() const {
+        WH_ASSERT(isTyped());
+        return cellSize_;
+    }
+
+    uint32_t numCells() const {
+        WH_ASSERT(isTyped());
+        return numCells_;
+    }
+
+    uint8_t *cellAddress(uint32_t idx) const {
+        WH_ASSERT(idx < numCells());
+        return allocTop_ + (idx * cellSize_);
+    }
+
+    uint32_t cellIndex(const uint8_t *ptr) const {
+        WH_ASSERT(ptr >= allocTop_ && ptr < allocBottom_);
+        uint32_t idx = (ptr - allocTop_) / cellSize();
+        WH_ASSERT(cellAddress(idx) == ptr);
+        return idx;
+    }
+
+    bool isCellAllocated(uint32_t idx) const {
+        WH_ASSERT(idx < numCells());
+        uint64_t bit = ToUInt64(1) << (idx % CellBitmapWordBits);
+        return (cellBitmap_[idx / CellBitmapWordBits] & bit) != 0;
+    }
+
+    // Allocate a free cell.  Returns null if the slab is full.
+    uint8_t *allocateCell() {
+        WH_ASSERT(isTyped());
+
+        uint32_t words = DivUp(numCells_, CellBitmapWordBits);
+        for (uint32_t i = cellCursor_; i < words; i++) {
+            uint64_t freeBits = ~cellBitmap_[i];
+            if (freeBits == 0)
+                continue;
+
+            // Bits past the last cell are always set, so the first
+            // clear bit always names a valid cell.
+            uint32_t bitNo = __builtin_ctzll(freeBits);
+            cellBitmap_[i] |= ToUInt64(1) << bitNo;
+            cellCursor_ = i;
+            return cellAddress((i * CellBitmapWordBits) + bitNo);
+        }
+
+        cellCursor_ = words;
+        return nullptr;
+    }
+
+    // Release an allocated cell.
+    void freeCell(uint8_t *ptr) {
+        uint32_t idx = cellIndex(ptr);
+        WH_ASSERT(isCellAllocated(idx));
+
+        uint32_t word = idx / CellBitmapWordBits;
+        cellBitmap_[word] &= ~(ToUInt64(1) << (idx % CellBitmapWordBits));
+        if (word < cellCursor_)
+            cellCursor_ = word;
+    }
 };
 
 
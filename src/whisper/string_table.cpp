@@ -8,6 +8,12 @@
 #include "vm/string.hpp"
 #include "vm/tuple.hpp"
 
+#include <algorithm>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
 namespace Whisper {
 
 
@@ -68,13 +74,17 @@ const StringTable::Query *
 StringTable::StringOrQuery::toQuery() const
 {
     WH_ASSERT(isQuery());
-    return reinterpret_cast<const Query *>(ptr);
+    return reinterpret_cast<const Query *>(ptr & ~static_cast<uintptr_t>(1));
 }
 
 StringTable::StringTable()
   : cx_(nullptr),
     entries_(0),
-    tuple_(nullptr)
+    tuple_(nullptr),
+    control_(),
+    oldTuple_(nullptr),
+    oldControl_(),
+    migrateGroup_(0)
 {}
 
 
@@ -87,9 +97,14 @@ StringTable::initialize(ThreadContext *cx)
     cx_ = cx;
 
     // Allocate a new tuple with reasonable capacity in tenured space.
+    static_assert((INITIAL_TUPLE_SIZE & (INITIAL_TUPLE_SIZE - 1)) == 0,
+                  "StringTable size must be a power of two.");
+    static_assert(INITIAL_TUPLE_SIZE % GROUP_SIZE == 0,
+                  "StringTable size must be a multiple of the group size.");
     if (!cx->inTenured().createTuple(INITIAL_TUPLE_SIZE, tuple_))
         return false;
 
+    control_.assign(INITIAL_TUPLE_SIZE, ToUInt8(CONTROL_EMPTY));
     return true;
 }
 
@@ -112,16 +127,20 @@ StringTable::lookupString(const Value &strval)
 VM::LinearString *
 StringTable::lookupString(VM::HeapString *str)
 {
-    if (str->isLinearString()) {
-        VM::LinearString *linStr = str->toLinearString();
+    if (str->isFlat()) {
+        VM::LinearString *linStr = str->flatString();
         if (linStr->isInterned())
             return linStr;
 
-        return lookupString(linStr->data(), linStr->length());
+        if (linStr->isEightBit())
+            return lookupString(linStr->eightBitData(), linStr->length());
+        return lookupString(linStr->sixteenBitData(), linStr->length());
     }
 
     VM::LinearString *result;
     lookupSlot(StringOrQuery(str), &result);
+    if (!result)
+        result = cx_->runtime()->atoms().lookup(str);
     return result;
 }
 
@@ -131,6 +150,8 @@ StringTable::lookupString(const uint8_t *str, uint32_t length)
     Query q(str, length);
     VM::LinearString *result;
     lookupSlot(StringOrQuery(&q), &result);
+    if (!result)
+        result = cx_->runtime()->atoms().lookup(str, length);
     return result;
 }
 
@@ -140,6 +161,8 @@ StringTable::lookupString(const uint16_t *str, uint32_t length)
     Query q(str, length);
     VM::LinearString *result;
     lookupSlot(StringOrQuery(&q), &result);
+    if (!result)
+        result = cx_->runtime()->atoms().lookup(str, length);
     return result;
 }
 
@@ -155,9 +178,8 @@ StringTable::addString(const uint8_t *str, uint32_t length,
     if (result)
         return true;
 
-    // Allocate tenured LinearString copy (marked interned).
-    result = cx_->inTenured().createSized<VM::LinearString>(
-                            length * 2, str, /*interned=*/true);
+    // Get the shared atom, creating it if necessary.
+    result = cx_->runtime()->atoms().add(str, length);
     if (!result)
         return false;
 
@@ -176,9 +198,8 @@ StringTable::addString(const uint16_t *str, uint32_t length,
     if (result)
         return true;
 
-    // Allocate tenured LinearString copy (marked interned).
-    result = cx_->inTenured().createSized<VM::LinearString>(
-                            length * 2, str, /*interned=*/true);
+    // Get the shared atom, creating it if necessary.
+    result = cx_->runtime()->atoms().add(str, length);
     if (!result)
         return false;
 
@@ -191,21 +212,28 @@ StringTable::addString(Handle<VM::HeapString *> string,
 {
     WH_ASSERT(!VM::IsInt32IdString(string));
 
-    // Check if |string| is already a LinearString and marked as interned.
-    if (string->isLinearString() && string->toLinearString()->isInterned()) {
-        result = string->toLinearString();
+    // Flatten ropes, so that hashing and comparison can use linear chars.
+    Root<VM::HeapString *> str(cx_, string);
+    if (str->isConcatString()) {
+        Root<VM::LinearString *> flat(cx_);
+        if (!VM::FlattenString(cx_, string, &flat))
+            return false;
+        str = flat.get();
+    }
+
+    // Check if |str| is already a LinearString and marked as interned.
+    if (str->isFlat() && str->flatString()->isInterned()) {
+        result = str->flatString();
         return true;
     }
 
     // Check for existing interned string in table.
-    uint32_t slot = lookupSlot(StringOrQuery(string), &result.get());
+    uint32_t slot = lookupSlot(StringOrQuery(str.get()), &result.get());
     if (result)
         return true;
 
-    // Allocate tenured LinearString copy (marked interned).
-    uint32_t size = string->length() * 2;
-    result = cx_->inTenured().createSized<VM::LinearString>(
-                            size, string, /*interned=*/true);
+    // Get the shared atom, creating it if necessary.
+    result = cx_->runtime()->atoms().add(str.get());
     if (!result)
         return false;
 
@@ -235,36 +263,120 @@ uint32_t
 StringTable::lookupSlot(const StringOrQuery &str, VM::LinearString **result)
 {
     uint32_t hash = hashString(str);
-    uint32_t slotCount = tuple_->size();
+
+    if (isMigrating())
+        migrateGroups(MIGRATE_GROUPS);
+
+    uint32_t slot = probeTable(tuple_, control_, str, hash, result);
+    if (*result || !isMigrating())
+        return slot;
+
+    // Strings which have not been migrated yet are in the old table.
+    // The returned slot is always in the new table.
+    probeTable(oldTuple_, oldControl_, str, hash, result);
+    return slot;
+}
+
+uint32_t
+StringTable::probeTable(VM::Tuple *tuple, const std::vector<uint8_t> &control,
+                        const StringOrQuery &str, uint32_t hash,
+                        VM::LinearString **result)
+{
+    uint8_t hashControl = ControlByte(hash);
+    uint32_t groupMask = control.size() / GROUP_SIZE - 1;
 
     *result = nullptr;
 
-    WH_ASSERT(tuple_);
-    for (uint32_t i = 0; i < slotCount; i++) {
-        uint32_t slot = (hash + i) % slotCount;
-        Handle<Value> slotVal = tuple_->get(slot);
-        if (slotVal->isUndefined())
-            return slot;
+    WH_ASSERT(tuple);
+    WH_ASSERT(tuple->size() == control.size());
+
+    // Groups are probed triangularly, which visits every group since
+    // the group count is a power of two.
+    uint32_t group = GroupIndex(hash) & groupMask;
+    for (uint32_t i = 0; i <= groupMask; i++) {
+        group = (group + i) & groupMask;
+        uint32_t base = group * GROUP_SIZE;
+        const uint8_t *groupControl = &control[base];
+
+        // Only strings whose control byte matches need to be compared.
+        uint32_t matches = MatchGroup(groupControl, hashControl);
+        for (; matches; matches &= matches - 1) {
+            uint32_t slot = base + __builtin_ctz(matches);
+            Handle<Value> slotVal = tuple->get(slot);
+            WH_ASSERT(slotVal->isHeapString());
 
-        if (slotVal->isHeapString()) {
             VM::HeapString *heapStr = slotVal->heapStringPtr();
             WH_ASSERT(heapStr->isLinearString());
             VM::LinearString *linearStr = heapStr->toLinearString();
 
-            if (compareStrings(linearStr, str) == 0) {
+            if (equalStrings(linearStr, str)) {
                 *result = linearStr;
                 return slot;
             }
         }
 
-        // Only other option is deleted slot.
-        WH_ASSERT(slotVal->isFalse());
+        // An empty slot in the group ends the probe sequence.
+        uint32_t empties = MatchGroup(groupControl, CONTROL_EMPTY);
+        if (empties)
+            return base + __builtin_ctz(empties);
     }
 
     WH_UNREACHABLE("Completely full StringTable should not ever happen!");
     return UINT32_MAX;
 }
 
+uint32_t
+StringTable::emptySlot(uint32_t hash)
+{
+    uint32_t groupMask = control_.size() / GROUP_SIZE - 1;
+
+    uint32_t group = GroupIndex(hash) & groupMask;
+    for (uint32_t i = 0; i <= groupMask; i++) {
+        group = (group + i) & groupMask;
+        uint32_t base = group * GROUP_SIZE;
+
+        uint32_t empties = MatchGroup(&control_[base], CONTROL_EMPTY);
+        if (empties)
+            return base + __builtin_ctz(empties);
+    }
+
+    WH_UNREACHABLE("Completely full StringTable should not ever happen!");
+    return UINT32_MAX;
+}
+
+/*static*/ uint8_t
+StringTable::ControlByte(uint32_t hash)
+{
+    return hash & CONTROL_HASH_MASK;
+}
+
+/*static*/ uint32_t
+StringTable::GroupIndex(uint32_t hash)
+{
+    // The low bits are used for the control byte.
+    return hash >> 7;
+}
+
+/*static*/ uint32_t
+StringTable::MatchGroup(const uint8_t *group, uint8_t control)
+{
+    // Return a mask with bit N set if the Nth control byte in the
+    // group equals |control|.
+#if defined(__SSE2__)
+    static_assert(GROUP_SIZE == 16, "SSE2 matching assumes 16-slot groups.");
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+    __m128i cmp = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(control));
+    return _mm_movemask_epi8(cmp);
+#else
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < GROUP_SIZE; i++) {
+        if (group[i] == control)
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
 uint32_t
 StringTable::hashString(const StringOrQuery &str)
 {
@@ -273,68 +385,54 @@ StringTable::hashString(const StringOrQuery &str)
     if (str.isQuery()) {
         const Query *query = str.toQuery();
         if (query->isEightBit) {
-            return VM::FNVHashString(spoiler, query->eightBitData(),
+            return VM::HashString(spoiler, query->eightBitData(),
                                      query->length);
         }
 
-        return VM::FNVHashString(spoiler, query->sixteenBitData(),
+        return VM::HashString(spoiler, query->sixteenBitData(),
                                  query->length);
     }
 
     WH_ASSERT(str.isHeapString());
-    const VM::HeapString *heapStr = str.toHeapString();
-
-    if (heapStr->isLinearString()) {
-        const VM::LinearString *linStr = heapStr->toLinearString();
-        return VM::FNVHashString(spoiler, linStr->data(), linStr->length());
-    }
-
-    return VM::FNVHashString(spoiler, heapStr);
+    return VM::HashString(spoiler, str.toHeapString());
 }
 
-int
-StringTable::compareStrings(VM::LinearString *a,
-                            const StringOrQuery &b)
+bool
+StringTable::equalStrings(VM::LinearString *a, const StringOrQuery &b)
 {
     if (b.isQuery()) {
         const Query *query = b.toQuery();
         if (query->isEightBit) {
-            return VM::CompareStrings(a->data(), a->length(),
-                                      query->eightBitData(), query->length);
+            return VM::EqualStrings(a, query->eightBitData(),
+                                    query->length);
         }
-        return VM::CompareStrings(a->data(), a->length(),
-                                  query->sixteenBitData(), query->length);
+        return VM::EqualStrings(a, query->sixteenBitData(), query->length);
     }
 
     WH_ASSERT(b.isHeapString());
-    const VM::HeapString *heapStr = b.toHeapString();
-
-    if (heapStr->isLinearString()) {
-        const VM::LinearString *linStr = heapStr->toLinearString();
-        return VM::CompareStrings(a->data(), a->length(),
-                                  linStr->data(), linStr->length());
-    }
-    return VM::CompareStrings(a->data(), a->length(), heapStr);
+    return VM::EqualStrings(a, b.toHeapString());
 }
 
 bool
 StringTable::insertString(Handle<VM::LinearString *> str, uint32_t slot)
 {
+    WH_ASSERT(control_[slot] == CONTROL_EMPTY);
     WH_ASSERT(tuple_->get(slot)->isUndefined());
     WH_ASSERT(str->isInterned());
 
+    uint32_t hash = hashString(StringOrQuery(str.get()));
+
     // Resize table if necessary.
     if (entries_ >= tuple_->size() * MAX_FILL_RATIO) {
         if (!enlarge())
             return false;
 
-        VM::LinearString *exist;
-        slot = lookupSlot(StringOrQuery(str), &exist);
-        WH_ASSERT(!exist);
+        slot = emptySlot(hash);
     }
 
     // Store interned string.
     tuple_->set(slot, Value::HeapString(str));
+    control_[slot] = ControlByte(hash);
     entries_++;
     return true;
 }
@@ -342,34 +440,79 @@ StringTable::insertString(Handle<VM::LinearString *> str, uint32_t slot)
 bool
 StringTable::enlarge()
 {
+    // Only one old table is kept around, so finish any earlier
+    // migration first.
+    finishMigration();
+
     Root<VM::Tuple *> oldTuple(cx_, tuple_);
     uint32_t curSize = tuple_->size();
-    
-    // Allocate a new tuple with double capacity.
-    if (!cx_->inTenured().createTuple(curSize * 2, tuple_))
+
+    // Allocate a new tuple with double capacity.  Entries are moved
+    // into it incrementally by later lookups.
+    VM::Tuple *newTuple;
+    if (!cx_->inTenured().createTuple(curSize * 2, newTuple))
         return false;
 
-    // Add old strings to table.
-    for (uint32_t i = 0; i < curSize; i++) {
-        Handle<Value> oldVal = tuple_->get(i);
-        WH_ASSERT(oldVal->isUndefined() || oldVal->isFalse() ||
-                  oldVal->isHeapString());
-        if (!oldVal->isHeapString())
-            continue;
+    tuple_ = newTuple;
+    oldTuple_ = oldTuple;
+
+    oldControl_.assign(curSize * 2, ToUInt8(CONTROL_EMPTY));
+    oldControl_.swap(control_);
+    migrateGroup_ = 0;
 
-        WH_ASSERT(oldVal->heapStringPtr()->isLinearString());
-        VM::LinearString *oldStr = oldVal->heapStringPtr()->toLinearString();
-        
+    return true;
+}
+
+bool
+StringTable::isMigrating() const
+{
+    return oldTuple_ != nullptr;
+}
 
-        // Check for existing interned string in table.
-        VM::LinearString *dummy;
-        uint32_t slot = lookupSlot(StringOrQuery(oldStr), &dummy);
-        WH_ASSERT(dummy == nullptr);
+void
+StringTable::migrateGroups(uint32_t count)
+{
+    WH_ASSERT(isMigrating());
+
+    uint32_t groupCount = oldControl_.size() / GROUP_SIZE;
+    uint32_t endGroup = migrateGroup_ +
+                        std::min(count, groupCount - migrateGroup_);
+
+    // Interned strings are distinct, so they can be placed without
+    // comparing against other entries.  Migrated slots are marked
+    // deleted so that probes of the old table skip past them.
+    for (; migrateGroup_ < endGroup; migrateGroup_++) {
+        uint32_t base = migrateGroup_ * GROUP_SIZE;
+        for (uint32_t i = base; i < base + GROUP_SIZE; i++) {
+            if (oldControl_[i] & CONTROL_EMPTY)
+                continue;
+
+            Handle<Value> oldVal = oldTuple_->get(i);
+            WH_ASSERT(oldVal->isHeapString());
+            WH_ASSERT(oldVal->heapStringPtr()->isLinearString());
+            VM::LinearString *oldStr =
+                oldVal->heapStringPtr()->toLinearString();
+
+            uint32_t hash = hashString(StringOrQuery(oldStr));
+            uint32_t slot = emptySlot(hash);
+            tuple_->set(slot, Value::HeapString(oldStr));
+            control_[slot] = ControlByte(hash);
+            oldControl_[i] = CONTROL_DELETED;
+        }
+    }
 
-        tuple_->set(slot, Value::HeapString(oldStr));
+    if (migrateGroup_ == groupCount) {
+        oldTuple_ = nullptr;
+        std::vector<uint8_t>().swap(oldControl_);
+        migrateGroup_ = 0;
     }
+}
 
-    return true;
+void
+StringTable::finishMigration()
+{
+    if (isMigrating())
+        migrateGroups(oldControl_.size() / GROUP_SIZE);
 }
 
 
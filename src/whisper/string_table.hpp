@@ -22,17 +22,23 @@ namespace VM
 //
 // StringTable keeps a table of interned strings.
 //
-// All interned strings are LinearStrings.  Any non-interned
-// LinearString added to the table (except for strings which are
-// representable as ImmStrings), are copied into new LinearStrings
-// and returned.
+// All interned strings are atoms: LinearStrings owned by the runtime's
+// AtomTable and shared by every thread, so a string interns to the same
+// LinearString on all threads.  Each thread's StringTable caches the
+// atoms it has used, so that most lookups avoid the shared table.
+// Strings which are representable as ImmStrings are never interned.
 //
-// When a string is interned, a new LinearString is created with the
-// contents and added to the table, even if the incoming
-// string is a LinearString.  This is because the interned string
-// will be created in the tenured generation, so it contributes less
-// to GC pressure, and the query string can be garbage collected
-// earlier (e.g. from the nursery).
+// Strings are stored in a Tuple, with a parallel array of control
+// bytes kept outside the heap.  Each control byte holds the low 7
+// bits of the hash of the string in the corresponding slot, or marks
+// the slot as empty or deleted.  Lookups scan the control bytes of a
+// group of 16 slots at a time, and only touch the strings whose control
+// byte matches, so a lookup usually reads a single string.
+//
+// Enlarging the table does not rehash all entries at once.  The old
+// tuple is kept alongside the new one, and each lookup moves a few
+// groups of entries across until the old tuple is empty.  Lookups
+// search both tuples while this migration is in progress.
 //
 
 class StringTable
@@ -71,9 +77,28 @@ class StringTable
     static constexpr uint32_t INITIAL_TUPLE_SIZE = 512;
     static constexpr float MAX_FILL_RATIO = 0.75;
 
+    // Slots are probed in aligned groups of GROUP_SIZE.  Tuple sizes
+    // are powers of two, and multiples of GROUP_SIZE.
+    static constexpr uint32_t GROUP_SIZE = 16;
+
+    // Control byte values.  Occupied slots have the high bit clear.
+    static constexpr uint8_t CONTROL_EMPTY = 0x80;
+    static constexpr uint8_t CONTROL_DELETED = 0xFE;
+    static constexpr uint8_t CONTROL_HASH_MASK = 0x7F;
+
+    // Number of old groups migrated on each lookup during an enlarge.
+    static constexpr uint32_t MIGRATE_GROUPS = 2;
+
     ThreadContext *cx_;
     uint32_t entries_;
     VM::Tuple *tuple_;
+    std::vector<uint8_t> control_;
+
+    // Table being migrated from, if any.  Groups of the old table
+    // below migrateGroup_ have been moved into tuple_.
+    VM::Tuple *oldTuple_;
+    std::vector<uint8_t> oldControl_;
+    uint32_t migrateGroup_;
 
   public:
     StringTable();
@@ -97,12 +122,24 @@ class StringTable
 
   private:
     uint32_t lookupSlot(const StringOrQuery &str, VM::LinearString **result);
+    uint32_t probeTable(VM::Tuple *tuple, const std::vector<uint8_t> &control,
+                        const StringOrQuery &str, uint32_t hash,
+                        VM::LinearString **result);
+    uint32_t emptySlot(uint32_t hash);
+
+    static uint8_t ControlByte(uint32_t hash);
+    static uint32_t GroupIndex(uint32_t hash);
+    static uint32_t MatchGroup(const uint8_t *group, uint8_t control);
 
     uint32_t hashString(const StringOrQuery &str);
-    int compareStrings(VM::LinearString *a, const StringOrQuery &b);
+    bool equalStrings(VM::LinearString *a, const StringOrQuery &b);
 
     bool insertString(Handle<VM::LinearString *> str, uint32_t slot);
     bool enlarge();
+
+    bool isMigrating() const;
+    void migrateGroups(uint32_t count);
+    void finishMigration();
 };
 
 
@@ -19,7 +19,8 @@ IsValidValueTag(ValueTag tag)
            tag == ValueTag::ImmDoubleLow        ||
            tag == ValueTag::ImmDoubleHigh       ||
            tag == ValueTag::ExtNumber           ||
-           tag == ValueTag::StringAndRest;
+           tag == ValueTag::StringAndRest       ||
+           tag == ValueTag::ImmString6;
 }
 
 unsigned
@@ -32,6 +33,10 @@ ValueTagNumber(ValueTag tag)
 /*static*/ bool
 Value::IsImmediateNumber(double dval)
 {
+#if defined(ENABLE_NANBOX)
+    // All doubles are representable.
+    return true;
+#else
     // Int32s are representable.
     if (ToInt32(dval) == dval)
         return true;
@@ -54,6 +59,7 @@ Value::IsImmediateNumber(double dval)
         return true;
 
     return false;
+#endif // defined(ENABLE_NANBOX)
 }
 
 template <typename CharT>
@@ -115,6 +121,121 @@ Value::IsImmediateIndexString(uint32_t length, const uint16_t *str)
     return ImmediateIndexValue(length, str) == -1;
 }
 
+static_assert(Value::ImmString6MaxLength <= Value::ImmStringMaxLength,
+              "ImmString6 strings must fit in immediate string buffers.");
+
+/*static*/ const char Value::ImmString6Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789_$";
+
+/*static*/ unsigned
+Value::ImmString6Digit(uint16_t ch)
+{
+    if (ch >= 'A' && ch <= 'Z')
+        return (ch - 'A') + 1;
+    if (ch >= 'a' && ch <= 'z')
+        return (ch - 'a') + 27;
+    if (ch >= '0' && ch <= '9')
+        return (ch - '0') + 53;
+    if (ch == '_')
+        return 63;
+    if (ch == '$')
+        return 64;
+    return 0;
+}
+
+template <typename CharT>
+static bool
+IsImmediateString6Helper(uint32_t length, const CharT *str)
+{
+    if (length == 0 || length > Value::ImmString6MaxLength)
+        return false;
+
+    for (uint32_t i = 0; i < length; i++) {
+        if (Value::ImmString6Digit(str[i]) == 0)
+            return false;
+    }
+    return true;
+}
+
+/*static*/ bool
+Value::IsImmediateString6(uint32_t length, const uint8_t *str)
+{
+    return IsImmediateString6Helper<uint8_t>(length, str);
+}
+
+/*static*/ bool
+Value::IsImmediateString6(uint32_t length, const uint16_t *str)
+{
+    return IsImmediateString6Helper<uint16_t>(length, str);
+}
+
+/*static*/ bool
+Value::MakeImmString(uint32_t length, const uint8_t *str, Value &output)
+{
+    // Check for integer index.
+    int32_t idxVal = ImmediateIndexValue(length, str);
+    if (idxVal >= 0) {
+        output = ImmIndexString(idxVal);
+        return true;
+    }
+
+    if (length <= ImmString8MaxLength) {
+        output = ImmString8(length, str);
+        return true;
+    }
+
+    if (IsImmediateString6(length, str)) {
+        output = ImmString6(length, str);
+        return true;
+    }
+
+    return false;
+}
+
+/*static*/ bool
+Value::MakeImmString(uint32_t length, const uint16_t *str, Value &output)
+{
+    // Check for integer index.
+    int32_t idxVal = ImmediateIndexValue(length, str);
+    if (idxVal >= 0) {
+        output = ImmIndexString(idxVal);
+        return true;
+    }
+
+    // Check if this is really an 8-bit immediate string in 16-bit clothes.
+    if (length <= ImmString8MaxLength) {
+        bool isEightBit = true;
+        for (unsigned i = 0; i < length; i++) {
+            if (str[i] > 0xFFu) {
+                isEightBit = false;
+                break;
+            }
+        }
+        if (isEightBit) {
+            uint8_t buf[ImmString8MaxLength];
+            for (unsigned i = 0; i < length; i++)
+                buf[i] = str[i];
+            output = ImmString8(length, buf);
+            return true;
+        }
+    }
+
+    if (IsImmediateString6(length, str)) {
+        output = ImmString6(length, str);
+        return true;
+    }
+
+    // Check if fits in 16-bit immediate string.
+    if (length <= ImmString16MaxLength) {
+        output = ImmString16(length, str);
+        return true;
+    }
+
+    return false;
+}
+
 Value::Value() : tagged_(Invalid) {}
 
 // Raw uint64_t constructor is private.
@@ -128,6 +249,12 @@ Value::Value(uint64_t tagged) : tagged_(tagged)
 ValueTag
 Value::getTag() const
 {
+#if defined(ENABLE_NANBOX)
+    // Encoded doubles are all reported as ImmDoubleLow.
+    if (tagged_ & EncodedDoubleMask)
+        return ValueTag::ImmDoubleLow;
+#endif // defined(ENABLE_NANBOX)
+
     ValueTag tag = static_cast<ValueTag>(tagged_ & TagMask);
     WH_ASSERT(IsValidValueTag(tag));
     return tag;
@@ -159,10 +286,22 @@ Value::Undefined()
     return Value(UndefinedVal);
 }
 
+/*static*/ Value
+Value::False()
+{
+    return Value(FalseVal);
+}
+
+/*static*/ Value
+Value::True()
+{
+    return Value(TrueVal);
+}
+
 /*static*/ Value
 Value::Int32(int32_t value)
 {
-    return Value((ToUInt64(value) << Int32Shift) | Int32Code);
+    return Value((ToUInt64(ToUInt32(value)) << Int32Shift) | Int32Code);
 }
 
 /*static*/ Value
@@ -171,6 +310,11 @@ Value::Double(double dval)
     WH_ASSERT(IsImmediateNumber(dval));
     WH_ASSERT_IF(dval == 0.0, GetDoubleSign(dval));
 
+#if defined(ENABLE_NANBOX)
+    // Canonicalize NaNs so that no encoded double can wrap around.
+    uint64_t bits = (dval != dval) ? CanonicalNaNBits : DoubleToInt(dval);
+    return Value(bits + DoubleEncodeOffset);
+#else
     if (dval != dval)
         return NaN();
 
@@ -187,6 +331,7 @@ Value::Double(double dval)
     Value result = Value(RotateLeft(DoubleToInt(dval), 4));
     WH_ASSERT(result.isImmDoubleLow() || result.isImmDoubleHigh());
     return result;
+#endif // defined(ENABLE_NANBOX)
 }
 
 /*static*/ Value
@@ -194,7 +339,7 @@ Value::Number(double dval)
 {
     WH_ASSERT(IsImmediateNumber(dval));
 
-    if (ToInt32(dval) == dval)
+    if (ToInt32(dval) == dval && !(dval == 0 && GetDoubleSign(dval)))
         return Int32(dval);
 
     return Double(dval);
@@ -211,25 +356,41 @@ Value::HeapDouble(VM::HeapDouble *dbl)
 /*static*/ Value
 Value::NaN()
 {
+#if defined(ENABLE_NANBOX)
+    return Double(std::numeric_limits<double>::quiet_NaN());
+#else
     return Value(NaNVal);
+#endif // defined(ENABLE_NANBOX)
 }
 
 /*static*/ Value
 Value::PosInf()
 {
+#if defined(ENABLE_NANBOX)
+    return Double(std::numeric_limits<double>::infinity());
+#else
     return Value(PosInfVal);
+#endif // defined(ENABLE_NANBOX)
 }
 
 /*static*/ Value
 Value::NegInf()
 {
+#if defined(ENABLE_NANBOX)
+    return Double(-std::numeric_limits<double>::infinity());
+#else
     return Value(NegInfVal);
+#endif // defined(ENABLE_NANBOX)
 }
 
 /*static*/ Value
 Value::NegZero()
 {
+#if defined(ENABLE_NANBOX)
+    return Double(-static_cast<double>(0.0));
+#else
     return Value(NegZeroVal);
+#endif // defined(ENABLE_NANBOX)
 }
 
 /*static*/ Value
@@ -238,7 +399,7 @@ Value::ImmString8(unsigned length, const uint8_t *data)
     WH_ASSERT(length <= ImmString8MaxLength);
     uint64_t val = ImmString8Code | (length << ImmString8LengthShift);
     for (unsigned i = 0; i < length; i++)
-        val |= data[i] << (ImmString8DataShift + (i*8));
+        val |= ToUInt64(data[i]) << (ImmString8DataShift + (i*8));
     return Value(val);
 }
 
@@ -248,7 +409,7 @@ Value::ImmString16(unsigned length, const uint16_t *data)
     WH_ASSERT(length <= ImmString16MaxLength);
     uint64_t val = ImmString16Code | (length << ImmString16LengthShift);
     for (unsigned i = 0; i < length; i++)
-        val |= data[i] << (ImmString16DataShift + (i*16));
+        val |= ToUInt64(data[i]) << (ImmString16DataShift + (i*16));
     return Value(val);
 }
 
@@ -261,6 +422,32 @@ Value::ImmIndexString(int32_t idx)
     return Value(val);
 }
 
+template <typename CharT>
+static uint64_t
+ImmString6Bits(unsigned length, const CharT *data)
+{
+    WH_ASSERT(Value::IsImmediateString6(length, data));
+    uint64_t digits = 0;
+    for (unsigned i = 0; i < length; i++) {
+        digits <<= Value::ImmString6CharBits;
+        digits += Value::ImmString6Digit(data[i]);
+    }
+    return (digits << Value::ImmString6DataShift) |
+           ValueTagNumber(ValueTag::ImmString6);
+}
+
+/*static*/ Value
+Value::ImmString6(unsigned length, const uint8_t *data)
+{
+    return Value(ImmString6Bits<uint8_t>(length, data));
+}
+
+/*static*/ Value
+Value::ImmString6(unsigned length, const uint16_t *data)
+{
+    return Value(ImmString6Bits<uint16_t>(length, data));
+}
+
 /*static*/ Value
 Value::HeapString(VM::HeapString *str)
 {
@@ -291,14 +478,22 @@ Value::isValid() const
 
       case ValueTag::ImmDoubleLow:
       case ValueTag::ImmDoubleHigh:
+#if defined(ENABLE_NANBOX)
+        return (tagged_ & EncodedDoubleMask) != 0u;
+#else
         return true;
+#endif // defined(ENABLE_NANBOX)
 
       case ValueTag::ExtNumber:
         if ((tagged_ & Int32Mask) == Int32Code)
             return true;
 
+#if defined(ENABLE_NANBOX)
+        return false;
+#else
         return tagged_ == NaNVal || tagged_ == NegInfVal ||
                tagged_ == PosInfVal || tagged_ == NegZeroVal;
+#endif // defined(ENABLE_NANBOX)
 
       case ValueTag::StringAndRest:
         if (((tagged_ & ImmString8Mask) == ImmString8Code) ||
@@ -312,6 +507,9 @@ Value::isValid() const
                tagged_ == FalseVal ||
                tagged_ == TrueVal;
 
+      case ValueTag::ImmString6:
+        return (tagged_ >> ImmString6DataShift) != 0u;
+
       default:
         WH_UNREACHABLE("Invalid ValueTag.");
         return false;
@@ -355,6 +553,12 @@ Value::type() const
         if (tagged_ == TrueVal)
             return ValueType::Boolean;
 
+        WH_UNREACHABLE("Invalid StringAndRest value.");
+        return ValueType::INVALID;
+
+      case ValueTag::ImmString6:
+        return ValueType::String;
+
       default:
         WH_UNREACHABLE("Invalid ValueTag.");
         return ValueType::INVALID;
@@ -394,73 +598,95 @@ Value::isImmDoubleHigh() const
 bool
 Value::isNaN() const
 {
+#if defined(ENABLE_NANBOX)
+    return tagged_ == NaN().tagged_;
+#else
     return (tagged_ & ExtNumberMask) == NaNVal;
+#endif // defined(ENABLE_NANBOX)
 }
 
 bool
 Value::isNegInf() const
 {
+#if defined(ENABLE_NANBOX)
+    return tagged_ == NegInf().tagged_;
+#else
     return (tagged_ & ExtNumberMask) == NegInfVal;
+#endif // defined(ENABLE_NANBOX)
 }
 
 bool
 Value::isPosInf() const
 {
+#if defined(ENABLE_NANBOX)
+    return tagged_ == PosInf().tagged_;
+#else
     return (tagged_ & ExtNumberMask) == PosInfVal;
+#endif // defined(ENABLE_NANBOX)
 }
 
 bool
 Value::isNegZero() const
 {
+#if defined(ENABLE_NANBOX)
+    return tagged_ == NegZero().tagged_;
+#else
     return (tagged_ & ExtNumberMask) == NegZeroVal;
+#endif // defined(ENABLE_NANBOX)
 }
 
 bool
 Value::isInt32() const
 {
-    return (tagged_ & ExtNumberMask) == Int32Code;
+    return (tagged_ & (ExtNumberMask | EncodedDoubleMask)) == Int32Code;
 }
 
 bool
 Value::isImmString8() const
 {
-    return (tagged_ & ImmString8Mask) == ImmString8Code;
+    return (tagged_ & (ImmString8Mask | EncodedDoubleMask)) == ImmString8Code;
 }
 
 bool
 Value::isImmString16() const
 {
-    return (tagged_ & ImmString16Mask) == ImmString16Code;
+    return (tagged_ & (ImmString16Mask | EncodedDoubleMask)) == ImmString16Code;
 }
 
 bool
 Value::isImmIndexString() const
 {
-    return (tagged_ & ImmIndexStringMask) == ImmIndexStringCode;
+    return (tagged_ & (ImmIndexStringMask | EncodedDoubleMask)) == ImmIndexStringCode;
+}
+
+bool
+Value::isImmString6() const
+{
+    return checkTag(ValueTag::ImmString6);
 }
 
 bool
 Value::isUndefined() const
 {
-    return (tagged_ & RestMask) == UndefinedVal;
+    return (tagged_ & (RestMask | EncodedDoubleMask)) == UndefinedVal;
 }
 
 bool
 Value::isNull() const
 {
-    return (tagged_ & RestMask) == NullVal;
+    return (tagged_ & (RestMask | EncodedDoubleMask)) == NullVal;
 }
 
 bool
 Value::isFalse() const
 {
-    return (tagged_ & RestMask) == FalseVal;
+    return (tagged_ & (RestMask | EncodedDoubleMask)) == FalseVal;
 }
 
 bool
 Value::isTrue() const
 {
-    return (tagged_ & RestMask) == TrueVal;
+    return (tagged_ & (RestMask | EncodedDoubleMask)) == TrueVal;
 }
 
 
@@ -495,13 +721,14 @@ Value::isNumber() const
 bool
 Value::isBoolean() const
 {
-    return (tagged_ & BoolMask) == BoolCode;
+    return (tagged_ & (BoolMask | EncodedDoubleMask)) == BoolCode;
 }
 
 bool
 Value::isImmString() const
 {
-    return isImmString8() || isImmString16() || isImmIndexString();
+    return isImmString8() || isImmString16() || isImmIndexString() ||
+           isImmString6();
 }
 
 bool
@@ -566,8 +793,13 @@ Value::numberValue() const
     if (isNegZero())
         return -static_cast<double>(0.0);
 
+#if defined(ENABLE_NANBOX)
+    if (isImmDoubleLow())
+        return IntToDouble(tagged_ - DoubleEncodeOffset);
+#else
     if (isImmDoubleLow() || isImmDoubleHigh())
         return IntToDouble(RotateRight<uint64_t>(tagged_, 4));
+#endif // defined(ENABLE_NANBOX)
 
     WH_ASSERT(isHeapDouble());
     return heapDoublePtr()->value();
@@ -613,7 +845,7 @@ Value::immIndexStringLength() const
 {
     WH_ASSERT(isImmIndexString());
     int32_t val = immIndexStringValue();
-    WH_ASSERT(val > 0);
+    WH_ASSERT(val >= 0);
     if (val < 10)
         return 1;
     if (val < 100)
@@ -638,21 +870,50 @@ Value::immIndexStringLength() const
 uint8_t
 Value::getImmIndexStringChar(unsigned idx) const
 {
-    WH_ASSERT(idx < immIndexStringLength());
+    unsigned length = immIndexStringLength();
+    WH_ASSERT(idx < length);
     int32_t val = immIndexStringValue();
-    return ToUInt8('0') + ((val / (idx * 10)) % 10);
+    for (unsigned i = idx + 1; i < length; i++)
+        val /= 10;
+    return ToUInt8('0') + (val % 10);
+}
+
+unsigned
+Value::immString6Length() const
+{
+    WH_ASSERT(isImmString6());
+    uint64_t digits = tagged_ >> ImmString6DataShift;
+    unsigned length = 0;
+    while (digits > 0) {
+        digits = (digits - 1) >> ImmString6CharBits;
+        length++;
+    }
+    WH_ASSERT(length <= ImmString6MaxLength);
+    return length;
+}
+
+uint8_t
+Value::getImmString6Char(unsigned idx) const
+{
+    uint8_t buf[ImmString6MaxLength];
+    DebugVal<unsigned> length = readImmString6(buf);
+    WH_ASSERT(idx < length);
+    return buf[idx];
 }
 
 unsigned
 Value::immStringLength() const
 {
-    WH_ASSERT(isImmString8() || isImmString16() || isImmIndexString());
+    WH_ASSERT(isImmString());
 
     if (isImmString8())
         return immString8Length();
 
     if (isImmString16())
-        immString16Length();
+        return immString16Length();
+
+    if (isImmString6())
+        return immString6Length();
 
     return immIndexStringLength();
 }
@@ -660,7 +921,7 @@ Value::immStringLength() const
 uint16_t
 Value::getImmStringChar(unsigned idx) const
 {
-    WH_ASSERT(isImmString8() || isImmString16() || isImmIndexString());
+    WH_ASSERT(isImmString());
 
     if (isImmString8())
         return getImmString8Char(idx);
@@ -668,6 +929,9 @@ Value::getImmStringChar(unsigned idx) const
     if (isImmString16())
         return getImmString16Char(idx);
 
+    if (isImmString6())
+        return getImmString6Char(idx);
+
     return getImmIndexStringChar(idx);
 }
 
@@ -46,7 +46,7 @@ namespace Whisper {
 //      10111 - UNUSED
 //      11111 - UNUSED
 //
-//    111 - UNUSED
+//    111 - 6-bit immediate string (up to 10 identifier chars).
 //
 //  PPPP-PPPP PPPP-PPPP ... PPPP-PPPP PPPP-PPPP PPPP-P000 - Object ptr.
 //  PPPP-PPPP PPPP-PPPP ... PPPP-PPPP PPPP-PPPP PPPP-P001 - Heap string ptr.
@@ -65,7 +65,44 @@ namespace Whisper {
 //  0000-0000 0000-0000 ... 0000-0000 0000-0000 0101-1110 - Null
 //  0000-0000 0000-0000 ... 0000-0000 0000-0000 0011-1110 - False
 //  0000-0000 0000-0000 ... 0000-0000 0000-0000 0111-1110 - True
+//  DDDD-DDDD DDDD-DDDD ... DDDD-DDDD DDDD-DDDD DDDD-D111 - ImmString6
 //
+// ImmString6 packs strings of identifier characters ([A-Za-z0-9_$])
+// which are too long for ImmString8.  Each char maps to a digit in the
+// range 1-64, and the digits are stored as a bijective base-64 number
+// with the first char most significant.  Since no digit is zero, the
+// length is implied by the number itself, and all 61 bits above the
+// tag are available for chars.
+//
+// Immediate strings are canonical: a given string is always represented
+// by the same kind of immediate (see MakeImmString), so two immediate
+// strings are equal exactly when their values are equal.
+//
+//
+// NaN-boxed representation (ENABLE_NANBOX)
+// ----------------------------------------
+//
+// When built with ENABLE_NANBOX, every double is stored immediately and
+// no HeapDoubles are ever created for numbers.  A double is encoded by
+// canonicalizing its NaN and adding a constant offset of 2^49 to its bit
+// pattern.  Because NaNs are canonicalized, no encoded double wraps
+// around, and every encoded double has at least one of its high 15 bits
+// set.
+//
+// All other values are required to fit within the low 49 bits, and use
+// the same tagging scheme as above.  Pointers fit trivially.  The
+// ImmString8 and ImmString16 formats lose their high characters and are
+// limited to 5 and 2 chars respectively, and ImmString6 is limited to
+// 7 chars.  The ExtNumber special double
+// codes (NaN, NegInf, PosInf, NegZero) are unused since those doubles are
+// encoded directly.
+//
+//  HHHH-HHHH HHHH-HHHD ... DDDD-DDDD DDDD-DDDD DDDD-DDDD - Double + 2^49
+//  0000-0000 0000-000P ... PPPP-PPPP PPPP-PPPP PPPP-PTTT - Everything else
+//
+// The getTag() method reports all encoded doubles as ImmDoubleLow, so
+// code that checks for immediate doubles works unchanged under either
+// representation.
 //
 
 namespace VM {
@@ -105,6 +142,7 @@ enum class ValueRepr : uint8_t
     ImmString8,
     ImmString16,
     ImmIndexString,
+    ImmString6,
     Undefined,
     Null,
     False,
@@ -122,7 +160,8 @@ enum class ValueTag : uint8_t
     ImmDoubleLow        = 0x03, // MMMMM-011
     ImmDoubleHigh       = 0x04, // MMMMM-100
     ExtNumber           = 0x05, // ?????-101 - Integer and special doubles
-    StringAndRest       = 0x06  // ?????-110 - immstring, undef, null, bool
+    StringAndRest       = 0x06, // ?????-110 - immstring, undef, null, bool
+    ImmString6          = 0x07  // DDDDD-111 - 6-bit immstring
 };
 
 bool IsValidValueTag(ValueTag tag);
@@ -134,6 +173,17 @@ class Value
     static constexpr unsigned TagBits = 3;
     static constexpr uint64_t TagMask = (1u << TagBits) - 1;
 
+#if defined(ENABLE_NANBOX)
+    static constexpr unsigned PayloadBits = 49;
+    static constexpr uint64_t DoubleEncodeOffset = ToUInt64(1) << PayloadBits;
+    static constexpr uint64_t CanonicalNaNBits = 0x7FF8000000000000ULL;
+
+    // Bits which are only ever set in encoded doubles.  Masked checks
+    // on non-double values include these bits to exclude doubles.
+    static constexpr uint64_t EncodedDoubleMask = ~(DoubleEncodeOffset - 1);
+#else
+    static constexpr uint64_t EncodedDoubleMask = 0u;
+#endif // defined(ENABLE_NANBOX)
 
     static constexpr uint64_t ExtNumberMask = 0xff;
 
@@ -151,14 +201,22 @@ class Value
     static constexpr unsigned ImmString8Code = 0x00 | 0x6;
     static constexpr unsigned ImmString8LengthMask = 0x07;
     static constexpr unsigned ImmString8LengthShift = 5;
+#if defined(ENABLE_NANBOX)
+    static constexpr unsigned ImmString8MaxLength = 5;
+#else
     static constexpr unsigned ImmString8MaxLength = 7;
+#endif
     static constexpr unsigned ImmString8DataShift = 8;
 
     static constexpr unsigned ImmString16Mask = 0x3f;
     static constexpr unsigned ImmString16Code = 0x10 | 0x6;
     static constexpr unsigned ImmString16LengthMask = 0x03;
     static constexpr unsigned ImmString16LengthShift = 6;
+#if defined(ENABLE_NANBOX)
+    static constexpr unsigned ImmString16MaxLength = 2;
+#else
     static constexpr unsigned ImmString16MaxLength = 3;
+#endif
     static constexpr unsigned ImmString16DataShift = 16;
 
     static constexpr unsigned ImmIndexStringMask = 0x3f;
@@ -166,6 +224,18 @@ class Value
     static constexpr unsigned ImmIndexStringMaxLength = 10; // "2147483647"
     static constexpr unsigned ImmIndexStringDataShift = 8;
 
+    static constexpr unsigned ImmString6DataShift = 3;
+    static constexpr unsigned ImmString6CharBits = 6;
+    static constexpr uint64_t ImmString6CharMask = 0x3f;
+#if defined(ENABLE_NANBOX)
+    static constexpr unsigned ImmString6MaxLength = 7;
+#else
+    static constexpr unsigned ImmString6MaxLength = 10;
+#endif
+
+    // Chars of ImmString6 strings, indexed by (digit - 1).
+    static const char ImmString6Alphabet[];
+
     static constexpr unsigned ImmStringMaxLength = ImmIndexStringMaxLength;
 
     static constexpr unsigned RestMask = 0xff;
@@ -189,6 +259,16 @@ class Value
     static bool IsImmediateIndexString(uint32_t length, const uint8_t *str);
     static bool IsImmediateIndexString(uint32_t length, const uint16_t *str);
 
+    static unsigned ImmString6Digit(uint16_t ch);
+    static bool IsImmediateString6(uint32_t length, const uint8_t *str);
+    static bool IsImmediateString6(uint32_t length, const uint16_t *str);
+
+    // Make the canonical immediate value for a string, if it has one.
+    static bool MakeImmString(uint32_t length, const uint8_t *str,
+                              Value &output);
+    static bool MakeImmString(uint32_t length, const uint16_t *str,
+                              Value &output);
+
   protected:
     uint64_t tagged_;
 
@@ -212,6 +292,8 @@ class Value
     // Constructors.
     //
     static Value Undefined();
+    static Value False();
+    static Value True();
     static Value Int32(int32_t value);
     static Value Double(double dval);
     static Value Number(double dval);
@@ -225,6 +307,8 @@ class Value
     static Value ImmString8(unsigned length, const uint8_t *data);
     static Value ImmString16(unsigned length, const uint16_t *data);
     static Value ImmIndexString(int32_t idx);
+    static Value ImmString6(unsigned length, const uint8_t *data);
+    static Value ImmString6(unsigned length, const uint16_t *data);
     static Value HeapString(VM::HeapString *str);
 
     static Value Object(VM::HeapThing *thing);
@@ -262,6 +346,7 @@ class Value
     bool isImmString8() const;
     bool isImmString16() const;
     bool isImmIndexString() const;
+    bool isImmString6() const;
 
     bool isUndefined() const;
     bool isNull() const;
@@ -311,6 +396,12 @@ class Value
     template <typename CharT>
     inline uint32_t readImmIndexString(CharT *buf) const;
 
+    unsigned immString6Length() const;
+    uint8_t getImmString6Char(unsigned idx) const;
+
+    template <typename CharT>
+    inline uint32_t readImmString6(CharT *buf) const;
+
     unsigned immStringLength() const;
     uint16_t getImmStringChar(unsigned idx) const;
 
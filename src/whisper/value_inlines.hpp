@@ -42,14 +42,30 @@ inline uint32_t
 Value::readImmIndexString(CharT *buf) const
 {
     WH_ASSERT(this->isImmIndexString());
-    unsigned len = 0;
+    unsigned len = immIndexStringLength();
     uint64_t val = tagged_ >> ImmIndexStringDataShift;
-    do {
-        buf[len] = static_cast<CharT>('0') + (val % 10);
+    for (unsigned i = len; i > 0; i--) {
+        buf[i - 1] = static_cast<CharT>('0') + (val % 10);
         val /= 10;
-        len++;
-    } while (val > 0);
-    WH_ASSERT(len <= ImmIndexStringMaxLength);
+    }
+    WH_ASSERT(val == 0);
+    return len;
+}
+
+template <typename CharT>
+inline uint32_t
+Value::readImmString6(CharT *buf) const
+{
+    WH_ASSERT(this->isImmString6());
+    unsigned len = immString6Length();
+
+    // Digits are extracted starting from the last char.
+    uint64_t digits = tagged_ >> ImmString6DataShift;
+    for (unsigned i = len; i > 0; i--) {
+        buf[i - 1] = ImmString6Alphabet[(digits - 1) & ImmString6CharMask];
+        digits = (digits - 1) >> ImmString6CharBits;
+    }
+    WH_ASSERT(digits == 0);
     return len;
 }
 
@@ -59,7 +75,7 @@ Value::readImmString(CharT *buf) const
 {
     static_assert(Trunc || sizeof(CharT) >= sizeof(uint16_t),
                   "Character type too small for non-truncating read.");
-    WH_ASSERT(isImmString8() || isImmString16() || isImmIndexString());
+    WH_ASSERT(isImmString());
 
     if (this->isImmString8())
         return this->readImmString8<CharT>(buf);
@@ -67,6 +83,9 @@ Value::readImmString(CharT *buf) const
     if (this->isImmString16())
         return this->readImmString16<CharT, Trunc>(buf);
 
+    if (this->isImmString6())
+        return this->readImmString6<CharT>(buf);
+
     return this->readImmIndexString<CharT>(buf);
 }
 
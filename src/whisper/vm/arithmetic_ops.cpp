@@ -8,6 +8,7 @@
 #include "rooting_inlines.hpp"
 #include "vm/heap_thing_inlines.hpp"
 #include "vm/stack_frame.hpp"
+#include "vm/string.hpp"
 #include "vm/arithmetic_ops.hpp"
 
 namespace Whisper {
@@ -58,7 +59,10 @@ PerformAdd(RunContext *cx, Handle<Value> lhs, Handle<Value> rhs,
         return SetOutputAndReturn(out, result.get());
     }
 
-    WH_UNREACHABLE("Non-int32 add not implemented yet!");
+    if (lhs->isString() && rhs->isString())
+        return ConcatenateStrings(cx, lhs, rhs, out);
+
+    WH_UNREACHABLE("Non-number, non-string add not implemented yet!");
     return false;
 }
 
@@ -265,5 +269,51 @@ PerformNeg(RunContext *cx, Handle<Value> in, MutHandle<Value> out)
 }
 
 
+double
+PerformNumberAdd(double lhs, double rhs)
+{
+    return lhs + rhs;
+}
+
+
+double
+PerformNumberSub(double lhs, double rhs)
+{
+    return lhs - rhs;
+}
+
+
+double
+PerformNumberMul(double lhs, double rhs)
+{
+    return lhs * rhs;
+}
+
+
+double
+PerformNumberDiv(double lhs, double rhs)
+{
+    // IEEE division already yields the required NaN and signed
+    // infinity results for zero divisors.
+    return lhs / rhs;
+}
+
+
+double
+PerformNumberMod(double lhs, double rhs)
+{
+    // fmod matches the semantics of the % operator on numbers: the
+    // result takes the sign of the dividend.
+    return fmod(lhs, rhs);
+}
+
+
+double
+PerformNumberNeg(double in)
+{
+    return -in;
+}
+
+
 } // namespace VM
 } // namespace Whisper
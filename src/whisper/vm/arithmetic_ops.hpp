@@ -27,6 +27,19 @@ bool PerformMod(RunContext *cx, Handle<Value> lhs, Handle<Value> rhs,
 
 bool PerformNeg(RunContext *cx, Handle<Value> in, MutHandle<Value> out);
 
+//
+// Unboxed number variants of the above.  These operate directly on
+// numbers and never allocate, which lets the interpreter keep the
+// results of arithmetic in unboxed frame slots.
+//
+
+double PerformNumberAdd(double lhs, double rhs);
+double PerformNumberSub(double lhs, double rhs);
+double PerformNumberMul(double lhs, double rhs);
+double PerformNumberDiv(double lhs, double rhs);
+double PerformNumberMod(double lhs, double rhs);
+double PerformNumberNeg(double in);
+
 
 } // namespace VM
 } // namespace Whisper
@@ -13,11 +13,10 @@ namespace VM {
 
 
 //
-// Double objects are reasonably straightforward.
+// Double objects are reasonably straightforward.  They are allocated
+// in typed slabs, and carry no header word.
 //
 //      +-----------------------+
-//      | Header                |
-//      +-----------------------+
 //      | Value                 |
 //      +-----------------------+
 //
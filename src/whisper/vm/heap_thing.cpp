@@ -49,12 +49,36 @@ SpewHeapThingArea(const uint8_t *startu8, const uint8_t *endu8)
     }
 }
 
+static void
+SpewHeapThingTypedSlab(Slab *slab)
+{
+    HeapType type = static_cast<HeapType>(slab->cellType());
+    uint32_t words = DivUp<uint32_t>(slab->cellSize(), sizeof(uint64_t));
+
+    for (uint32_t i = 0; i < slab->numCells(); i++) {
+        if (!slab->isCellAllocated(i))
+            continue;
+
+        const uint64_t *cell =
+            reinterpret_cast<const uint64_t *>(slab->cellAddress(i));
+        SpewSlabNote("{%016p}  <%s> [cell=%u]", cell, HeapTypeString(type),
+                     (unsigned) i);
+        for (uint32_t j = 0; j < words; j++)
+            SpewSlabNote("{%016p}  %016" PRIx64, &cell[j], cell[j]);
+    }
+}
+
 void
 SpewHeapThingSlab(Slab *slab)
 {
     if (ChannelSpewLevel(SpewChannel::Slab) > SpewLevel::Note)
         return;
 
+    if (slab->isTyped()) {
+        SpewHeapThingTypedSlab(slab);
+        return;
+    }
+
     uint8_t *headStart = slab->headStartAlloc();
     uint8_t *headEnd = slab->headEndAlloc();
     SpewHeapThingArea(headStart, headEnd);
@@ -123,6 +147,13 @@ HeapThingHeader::addFlags(uint32_t fl)
     header_ |= ToUInt64(fl) << FlagsShift;
 }
 
+void
+HeapThingHeader::removeFlags(uint32_t fl)
+{
+    WH_ASSERT(fl <= FlagsMask);
+    header_ &= ~(ToUInt64(fl) << FlagsShift);
+}
+
 //
 // HeapThing
 //
@@ -133,6 +164,7 @@ HeapThing::~HeapThing() {}
 HeapThingHeader *
 HeapThing::header()
 {
+    WH_ASSERT(!typedSlab());
     uint64_t *thisp = recastThis<uint64_t>();
     return reinterpret_cast<HeapThingHeader *>(thisp - 1);
 }
@@ -140,10 +172,18 @@ HeapThing::header()
 const HeapThingHeader *
 HeapThing::header() const
 {
+    WH_ASSERT(!typedSlab());
     const uint64_t *thisp = recastThis<const uint64_t>();
     return reinterpret_cast<const HeapThingHeader *>(thisp - 1);
 }
 
+Slab *
+HeapThing::typedSlab() const
+{
+    Slab *slab = Slab::FromPointer(this);
+    return slab->isTyped() ? slab : nullptr;
+}
+
 void 
 HeapThing::initFlags(uint32_t flags)
 {
@@ -156,6 +196,12 @@ HeapThing::addFlags(uint32_t flags)
     header()->addFlags(flags);
 }
 
+void
+HeapThing::removeFlags(uint32_t flags)
+{
+    header()->removeFlags(flags);
+}
+
 void 
 HeapThing::noteWrite(void *ptr)
 {
@@ -165,24 +211,32 @@ HeapThing::noteWrite(void *ptr)
 uint32_t 
 HeapThing::cardNo() const
 {
+    if (Slab *slab = typedSlab())
+        return slab->calculateCardNumber(recastThis<uint8_t>());
     return header()->cardNo();
 }
 
 HeapType 
 HeapThing::type() const
 {
+    if (Slab *slab = typedSlab())
+        return static_cast<HeapType>(slab->cellType());
     return header()->type();
 }
 
 uint32_t 
 HeapThing::objectSize() const
 {
+    if (Slab *slab = typedSlab())
+        return slab->cellSize();
     return header()->size();
 }
 
 uint32_t 
 HeapThing::flags() const
 {
+    if (typedSlab())
+        return 0;
     return header()->flags();
 }
 
@@ -42,9 +42,10 @@ const char *HeapTypeString(HeapType ht);
 void SpewHeapThingSlab(Slab *slab);
 
 template <HeapType HT> struct HeapTypeTraits {};
-#define TRAITS_(t, traced) \
+#define TRAITS_(t, traced, typedSlab) \
     template <> struct HeapTypeTraits<HeapType::t> { \
         static constexpr bool Traced = traced; \
+        static constexpr bool TypedSlab = typedSlab; \
     };
     WHISPER_DEFN_HEAP_TYPES(TRAITS_)
 #undef TRAITS_
@@ -99,6 +100,10 @@ template <HeapType HT> struct HeapTypeTraits {};
 //      It's basically a small number of "free" bits which a type can
 //      use to track information about an object.
 //
+// Heap things of types allocated in typed slabs (see slab.hpp) have
+// no header word.  Their type and size are recorded in the slab, and
+// their flags are always zero.
+//
 
 class HeapThingHeader
 {
@@ -145,6 +150,7 @@ class HeapThingHeader
   protected:
     void initFlags(uint32_t fl);
     void addFlags(uint32_t fl);
+    void removeFlags(uint32_t fl);
 };
 
 //
@@ -199,8 +205,13 @@ class HeapThing
 
     const HeapThingHeader *header() const;
 
+    // Get the typed slab holding this thing, or null if this thing
+    // has a header.
+    Slab *typedSlab() const;
+
     void initFlags(uint32_t flags);
     void addFlags(uint32_t flags);
+    void removeFlags(uint32_t flags);
 
     // Write barrier helper
     void noteWrite(void *ptr);
@@ -3,43 +3,50 @@
 
 
 // Macro iterating over all heap types.
+//
+// Types with TypedSlab set are small, fixed-size, headerless types
+// which are allocated in typed (BiBOP) slabs.  See slab.hpp.
 #define WHISPER_DEFN_HEAP_TYPES(_)                              \
-    /* Name                             Traced */               \
+    /* Name                             Traced TypedSlab */     \
     \
-    _(HeapDouble,                       false)                  \
-    _(LinearString,                     false)                  \
-    _(Bytecode,                         false)                  \
+    _(HeapDouble,                       false,  true)           \
+    _(LinearString,                     false,  false)          \
+    _(ConcatString,                     true,   false)          \
+    _(DependentString,                  true,   false)          \
+    _(ExternalString,                   false,  false)          \
+    _(Bytecode,                         false,  false)          \
+    _(RawElements,                      false,  false)          \
     \
-    _(Tuple,                            true)                   \
+    _(Tuple,                            true,   false)          \
     \
-    _(ShapeTree,                        true)                   \
-    _(ShapeTreeChild,                   true)                   \
-    _(Shape,                            true)                   \
+    _(ShapeTree,                        true,   false)          \
+    _(ShapeTreeChild,                   true,   false)          \
+    _(Shape,                            true,   false)          \
     \
-    _(Script,                           true)                   \
-    _(StackFrame,                       true)                   \
+    _(Script,                           true,   false)          \
+    _(StackFrame,                       true,   false)          \
     \
-    _(ObjectScopeDescriptor,            true)                   \
-    _(ObjectScope,                      true)                   \
-    _(DeclarativeScopeDescriptor,       true)                   \
-    _(DeclarativeScope,                 true)                   \
-    _(GlobalScope,                      true)                   \
+    _(ObjectScopeDescriptor,            true,   false)          \
+    _(ObjectScope,                      true,   false)          \
+    _(DeclarativeScopeDescriptor,       true,   false)          \
+    _(DeclarativeScope,                 true,   false)          \
+    _(GlobalScope,                      true,   false)          \
     \
-    _(PropertyTraps,                    false)                  \
+    _(PropertyTraps,                    false,  false)          \
     \
-    _(HashObject,                       true)                   \
-    _(HashObject_ValueProp,             true)                   \
-    _(HashObjectAccessorProperty,       true)                   \
-    _(Global,                           true)                   \
+    _(ShapedObject,                     true,   false)          \
+    _(HashObject,                       true,   false)          \
+    _(HashObject_ValueProp,             true,   false)          \
+    _(HashObjectAccessorProperty,       true,   false)          \
+    _(Global,                           true,   false)          \
     \
-    _(ConstantPool,                     true)                   \
+    _(ConstantPool,                     true,   false)          \
 
 
 // Listing of minimum
 #define WHISPER_DEFN_PROPMAP_TYPES(_)                           \
     /* Name */                                                  \
-    _(Object)                                                   \
-    _(Global)
+    _(ShapedObject)
 
 
 #endif // WHISPER__VM__HEAP_TYPE_DEFN_HPP
@@ -1,5 +1,7 @@
 
 #include <algorithm>
+#include <new>
+#include <string.h>
 
 #include "value_inlines.hpp"
 #include "rooting_inlines.hpp"
@@ -7,11 +9,36 @@
 #include "vm/heap_thing_inlines.hpp"
 #include "vm/string.hpp"
 #include "vm/object.hpp"
+#include "vm/shape_tree.hpp"
 
 namespace Whisper {
 namespace VM {
 
 
+//
+// ShapedObject
+//
+
+/*static*/ uint32_t
+ShapedObject::CalculateSize(uint32_t numFixedSlots)
+{
+    static_assert(sizeof(ShapedObject) % sizeof(Value) == 0,
+                  "Fixed slots of ShapedObject must be Value-aligned.");
+    return sizeof(ShapedObject) + (numFixedSlots * sizeof(Value));
+}
+
+ShapedObject::ShapedObject(Shape *shape)
+  : ShapedPropertyMapThing(shape)
+{
+    WH_ASSERT(objectSize() ==
+              CalculateSize(shape->tree()->numFixedSlots()));
+    initializeFixedSlots();
+}
+
+//
+// HashObject
+//
+
 HashObject::PropConfig::PropConfig()
   : configurable(false),
     enumerable(false),
@@ -42,7 +69,11 @@ HashObject::PropConfig::setWritable(bool w)
 
 
 HashObject::HashObject(Handle<Object *> prototype)
-  : prototype_(prototype),  mappings_(nullptr), entries_(0)
+  : prototype_(prototype),  mappings_(nullptr), entries_(0),
+    oldMappings_(nullptr), migrateEntry_(0),
+    elements_(nullptr), elementsLength_(0), elementsHoles_(0),
+    maxSparseIndex_(0), elementsKind_(ElementsKind::Int32),
+    packedKind_(ElementsKind::Int32)
 {}
 
 bool
@@ -86,6 +117,60 @@ HashObject::numProperties() const
     return entries_;
 }
 
+HashObject::ElementsKind
+HashObject::elementsKind() const
+{
+    return elementsKind_;
+}
+
+uint32_t
+HashObject::elementsLength() const
+{
+    return elementsLength_;
+}
+
+uint32_t
+HashObject::elementsCapacity() const
+{
+    if (!elements_)
+        return 0;
+
+    switch (elementsKind_) {
+      case ElementsKind::Int32:
+        return elements_->toRawElements()->int32Capacity();
+      case ElementsKind::Double:
+        return elements_->toRawElements()->doubleCapacity();
+      case ElementsKind::Generic:
+        return elements_->toTuple()->size();
+      case ElementsKind::Sparse:
+        return sparseCapacity();
+    }
+
+    WH_UNREACHABLE("Invalid elements kind.");
+    return 0;
+}
+
+const int32_t *
+HashObject::int32Elements() const
+{
+    WH_ASSERT(elementsKind_ == ElementsKind::Int32);
+    return elements_ ? elements_->toRawElements()->int32Data() : nullptr;
+}
+
+const double *
+HashObject::doubleElements() const
+{
+    WH_ASSERT(elementsKind_ == ElementsKind::Double);
+    return elements_ ? elements_->toRawElements()->doubleData() : nullptr;
+}
+
+const Tuple *
+HashObject::genericElements() const
+{
+    WH_ASSERT(elementsKind_ == ElementsKind::Generic);
+    return elements_ ? elements_->toTuple() : nullptr;
+}
+
 void
 HashObject::setPrototype(Handle<Object *> newProto)
 {
@@ -95,6 +180,112 @@ HashObject::setPrototype(Handle<Object *> newProto)
 bool
 HashObject::defineValueProperty(RunContext *cx, Handle<Value> keyString,
                                 Handle<Value> val)
+{
+    // Index keys are stored as elements.
+    Root<Value> key(cx);
+    if (ImmediateStringValue(keyString, key.get()) &&
+        key->isImmIndexString())
+    {
+        return setElement(cx, key->immIndexStringValue(), val);
+    }
+
+    return defineMappedProperty(cx, keyString, val);
+}
+
+bool
+HashObject::getElement(RunContext *cx, uint32_t idx, MutHandle<Value> result,
+                       bool *found)
+{
+    WH_ASSERT(idx <= INT32_MAX);
+
+    if (elementsKind_ == ElementsKind::Sparse) {
+        Tuple *entries = elements_->toTuple();
+        uint32_t entry = ProbeSparseEntries(entries, idx, sparseHash(cx, idx));
+        *found = !entries->get(entry * 2)->isUndefined();
+        if (*found)
+            result = entries->get(entry * 2 + 1);
+        return true;
+    }
+
+    *found = idx < elementsLength_ && !isElementHole(idx);
+    if (!*found)
+        return true;
+
+    return readElement(cx, idx, result);
+}
+
+bool
+HashObject::setElement(RunContext *cx, uint32_t idx, Handle<Value> val)
+{
+    WH_ASSERT(idx <= INT32_MAX);
+
+    if (elementsKind_ == ElementsKind::Sparse)
+        return setSparseElement(cx, idx, val);
+
+    if (idx < elementsLength_) {
+        if (ElementsKindFor(val) > elementsKind_) {
+            if (!transitionElements(cx, ElementsKindFor(val)))
+                return false;
+        }
+        if (isElementHole(idx))
+            elementsHoles_--;
+        writeElement(idx, val);
+        return true;
+    }
+
+    if (idx == elementsLength_)
+        return appendElement(cx, val);
+
+    // Small gaps are filled with holes, so long as at least half of the
+    // elements stay present.  Otherwise the holes would cost more than
+    // the elements, so go sparse.
+    uint32_t gap = idx - elementsLength_;
+    if (gap <= MAX_ELEMENTS_GAP &&
+        (idx < INITIAL_ELEMENTS || (elementsHoles_ + gap) * 2 <= idx + 1))
+    {
+        return fillElements(cx, idx, val);
+    }
+
+    uint32_t capacity = INITIAL_SPARSE_ENTRIES;
+    while (capacity < (elementsLength_ + 1) * 2)
+        capacity *= 2;
+    if (!makeElementsSparse(cx, capacity))
+        return false;
+
+    return setSparseElement(cx, idx, val);
+}
+
+bool
+HashObject::getElementIndexes(std::vector<uint32_t> &indexes) const
+{
+    try {
+        if (elementsKind_ != ElementsKind::Sparse) {
+            for (uint32_t i = 0; i < elementsLength_; i++) {
+                if (!isElementHole(i))
+                    indexes.push_back(i);
+            }
+            return true;
+        }
+
+        size_t start = indexes.size();
+        Tuple *entries = elements_->toTuple();
+        uint32_t capacity = sparseCapacity();
+        for (uint32_t i = 0; i < capacity; i++) {
+            Handle<Value> key = entries->get(i * 2);
+            if (key->isInt32())
+                indexes.push_back(key->int32Value());
+        }
+        std::sort(indexes.begin() + start, indexes.end());
+    } catch (std::bad_alloc &err) {
+        return false;
+    }
+
+    return true;
+}
+
+bool
+HashObject::defineMappedProperty(RunContext *cx, Handle<Value> keyString,
+                                 Handle<Value> val)
 {
     uint32_t entry = lookupOwnProperty(cx, keyString, /*forAdd=*/true);
     WH_ASSERT(entry != UINT32_MAX);
@@ -114,17 +305,10 @@ HashObject::defineValueProperty(RunContext *cx, Handle<Value> keyString,
               getEntryKey(entry)->isFalse());
 
     // Key needs to be interned before being used as a property name,
-    // but only if it's not an indexed string.
+    // but only if it's not an immediate string.
     Root<Value> keyval(cx);
-    int32_t id;
-    if (IsInt32IdString(keyString, &id)) {
-        keyval = Value::ImmIndexString(id);
-    } else {
-        Root<LinearString *> internedKey(cx);
-        if (!cx->stringTable().addString(keyString, &internedKey))
-            return false;
-        keyval = Value::HeapString(internedKey);
-    }
+    if (!NormalizeString(cx, keyString, &keyval))
+        return false;
 
     // Otherwise, number of entries is about to grow.  Check to see
     // if mapping should be enlarged.
@@ -135,7 +319,7 @@ HashObject::defineValueProperty(RunContext *cx, Handle<Value> keyString,
         entry = lookupOwnProperty(cx, keyString, /*forAdd=*/true);
         WH_ASSERT(entry != UINT32_MAX);
 
-        // All deleted entries will have been reset during the enlarge.
+        // The new mappings never contain deleted entries.
         WH_ASSERT(getEntryKey(entry)->isUndefined());
     }
 
@@ -148,6 +332,385 @@ HashObject::defineValueProperty(RunContext *cx, Handle<Value> keyString,
 
     setEntryKey(entry, keyval);
     setEntryValue(entry, Value::Object(valProp));
+    entries_++;
+    return true;
+}
+
+// The least general elements kind which can hold |val|.
+/*static*/ HashObject::ElementsKind
+HashObject::ElementsKindFor(const Value &val)
+{
+    if (val.isInt32())
+        return ElementsKind::Int32;
+
+    if (val.isNumber())
+        return ElementsKind::Double;
+
+    return ElementsKind::Generic;
+}
+
+/*static*/ bool
+HashObject::AllocateElements(RunContext *cx, ElementsKind kind,
+                             uint32_t capacity, HeapThing *&output)
+{
+    if (kind == ElementsKind::Generic) {
+        Tuple *tuple;
+        if (!cx->inHatchery().createTuple(capacity, tuple))
+            return false;
+
+        output = tuple;
+        return true;
+    }
+
+    uint32_t size = capacity * (kind == ElementsKind::Int32 ? sizeof(int32_t)
+                                                            : sizeof(double));
+    RawElements *raw = cx->inHatchery().createSized<RawElements>(size);
+    if (!raw)
+        return false;
+
+    output = raw;
+    return true;
+}
+
+bool
+HashObject::readElement(RunContext *cx, uint32_t idx, MutHandle<Value> result)
+{
+    WH_ASSERT(idx < elementsLength_);
+
+    switch (elementsKind_) {
+      case ElementsKind::Int32:
+        result = Value::Int32(elements_->toRawElements()->int32Data()[idx]);
+        return true;
+      case ElementsKind::Double:
+        return cx->inHatchery().createNumber(
+                    elements_->toRawElements()->doubleData()[idx],
+                    result.get());
+      case ElementsKind::Generic:
+        result = elements_->toTuple()->get(idx);
+        return true;
+      case ElementsKind::Sparse:
+        break;
+    }
+
+    WH_UNREACHABLE("Invalid elements kind.");
+    return false;
+}
+
+void
+HashObject::writeElement(uint32_t idx, const Value &val)
+{
+    WH_ASSERT(idx < elementsCapacity());
+    WH_ASSERT(ElementsKindFor(val) <= elementsKind_);
+
+    switch (elementsKind_) {
+      case ElementsKind::Int32:
+        elements_->toRawElements()->int32Data()[idx] = val.int32Value();
+        return;
+      case ElementsKind::Double:
+        elements_->toRawElements()->doubleData()[idx] = val.numberValue();
+        return;
+      case ElementsKind::Generic:
+        elements_->toTuple()->set(idx, val);
+        return;
+      case ElementsKind::Sparse:
+        break;
+    }
+
+    WH_UNREACHABLE("Invalid elements kind.");
+}
+
+// Holes in Generic elements are marked with the invalid value, which
+// no script value ever has.
+bool
+HashObject::isElementHole(uint32_t idx) const
+{
+    WH_ASSERT(idx < elementsLength_);
+
+    if (elementsKind_ != ElementsKind::Generic)
+        return false;
+
+    return elements_->toTuple()->get(idx) == Value();
+}
+
+bool
+HashObject::transitionElements(RunContext *cx, ElementsKind kind)
+{
+    WH_ASSERT(kind > elementsKind_);
+
+    uint32_t capacity = elementsCapacity();
+    if (capacity == 0) {
+        elementsKind_ = kind;
+        return true;
+    }
+
+    HeapThing *newElements;
+    if (!AllocateElements(cx, kind, capacity, newElements))
+        return false;
+
+    // Convert the existing elements.  Doubles may need to be boxed,
+    // so nothing is changed until all of them have been converted.
+    for (uint32_t i = 0; i < elementsLength_; i++) {
+        if (kind == ElementsKind::Double) {
+            WH_ASSERT(elementsKind_ == ElementsKind::Int32);
+            newElements->toRawElements()->doubleData()[i] =
+                elements_->toRawElements()->int32Data()[i];
+            continue;
+        }
+
+        Root<Value> val(cx);
+        if (!readElement(cx, i, &val))
+            return false;
+        newElements->toTuple()->set(i, val);
+    }
+
+    elements_.set(newElements, this);
+    elementsKind_ = kind;
+    return true;
+}
+
+// Grow the packed elements storage by doubling until it holds at least
+// |minCapacity| elements.
+bool
+HashObject::growElements(RunContext *cx, uint32_t minCapacity)
+{
+    uint32_t capacity = elementsCapacity();
+    if (minCapacity <= capacity)
+        return true;
+
+    uint32_t newCapacity = capacity ? capacity * 2 : INITIAL_ELEMENTS;
+    while (newCapacity < minCapacity)
+        newCapacity *= 2;
+
+    HeapThing *newElements;
+    if (!AllocateElements(cx, elementsKind_, newCapacity, newElements))
+        return false;
+
+    if (elementsKind_ == ElementsKind::Generic) {
+        for (uint32_t i = 0; i < elementsLength_; i++)
+            newElements->toTuple()->set(i, elements_->toTuple()->get(i));
+    } else if (elementsLength_ > 0) {
+        RawElements *from = elements_->toRawElements();
+        RawElements *to = newElements->toRawElements();
+        if (elementsKind_ == ElementsKind::Int32) {
+            memcpy(to->int32Data(), from->int32Data(),
+                   elementsLength_ * sizeof(int32_t));
+        } else {
+            memcpy(to->doubleData(), from->doubleData(),
+                   elementsLength_ * sizeof(double));
+        }
+    }
+
+    elements_.set(newElements, this);
+    return true;
+}
+
+bool
+HashObject::appendElement(RunContext *cx, const Value &val)
+{
+    if (ElementsKindFor(val) > elementsKind_) {
+        if (!transitionElements(cx, ElementsKindFor(val)))
+            return false;
+    }
+
+    if (!growElements(cx, elementsLength_ + 1))
+        return false;
+
+    writeElement(elementsLength_, val);
+    elementsLength_++;
+    return true;
+}
+
+// Store |val| at |idx|, past the elements length, leaving holes below
+// it.  Only Generic elements can hold holes.
+bool
+HashObject::fillElements(RunContext *cx, uint32_t idx, const Value &val)
+{
+    WH_ASSERT(idx > elementsLength_);
+
+    if (elementsKind_ != ElementsKind::Generic) {
+        if (!transitionElements(cx, ElementsKind::Generic))
+            return false;
+    }
+
+    if (!growElements(cx, idx + 1))
+        return false;
+
+    Tuple *elements = elements_->toTuple();
+    for (uint32_t i = elementsLength_; i < idx; i++)
+        elements->set(i, Value());
+    elements->set(idx, val);
+
+    elementsHoles_ += idx - elementsLength_;
+    elementsLength_ = idx + 1;
+    return true;
+}
+
+uint32_t
+HashObject::sparseCapacity() const
+{
+    WH_ASSERT(elementsKind_ == ElementsKind::Sparse);
+    return elements_->toTuple()->size() / 2;
+}
+
+// Indexes are mixed with the spoiler rather than just xored with it:
+// with linear probing, xoring leaves indexes which differ only in their
+// high bits on the same probe sequence, so a script could fill one run
+// of entries with stores to a[k * capacity].
+uint32_t
+HashObject::sparseHash(RunContext *cx, uint32_t idx) const
+{
+    return HashIndex(cx->threadContext()->spoiler(), idx);
+}
+
+// Find the entry for |idx|, or the empty entry where it would be added.
+/*static*/ uint32_t
+HashObject::ProbeSparseEntries(Tuple *entries, uint32_t idx, uint32_t hash)
+{
+    uint32_t capacity = entries->size() / 2;
+    WH_ASSERT(IsPowerOfTwo(capacity));
+
+    uint32_t mask = capacity - 1;
+    for (uint32_t i = 0; i < capacity; i++) {
+        uint32_t entry = (hash + i) & mask;
+        Handle<Value> key = entries->get(entry * 2);
+        if (key->isUndefined())
+            return entry;
+
+        WH_ASSERT(key->isInt32());
+        if (ToUInt32(key->int32Value()) == idx)
+            return entry;
+    }
+
+    WH_UNREACHABLE("Completely full sparse elements should not happen!");
+    return UINT32_MAX;
+}
+
+bool
+HashObject::setSparseElement(RunContext *cx, uint32_t idx, const Value &val)
+{
+    WH_ASSERT(elementsKind_ == ElementsKind::Sparse);
+
+    Tuple *entries = elements_->toTuple();
+    uint32_t entry = ProbeSparseEntries(entries, idx, sparseHash(cx, idx));
+    if (!entries->get(entry * 2)->isUndefined()) {
+        entries->set(entry * 2 + 1, val);
+        return true;
+    }
+
+    if (elementsLength_ >= sparseCapacity() * MAX_FILL_RATIO) {
+        if (!makeElementsSparse(cx, sparseCapacity() * 2))
+            return false;
+
+        entries = elements_->toTuple();
+        entry = ProbeSparseEntries(entries, idx, sparseHash(cx, idx));
+    }
+
+    entries->set(entry * 2, Value::Int32(idx));
+    entries->set(entry * 2 + 1, val);
+    elementsLength_++;
+    if (idx > maxSparseIndex_)
+        maxSparseIndex_ = idx;
+
+    // Go back to packed elements once every index up to the highest
+    // one is present.
+    if (elementsLength_ == maxSparseIndex_ + 1)
+        return makeElementsPacked(cx);
+
+    return true;
+}
+
+// Move the elements into a new sparse table with |capacity| entries.
+// Also used to enlarge the table of sparse elements.
+bool
+HashObject::makeElementsSparse(RunContext *cx, uint32_t capacity)
+{
+    WH_ASSERT(elementsLength_ < capacity * MAX_FILL_RATIO);
+
+    Root<Tuple *> entries(cx);
+    if (!cx->inHatchery().createTuple(capacity * 2, entries))
+        return false;
+
+    uint32_t maxIndex = 0;
+    if (elementsKind_ == ElementsKind::Sparse) {
+        Tuple *oldEntries = elements_->toTuple();
+        uint32_t oldCapacity = sparseCapacity();
+        for (uint32_t i = 0; i < oldCapacity; i++) {
+            Handle<Value> key = oldEntries->get(i * 2);
+            if (key->isUndefined())
+                continue;
+
+            uint32_t idx = key->int32Value();
+            uint32_t entry = ProbeSparseEntries(entries, idx,
+                                                sparseHash(cx, idx));
+            entries->set(entry * 2, key);
+            entries->set(entry * 2 + 1, oldEntries->get(i * 2 + 1));
+        }
+        maxIndex = maxSparseIndex_;
+    } else {
+        for (uint32_t idx = 0; idx < elementsLength_; idx++) {
+            if (isElementHole(idx))
+                continue;
+
+            Root<Value> val(cx);
+            if (!readElement(cx, idx, &val))
+                return false;
+
+            uint32_t entry = ProbeSparseEntries(entries, idx,
+                                                sparseHash(cx, idx));
+            entries->set(entry * 2, Value::Int32(idx));
+            entries->set(entry * 2 + 1, val);
+            maxIndex = idx;
+        }
+        elementsLength_ -= elementsHoles_;
+        elementsHoles_ = 0;
+        packedKind_ = elementsKind_;
+    }
+
+    elements_.set(entries, this);
+    elementsKind_ = ElementsKind::Sparse;
+    maxSparseIndex_ = maxIndex;
+    return true;
+}
+
+bool
+HashObject::makeElementsPacked(RunContext *cx)
+{
+    WH_ASSERT(elementsKind_ == ElementsKind::Sparse);
+    WH_ASSERT(elementsLength_ == maxSparseIndex_ + 1);
+
+    // Pick the least general kind which holds all the values.  Kinds
+    // only move towards Generic, so start from the kind the elements
+    // had before going sparse.
+    Tuple *entries = elements_->toTuple();
+    uint32_t capacity = sparseCapacity();
+    ElementsKind kind = packedKind_;
+    for (uint32_t i = 0; i < capacity; i++) {
+        if (entries->get(i * 2)->isUndefined())
+            continue;
+
+        ElementsKind valKind = ElementsKindFor(entries->get(i * 2 + 1));
+        if (valKind > kind)
+            kind = valKind;
+    }
+
+    uint32_t newCapacity = INITIAL_ELEMENTS;
+    while (newCapacity < elementsLength_)
+        newCapacity *= 2;
+
+    HeapThing *newElements;
+    if (!AllocateElements(cx, kind, newCapacity, newElements))
+        return false;
+
+    Root<Tuple *> oldEntries(cx, entries);
+    elements_.set(newElements, this);
+    elementsKind_ = kind;
+    maxSparseIndex_ = 0;
+
+    for (uint32_t i = 0; i < capacity; i++) {
+        Handle<Value> key = oldEntries->get(i * 2);
+        if (!key->isUndefined())
+            writeElement(key->int32Value(), oldEntries->get(i * 2 + 1));
+    }
     return true;
 }
 
@@ -157,26 +720,57 @@ HashObject::lookupOwnProperty(RunContext *cx, Handle<Value> keyString,
 {
     Root<Value> key(cx);
 
-    // Normalize key value.
-    int32_t id;
-    if (IsInt32IdString(keyString, &id)) {
-        key = Value::ImmIndexString(id);
-    } else {
+    // Normalize key value.  If the key is not an immediate and was
+    // never interned, then no entry can match it, but the probe must
+    // still find a slot for it if adding.
+    if (!ImmediateStringValue(keyString, key.get())) {
         LinearString *linstr = cx->stringTable().lookupString(keyString);
-        if (!linstr)
-            return false;
-        WH_ASSERT(linstr->isInterned());
-        key = Value::HeapString(linstr);
+        if (!linstr && !forAdd)
+            return UINT32_MAX;
+        WH_ASSERT_IF(linstr, linstr->isInterned());
+        key = linstr ? Value::HeapString(linstr) : keyString.get();
     }
 
-    uint32_t entryCount = propertyCapacity();
-    uint32_t addEntry = UINT32_MAX;
-    uint32_t hash = hashValue(cx, keyString);
+    uint32_t hash = hashValue(cx, key);
+
+    if (isMigrating())
+        migrateEntries(cx, MIGRATE_ENTRIES);
 
     WH_ASSERT(mappings_);
+    uint32_t entry = ProbeEntries(mappings_, ENTRY_SIZE, key, hash, forAdd);
+    if (!isMigrating() || getEntryKey(entry)->isString())
+        return entry;
+
+    // Keys which have not been migrated yet are in the old mappings.
+    // Move such a key across now, so that the returned entry is
+    // always in the current mappings.
+    uint32_t oldEntry = ProbeEntries(oldMappings_, ENTRY_SIZE, key, hash,
+                                     false);
+    if (!oldMappings_->get(KeySlotOffset(oldEntry))->isString())
+        return entry;
+
+    if (!forAdd)
+        entry = ProbeEntries(mappings_, ENTRY_SIZE, key, hash,
+                             /*forAdd=*/true);
+
+    setEntryKey(entry, key);
+    setEntryValue(entry, oldMappings_->get(ValueSlotOffset(oldEntry)));
+    oldMappings_->set(KeySlotOffset(oldEntry), Value::False());
+    oldMappings_->set(ValueSlotOffset(oldEntry), Value::Undefined());
+    return entry;
+}
+
+/*static*/ uint32_t
+HashObject::ProbeEntries(Tuple *table, uint32_t entrySize, const Value &key,
+                         uint32_t hash, bool forAdd)
+{
+    WH_ASSERT(table->size() % entrySize == 0);
+    uint32_t entryCount = table->size() / entrySize;
+    uint32_t addEntry = UINT32_MAX;
+
     for (uint32_t i = 0; i < entryCount; i++) {
         uint32_t entry = (hash + i) % entryCount;
-        Handle<Value> entryKey = getEntryKey(entry);
+        Handle<Value> entryKey = table->get(entry * entrySize);
 
         if (entryKey->isUndefined()) {
             if (forAdd && addEntry < UINT32_MAX)
@@ -187,7 +781,7 @@ HashObject::lookupOwnProperty(RunContext *cx, Handle<Value> keyString,
         if (entryKey == key)
             return entry;
 
-        WH_ASSERT(entryKey->isFalse() || entryKey->isImmIndexString() ||
+        WH_ASSERT(entryKey->isFalse() || entryKey->isImmString() ||
                   (entryKey->isHeapString() &&
                    entryKey->heapStringPtr()->isLinearString() &&
                    entryKey->heapStringPtr()->toLinearString()->isInterned()));
@@ -196,23 +790,23 @@ HashObject::lookupOwnProperty(RunContext *cx, Handle<Value> keyString,
             addEntry = entry;
     }
 
-    WH_UNREACHABLE("Completely full HashObject table should not ever happen!");
+    // A table full of deleted entries can still be added to.
+    if (forAdd && addEntry < UINT32_MAX)
+        return addEntry;
+
+    WH_UNREACHABLE("Completely full table should not ever happen!");
     return UINT32_MAX;
 }
 
 uint32_t
 HashObject::hashValue(RunContext *cx, const Value &key) const
 {
-    WH_ASSERT(key.isImmIndexString() ||
-              (key.isHeapString() && key.heapStringPtr()->isLinearString() &&
-               key.heapStringPtr()->toLinearString()->isInterned()));
+    WH_ASSERT(key.isString());
 
-    if (key.isImmIndexString()) {
-        int32_t idx = key.immIndexStringValue();
-        return idx ^ cx->threadContext()->spoiler();
-    }
+    // Index keys are stored as elements, never in the mappings.
+    WH_ASSERT(!key.isImmIndexString());
 
-    return FNVHashString(cx->threadContext()->spoiler(), key.heapStringPtr());
+    return HashString(cx->threadContext()->spoiler(), key);
 }
 
 /*static*/ uint32_t
@@ -255,35 +849,73 @@ HashObject::setEntryValue(uint32_t entry, const Value &val)
 bool
 HashObject::enlarge(RunContext *cx)
 {
-    Root<Tuple *> oldMappings(cx, mappings_);
+    // Only one old mapping is kept around, so finish any earlier
+    // migration first.
+    finishMigration(cx);
+
     uint32_t curSize = propertyCapacity();
-    
-    // Allocate a new mapping with double capacity.
+
+    // Allocate a new mapping with double capacity.  Entries are moved
+    // into it incrementally by later lookups.
     Root<Tuple *> newMappings(cx);
     if (!cx->inHatchery().createTuple(curSize * 2 * 2, newMappings))
         return false;
+
+    oldMappings_.set(mappings_, this);
     mappings_.set(newMappings, this);
+    migrateEntry_ = 0;
+
+    return true;
+}
 
-    // Add old entries to table.
-    for (uint32_t i = 0; i < curSize; i++) {
-        Handle<Value> oldKey = oldMappings->get(KeySlotOffset(i));
-        Handle<Value> oldVal = oldMappings->get(ValueSlotOffset(i));
+bool
+HashObject::isMigrating() const
+{
+    return oldMappings_ != nullptr;
+}
 
+void
+HashObject::migrateEntries(RunContext *cx, uint32_t count)
+{
+    WH_ASSERT(isMigrating());
+
+    uint32_t oldSize = oldMappings_->size() / 2;
+    uint32_t endEntry = migrateEntry_ +
+                        std::min(count, oldSize - migrateEntry_);
+
+    // Keys are unique, so migrated entries are placed without checking
+    // for an existing key.  The old entry is marked deleted so that
+    // probes of the old mappings skip past it.
+    for (; migrateEntry_ < endEntry; migrateEntry_++) {
+        Handle<Value> oldKey = oldMappings_->get(
+                                    KeySlotOffset(migrateEntry_));
         WH_ASSERT(oldKey->isUndefined() || oldKey->isFalse() ||
                   oldKey->isString());
         if (!oldKey->isString())
             continue;
 
-        uint32_t entry = lookupOwnProperty(cx, oldKey, /*forAdd=*/true);
-        WH_ASSERT(entry != UINT32_MAX);
-
-        WH_ASSERT(getEntryKey(entry)->isUndefined());
+        uint32_t entry = ProbeEntries(mappings_, ENTRY_SIZE, oldKey,
+                                      hashValue(cx, oldKey), /*forAdd=*/true);
+        WH_ASSERT(!getEntryKey(entry)->isString());
 
         setEntryKey(entry, oldKey);
-        setEntryValue(entry, oldVal);
+        setEntryValue(entry, oldMappings_->get(
+                                ValueSlotOffset(migrateEntry_)));
+        oldMappings_->set(KeySlotOffset(migrateEntry_), Value::False());
+        oldMappings_->set(ValueSlotOffset(migrateEntry_), Value::Undefined());
     }
 
-    return true;
+    if (migrateEntry_ == oldSize) {
+        oldMappings_.set(nullptr, this);
+        migrateEntry_ = 0;
+    }
+}
+
+void
+HashObject::finishMigration(RunContext *cx)
+{
+    if (isMigrating())
+        migrateEntries(cx, oldMappings_->size() / 2);
 }
 
 
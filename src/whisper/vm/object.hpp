@@ -6,6 +6,10 @@
 #include "value.hpp"
 #include "rooting.hpp"
 #include "tuple.hpp"
+#include "vm/raw_elements.hpp"
+#include "vm/property_map_thing.hpp"
+
+#include <vector>
 
 namespace Whisper {
 namespace VM {
@@ -27,10 +31,60 @@ class Object : public HeapThing
 };
 
 
+//
+// A ShapedObject is a plain native object whose property mappings are
+// described by its shape, with the values stored in its fixed slots
+// and dynamic slots.  The fixed slots follow the object's fields, and
+// their number is fixed by the shape tree.
+//
+class ShapedObject : public ShapedPropertyMapThing,
+                     public TypedHeapThing<HeapType::ShapedObject>
+{
+  public:
+    static uint32_t CalculateSize(uint32_t numFixedSlots);
+
+    ShapedObject(Shape *shape);
+};
+
+template <>
+struct PropertyMapTypeTraits<HeapType::ShapedObject>
+{
+    static constexpr bool IsShaped = true;
+    static constexpr uint32_t BaseSize = sizeof(ShapedObject);
+};
+
+
 //
 // A HashObject is a simple native object format which stores its property
 // mappings as a hash table.
 //
+// When the table is enlarged, the old mappings are kept alongside the
+// new ones, and each lookup moves a few entries across until the old
+// mappings are empty.
+//
+// Properties with index keys are stored separately, as elements.
+// Elements are normally a packed array: elements below the elements
+// length are all present, and the storage is grown by doubling as
+// elements are appended.
+//
+// The elements kind says how the elements are stored.  Objects start
+// out with Int32 elements, stored as raw int32_t values in a
+// RawElements.  Storing any other number moves them to Double
+// elements, stored as raw doubles, and storing any other value moves
+// them to Generic elements, stored as values in a Tuple.  Kinds only
+// ever move towards Generic.
+//
+// An index write past the elements length leaves a hole below it.
+// Small holes are kept in packed Generic elements, marked with the
+// invalid value, so long as at least half of the elements below the
+// length are present.  Any other write which would leave a hole
+// switches the elements to the Sparse kind, a hash table of (index,
+// value) entries in a Tuple, so that a write to a large index never
+// allocates storage for the indexes below it.  If the entries come to
+// fill every index from zero up, the elements are packed again.  They
+// get the least general kind which holds their values, but never a
+// less general kind than they had before going sparse.
+//
 class HashObject : public HeapThing,
                    public TypedHeapThing<HeapType::HashObject>
 {
@@ -47,14 +101,47 @@ class HashObject : public HeapThing,
         PropConfig &setWritable(bool w);
     };
 
+    enum class ElementsKind : uint8_t
+    {
+        Int32,
+        Double,
+        Generic,
+        Sparse
+    };
+
   private:
     Heap<Object *> prototype_;
     Heap<Tuple *> mappings_;
     uint32_t entries_;
 
+    // Mappings being migrated from, if any.  Entries of the old
+    // mappings below migrateEntry_ have been moved into mappings_.
+    Heap<Tuple *> oldMappings_;
+    uint32_t migrateEntry_;
+
+    // Elements storage, a RawElements or a Tuple depending on the
+    // elements kind.  For packed elements, elementsHoles_ is the number
+    // of holes below elementsLength_.  For Sparse elements,
+    // elementsLength_ is the number of entries, maxSparseIndex_ the
+    // highest index, and packedKind_ the kind the elements had before
+    // they went sparse.
+    Heap<HeapThing *> elements_;
+    uint32_t elementsLength_;
+    uint32_t elementsHoles_;
+    uint32_t maxSparseIndex_;
+    ElementsKind elementsKind_;
+    ElementsKind packedKind_;
+
+    static constexpr uint32_t ENTRY_SIZE = 2;
     static constexpr uint32_t INITIAL_ENTRIES = 4;
+    static constexpr uint32_t INITIAL_ELEMENTS = 8;
+    static constexpr uint32_t INITIAL_SPARSE_ENTRIES = 8;
+    static constexpr uint32_t MAX_ELEMENTS_GAP = 16;
     static constexpr float MAX_FILL_RATIO = 0.75;
 
+    // Number of old entries migrated on each lookup during an enlarge.
+    static constexpr uint32_t MIGRATE_ENTRIES = 8;
+
   public:
     HashObject(Handle<Object *> prototype);
     bool initialize(RunContext *cx);
@@ -65,16 +152,72 @@ class HashObject : public HeapThing,
     uint32_t propertyCapacity() const;
     uint32_t numProperties() const;
 
+    ElementsKind elementsKind() const;
+    uint32_t elementsLength() const;
+    uint32_t elementsCapacity() const;
+
+    // Direct access to the elements storage, for bulk operations.
+    // Only the first elementsLength() entries are meaningful, and
+    // Generic elements may contain holes.
+    const int32_t *int32Elements() const;
+    const double *doubleElements() const;
+    const Tuple *genericElements() const;
+
     void setPrototype(Handle<Object *> newProto);
 
     bool defineValueProperty(RunContext *cx,
                              Handle<Value> key,
                              Handle<Value> val);
 
+    // Get the value of the element at |idx|.  Sets |found| to false if
+    // there is no such element.  Returns false only on allocation
+    // failure.
+    bool getElement(RunContext *cx, uint32_t idx, MutHandle<Value> result,
+                    bool *found);
+
+    // Set the element at |idx|, adding it if needed.  Returns false
+    // only on allocation failure.
+    bool setElement(RunContext *cx, uint32_t idx, Handle<Value> val);
+
+    // Get the indexes of all elements, in ascending order.  Returns
+    // false only on allocation failure.
+    bool getElementIndexes(std::vector<uint32_t> &indexes) const;
+
+    // Find the entry for |key| in an open-addressed table of entries
+    // |entrySize| values wide, keyed by their first value, or the empty
+    // entry where it would be added.  Empty entries have undefined keys
+    // and deleted entries false keys.  When adding, a deleted entry seen
+    // along the way is returned instead.  Also used for the dictionaries
+    // of dictionary mode ShapedPropertyMapThings.
+    static uint32_t ProbeEntries(Tuple *table, uint32_t entrySize,
+                                 const Value &key, uint32_t hash,
+                                 bool forAdd);
+
   private:
+    bool defineMappedProperty(RunContext *cx, Handle<Value> keyString,
+                              Handle<Value> val);
+
+    static ElementsKind ElementsKindFor(const Value &val);
+    static bool AllocateElements(RunContext *cx, ElementsKind kind,
+                                 uint32_t capacity, HeapThing *&output);
+    bool readElement(RunContext *cx, uint32_t idx, MutHandle<Value> result);
+    void writeElement(uint32_t idx, const Value &val);
+    bool isElementHole(uint32_t idx) const;
+    bool transitionElements(RunContext *cx, ElementsKind kind);
+    bool growElements(RunContext *cx, uint32_t minCapacity);
+    bool appendElement(RunContext *cx, const Value &val);
+    bool fillElements(RunContext *cx, uint32_t idx, const Value &val);
+
+    uint32_t sparseCapacity() const;
+    uint32_t sparseHash(RunContext *cx, uint32_t idx) const;
+    static uint32_t ProbeSparseEntries(Tuple *entries, uint32_t idx,
+                                       uint32_t hash);
+    bool setSparseElement(RunContext *cx, uint32_t idx, const Value &val);
+    bool makeElementsSparse(RunContext *cx, uint32_t capacity);
+    bool makeElementsPacked(RunContext *cx);
+
     uint32_t lookupOwnProperty(RunContext *cx, Handle<Value> keyString,
                                bool forAdd=false);
-
     uint32_t hashValue(RunContext *cx, const Value &key) const;
 
     static uint32_t KeySlotOffset(uint32_t entry);
@@ -86,6 +229,10 @@ class HashObject : public HeapThing,
     void setEntryValue(uint32_t entry, const Value &val);
 
     bool enlarge(RunContext *cx);
+
+    bool isMigrating() const;
+    void migrateEntries(RunContext *cx, uint32_t count);
+    void finishMigration(RunContext *cx);
 };
 
 
@@ -1,138 +1,698 @@
 
 #include "value_inlines.hpp"
+#include "rooting_inlines.hpp"
+#include "runtime_inlines.hpp"
 #include "vm/heap_thing_inlines.hpp"
 #include "vm/property_map_thing.hpp"
 #include "vm/object.hpp"
-#include "vm/global.hpp"
-
-#include <algorithm>
+#include "vm/vm_helpers.hpp"
 
 namespace Whisper {
 namespace VM {
 
 
-/*static*/ uint32_t
-PropertyMapThing::NumInternalSlots(HeapType ht)
-{
-    switch (ht) {
-#define CASE_(type) \
-      case HeapType::type: \
-        return PropertyMapTypeTraits<HeapType::type>::NumInternalSlots;
-    WHISPER_DEFN_PROPMAP_TYPES(CASE_)
-#undef CASE_
-      default:
-        WH_UNREACHABLE("Invalid PropertyMapThing HeapType.");
-        return INT32_MAX;
-    }
-}
+//
+// ShapedPropertyMapThing
+//
 
-PropertyMapThing::PropertyMapThing(Shape *shape)
-  : ShapedHeapThing(shape)
+ShapedPropertyMapThing::ShapedPropertyMapThing(Shape *shape)
+  : ShapedHeapThing(shape),
+    dynamicSlots_(nullptr),
+    dictionaryEntries_(0),
+    dictionaryUsed_(0)
 {}
 
+void
+ShapedPropertyMapThing::initializeFixedSlots()
+{
+    Heap<Value> *slots = fixedSlots();
+    uint32_t count = numFixedSlots();
+    for (uint32_t i = 0; i < count; i++)
+        slots[i].set(Value::Undefined(), this);
+}
+
 bool
-PropertyMapThing::isExtensible() const
+ShapedPropertyMapThing::isExtensible() const
 {
-    return !(flags() & PreventExtensionsFlag);
+    return !(flags() & PropertyMapThing::PreventExtensionsFlag);
 }
 
 void
-PropertyMapThing::preventExtensions()
+ShapedPropertyMapThing::preventExtensions()
 {
     WH_ASSERT(isExtensible());
-    addFlags(PreventExtensionsFlag);
+    addFlags(PropertyMapThing::PreventExtensionsFlag);
 }
 
-uint32_t
-PropertyMapThing::numImplicitSlots() const
+bool
+ShapedPropertyMapThing::inDictionaryMode() const
 {
-    return BaseImplicitSlots + NumInternalSlots(type());
+    return flags() & PropertyMapThing::DictionaryModeFlag;
 }
 
 bool
-PropertyMapThing::hasDynamicSlots() const
+ShapedPropertyMapThing::hasDynamicSlots() const
 {
-    return dynamicSlots_.hasHeapThing();
+    return dynamicSlots_;
 }
 
-Tuple *
-PropertyMapThing::maybeDynamicSlots() const
+Handle<Tuple *>
+ShapedPropertyMapThing::maybeDynamicSlots() const
 {
     return dynamicSlots_;
 }
 
-Tuple *
-PropertyMapThing::dynamicSlots() const
+Handle<Tuple *>
+ShapedPropertyMapThing::dynamicSlots() const
 {
     WH_ASSERT(hasDynamicSlots());
     return dynamicSlots_;
 }
 
 uint32_t
-PropertyMapThing::numFixedSlots() const
+ShapedPropertyMapThing::numFixedSlots() const
 {
-    return objectValueCount() - numImplicitSlots();
+    return shape_->tree()->numFixedSlots();
 }
 
 uint32_t
-PropertyMapThing::numDynamicSlots() const
+ShapedPropertyMapThing::numDynamicSlots() const
 {
-    // This needs to search the shape lineage for the highest
-    // numbered writable dynamic value slot.
-    Shape *shape = shape_;
-    WH_ASSERT(shape);
+    return hasDynamicSlots() ? dynamicSlots_->size() : 0;
+}
+
+uint32_t
+ShapedPropertyMapThing::numSlots() const
+{
+    return numFixedSlots() + numDynamicSlots();
+}
+
+Handle<Value>
+ShapedPropertyMapThing::fixedSlotValue(uint32_t idx) const
+{
+    WH_ASSERT(idx < numFixedSlots());
+    return fixedSlots()[idx];
+}
+
+Handle<Value>
+ShapedPropertyMapThing::dynamicSlotValue(uint32_t idx) const
+{
+    WH_ASSERT(idx < numDynamicSlots());
+    return dynamicSlots_->get(idx);
+}
+
+Handle<Value>
+ShapedPropertyMapThing::slotValue(uint32_t idx) const
+{
+    WH_ASSERT(idx < numSlots());
+    uint32_t fixed = numFixedSlots();
+    if (idx < fixed)
+        return fixedSlotValue(idx);
+
+    return dynamicSlotValue(idx - fixed);
+}
+
+void
+ShapedPropertyMapThing::setFixedSlotValue(uint32_t idx, const Value &val)
+{
+    WH_ASSERT(idx < numFixedSlots());
+    fixedSlots()[idx].set(val, this);
+}
+
+void
+ShapedPropertyMapThing::setDynamicSlotValue(uint32_t idx, const Value &val)
+{
+    WH_ASSERT(idx < numDynamicSlots());
+    dynamicSlots_->set(idx, val);
+}
+
+void
+ShapedPropertyMapThing::setSlotValue(uint32_t idx, const Value &val)
+{
+    WH_ASSERT(idx < numSlots());
+    uint32_t fixed = numFixedSlots();
+    if (idx < fixed)
+        setFixedSlotValue(idx, val);
+    else
+        setDynamicSlotValue(idx - fixed, val);
+}
+
+bool
+ShapedPropertyMapThing::lookupProperty(RunContext *cx, const Value &name,
+                                       Shape **result)
+{
+    WH_ASSERT(IsNormalizedPropertyId(name));
+    WH_ASSERT(!inDictionaryMode());
+    return shape_->lookupProperty(cx, name, result);
+}
+
+bool
+ShapedPropertyMapThing::getProperty(RunContext *cx, Handle<Value> name,
+                                    MutHandle<Value> result)
+{
+    if (inDictionaryMode()) {
+        Tuple *dict = dynamicSlots_;
+        uint32_t entry = lookupDictionaryEntry(cx, name);
+        if (entry == UINT32_MAX) {
+            result = Value::Undefined();
+            return true;
+        }
+
+        uint32_t attributes =
+            dict->get(entry * DictionaryEntrySize + 2)->int32Value();
+        if (!(attributes & Shape::HasValue)) {
+            WH_UNREACHABLE("Accessor properties not handled yet.");
+            return false;
+        }
+
+        result = dict->get(entry * DictionaryEntrySize + 1);
+        return true;
+    }
+
+    Shape *shape;
+    if (!lookupProperty(cx, name, &shape))
+        return false;
+
+    // Shaped objects don't have prototypes yet, so missing properties
+    // are just undefined.
+    if (!shape) {
+        result = Value::Undefined();
+        return true;
+    }
+
+    if (!shape->hasValue()) {
+        WH_UNREACHABLE("Accessor properties not handled yet.");
+        return false;
+    }
+
+    if (shape->isWritable())
+        result = slotValue(shape->toValueShape()->slotIndex());
+    else
+        result = shape->toConstantShape()->constant();
+    return true;
+}
+
+bool
+ShapedPropertyMapThing::setProperty(RunContext *cx, Handle<Value> name,
+                                    Handle<Value> val)
+{
+    if (inDictionaryMode()) {
+        Tuple *dict = dynamicSlots_;
+        uint32_t entry = lookupDictionaryEntry(cx, name);
+        if (entry == UINT32_MAX) {
+            if (!isExtensible())
+                return true;
+
+            return defineValueProperty(cx, name, val);
+        }
+
+        uint32_t attributes =
+            dict->get(entry * DictionaryEntrySize + 2)->int32Value();
+        if (!(attributes & Shape::HasValue)) {
+            WH_UNREACHABLE("Accessor properties not handled yet.");
+            return false;
+        }
+
+        if (attributes & Shape::IsWritable)
+            dict->set(entry * DictionaryEntrySize + 1, val);
+        return true;
+    }
+
+    Shape *shape;
+    if (!lookupProperty(cx, name, &shape))
+        return false;
+
+    if (!shape) {
+        // Adding to a non-extensible object is silently ignored.
+        if (!isExtensible())
+            return true;
+
+        return defineValueProperty(cx, name, val);
+    }
+
+    if (!shape->hasValue()) {
+        WH_UNREACHABLE("Accessor properties not handled yet.");
+        return false;
+    }
+
+    // Writes to constant properties are silently ignored.
+    if (!shape->isWritable())
+        return true;
+
+    setSlotValue(shape->toValueShape()->slotIndex(), val);
+    return true;
+}
+
+bool
+ShapedPropertyMapThing::defineValueProperty(RunContext *cx,
+                                            Handle<Value> name,
+                                            Handle<Value> val)
+{
+    WH_ASSERT(IsNormalizedPropertyId(name));
+    WH_ASSERT(isExtensible());
+
+    Shape::Config config = Shape::Config().setHasValue(true)
+                                          .setIsConfigurable(true)
+                                          .setIsEnumerable(true)
+                                          .setIsWritable(true);
+
+    // Objects which would grow past DictionaryModeMinProperties
+    // properties stop extending the shape tree.  The depth of a shape
+    // counts the root shape, which holds no property.
+    uint32_t numProperties = shape_->depth() - 1;
+    if (!inDictionaryMode() && numProperties >= DictionaryModeMinProperties) {
+        if (!enterDictionaryMode(cx))
+            return false;
+    }
+
+    if (inDictionaryMode()) {
+        return addDictionaryEntry(cx, name, val,
+                                  Shape::HasValue | Shape::IsConfigurable |
+                                  Shape::IsEnumerable | Shape::IsWritable);
+    }
+
+    // Reuse an existing transition if there is one.
+    Shape *parent = shape_;
+    Shape *child = parent->lookupChild(cx, name, config);
+    if (!child) {
+        child = cx->inHatchery().create<ValueShape>(
+                    parent->tree(), parent, name.get(), NextSlotIndex(parent),
+                    true, true);
+        if (!child)
+            return false;
+
+        if (!parent->addChild(cx, child))
+            return false;
+    }
+
+    ValueShape *valueShape = child->toValueShape();
+    if (valueShape->isDynamicSlot()) {
+        if (!ensureDynamicSlots(cx, valueShape->dynamicSlotIndex() + 1))
+            return false;
+    }
+
+    setShape(child);
+    setSlotValue(valueShape->slotIndex(), val);
+    return true;
+}
+
+bool
+ShapedPropertyMapThing::deleteProperty(RunContext *cx, Handle<Value> name,
+                                       bool *deleted)
+{
+    WH_ASSERT(IsNormalizedPropertyId(name));
+
+    // Deleting a property from a shaped object would need a new
+    // lineage without it, so the object is converted to a dictionary
+    // instead.
+    if (!inDictionaryMode()) {
+        Shape *shape;
+        if (!lookupProperty(cx, name, &shape))
+            return false;
+
+        if (!shape) {
+            *deleted = true;
+            return true;
+        }
+
+        if (!shape->isConfigurable()) {
+            *deleted = false;
+            return true;
+        }
+
+        if (!enterDictionaryMode(cx))
+            return false;
+    }
+
+    uint32_t entry = lookupDictionaryEntry(cx, name);
+    if (entry == UINT32_MAX) {
+        *deleted = true;
+        return true;
+    }
+
+    Tuple *dict = dynamicSlots_;
+    uint32_t offset = entry * DictionaryEntrySize;
+
+    if (!(dict->get(offset + 2)->int32Value() & Shape::IsConfigurable)) {
+        *deleted = false;
+        return true;
+    }
 
-    uint32_t maxSlotIndex = 0;
-    bool found = false;
-    do {
-        if (!shape->hasValue() || !shape->isWritable())
+    dict->set(offset, Value::False());
+    dict->set(offset + 1, Value::Undefined());
+    dict->set(offset + 2, Value::Undefined());
+    dictionaryEntries_--;
+    *deleted = true;
+    return true;
+}
+
+bool
+ShapedPropertyMapThing::enterDictionaryMode(RunContext *cx)
+{
+    WH_ASSERT(!inDictionaryMode());
+
+    uint32_t capacity = InitialDictionaryEntries;
+    while (capacity < shape_->depth() * 2)
+        capacity *= 2;
+
+    Root<Tuple *> dict(cx);
+    if (!cx->inHatchery().createTuple(capacity * DictionaryEntrySize, dict))
+        return false;
+
+    // Walk the lineage from the current shape, so that only the nearest
+    // definition of a name is added.
+    uint32_t entries = 0;
+    Shape *root = shape_;
+    for (Shape *shape = shape_; shape; shape = shape->maybeParent()) {
+        root = shape;
+        if (shape->name()->isUndefined())
             continue;
 
-        ValueShape *valueShape = shape->toValueShape();
-        if (!valueShape->isDynamicSlot())
+        uint32_t entry = ProbeDictionary(cx, dict, shape->name(), false);
+        if (!dict->get(entry * DictionaryEntrySize)->isUndefined())
             continue;
 
-        found = true;
-        maxSlotIndex = std::max(maxSlotIndex, valueShape->slotIndex());
+        if (!shape->hasValue()) {
+            WH_UNREACHABLE("Accessor properties not handled yet.");
+            return false;
+        }
+
+        Value val = shape->isWritable()
+                  ? slotValue(shape->toValueShape()->slotIndex()).get()
+                  : shape->toConstantShape()->constant().get();
+        SetDictionaryEntry(dict, entry, shape->name(), val,
+                           shape->attributes());
+        entries++;
+    }
+
+    uint32_t fixed = numFixedSlots();
+    for (uint32_t i = 0; i < fixed; i++)
+        setFixedSlotValue(i, Value::Undefined());
+
+    addFlags(PropertyMapThing::DictionaryModeFlag);
+    setShape(root);
+    dynamicSlots_.set(dict, this);
+    dictionaryEntries_ = entries;
+    dictionaryUsed_ = entries;
+    return true;
+}
+
+bool
+ShapedPropertyMapThing::leaveDictionaryMode(RunContext *cx)
+{
+    WH_ASSERT(inDictionaryMode());
+
+    if (dictionaryEntries_ > DictionaryModeMinProperties / 2)
+        return true;
+
+    Shape::Config config = Shape::Config().setHasValue(true)
+                                          .setIsConfigurable(true)
+                                          .setIsEnumerable(true)
+                                          .setIsWritable(true);
+    uint32_t attributes = Shape::HasValue | Shape::IsConfigurable |
+                          Shape::IsEnumerable | Shape::IsWritable;
+
+    Root<Tuple *> dict(cx, dynamicSlots_);
+    uint32_t capacity = dictionaryCapacity();
+    for (uint32_t i = 0; i < capacity; i++) {
+        uint32_t offset = i * DictionaryEntrySize;
+        if (!dict->get(offset)->isString())
+            continue;
+        if (ToUInt32(dict->get(offset + 2)->int32Value()) != attributes)
+            return true;
+    }
+
+    // Build the lineage for the properties, in dictionary order, before
+    // changing anything, so that a failed allocation leaves the object
+    // as it was.
+    Shape *shape = shape_;
+    uint32_t numSlots = 0;
+    for (uint32_t i = 0; i < capacity; i++) {
+        Handle<Value> name = dict->get(i * DictionaryEntrySize);
+        if (!name->isString())
+            continue;
+
+        Shape *child = shape->lookupChild(cx, name, config);
+        if (!child) {
+            child = cx->inHatchery().create<ValueShape>(
+                        shape->tree(), shape, name.get(), numSlots,
+                        true, true);
+            if (!child)
+                return false;
+
+            if (!shape->addChild(cx, child))
+                return false;
+        }
+        WH_ASSERT(child->toValueShape()->slotIndex() == numSlots);
+
+        shape = child;
+        numSlots++;
+    }
+
+    Root<Tuple *> newSlots(cx);
+    uint32_t fixed = numFixedSlots();
+    if (numSlots > fixed) {
+        uint32_t size = numSlots - fixed;
+        if (size < InitialDynamicSlots)
+            size = InitialDynamicSlots;
+        if (!cx->inHatchery().createTuple(size, newSlots))
+            return false;
+    }
+
+    removeFlags(PropertyMapThing::DictionaryModeFlag);
+    setShape(shape);
+    dynamicSlots_.set(newSlots, this);
+    dictionaryEntries_ = 0;
+    dictionaryUsed_ = 0;
 
-        shape = shape->maybeParent();
+    uint32_t slot = 0;
+    for (uint32_t i = 0; i < capacity; i++) {
+        uint32_t offset = i * DictionaryEntrySize;
+        if (dict->get(offset)->isString())
+            setSlotValue(slot++, dict->get(offset + 1));
+    }
+    return true;
+}
 
-    } while (shape);
+const Heap<Value> *
+ShapedPropertyMapThing::fixedSlots() const
+{
+    const uint8_t *base = reinterpret_cast<const uint8_t *>(this);
+    return reinterpret_cast<const Heap<Value> *>(
+                base + PropertyMapThing::BaseSize(type()));
+}
 
-    if (!found)
-        return 0;
+Heap<Value> *
+ShapedPropertyMapThing::fixedSlots()
+{
+    uint8_t *base = reinterpret_cast<uint8_t *>(this);
+    return reinterpret_cast<Heap<Value> *>(
+                base + PropertyMapThing::BaseSize(type()));
+}
 
-    return maxSlotIndex + 1;
+// The slot for a new property follows the highest slot used in the
+// lineage, which is held by the nearest value shape.
+/*static*/ uint32_t
+ShapedPropertyMapThing::NextSlotIndex(Shape *shape)
+{
+    for (; shape; shape = shape->maybeParent()) {
+        if (shape->hasValue() && shape->isWritable())
+            return shape->toValueShape()->slotIndex() + 1;
+    }
+    return 0;
+}
+
+bool
+ShapedPropertyMapThing::ensureDynamicSlots(RunContext *cx, uint32_t count)
+{
+    uint32_t curSize = numDynamicSlots();
+    if (count <= curSize)
+        return true;
+
+    uint32_t newSize = curSize ? curSize * 2 : InitialDynamicSlots;
+    if (newSize < count)
+        newSize = count;
+
+    Tuple *newSlots;
+    if (!cx->inHatchery().createTuple(newSize, newSlots))
+        return false;
+
+    for (uint32_t i = 0; i < curSize; i++)
+        newSlots->set(i, dynamicSlots_->get(i));
+
+    dynamicSlots_.set(newSlots, this);
+    return true;
 }
 
 uint32_t
-PropertyMapThing::numSlots() const
+ShapedPropertyMapThing::dictionaryCapacity() const
 {
-    return numFixedSlots() + numDynamicSlots();
+    WH_ASSERT(inDictionaryMode());
+    return dynamicSlots_->size() / DictionaryEntrySize;
 }
 
-const Value &
-PropertyMapThing::fixedSlotValue(uint32_t idx) const
+// Find the entry for |name|, or return UINT32_MAX if there is none.
+uint32_t
+ShapedPropertyMapThing::lookupDictionaryEntry(RunContext *cx,
+                                              const Value &name) const
 {
-    WH_ASSERT(idx < numFixedSlots());
-    return valueRef(idx + numImplicitSlots());
+    WH_ASSERT(inDictionaryMode());
+    Tuple *dict = dynamicSlots_;
+    uint32_t entry = ProbeDictionary(cx, dict, name, false);
+    if (dict->get(entry * DictionaryEntrySize)->isUndefined())
+        return UINT32_MAX;
+    return entry;
+}
+
+// Dictionaries share the probing of HashObject mappings.
+/*static*/ uint32_t
+ShapedPropertyMapThing::ProbeDictionary(RunContext *cx, Tuple *dict,
+                                        const Value &name, bool forAdd)
+{
+    return HashObject::ProbeEntries(dict, DictionaryEntrySize, name,
+                                    Shape::HashName(cx, name), forAdd);
 }
 
-const Value &
-PropertyMapThing::dynamicSlotValue(uint32_t idx) const
+/*static*/ void
+ShapedPropertyMapThing::SetDictionaryEntry(Tuple *dict, uint32_t entry,
+                                           const Value &name, const Value &val,
+                                           uint32_t attributes)
 {
-    WH_ASSERT(idx < numDynamicSlots());
-    return dynamicSlots_->element(idx);
+    uint32_t offset = entry * DictionaryEntrySize;
+    dict->set(offset, name);
+    dict->set(offset + 1, val);
+    dict->set(offset + 2, Value::Int32(attributes));
 }
 
-const Value &
-PropertyMapThing::slotValue(uint32_t idx) const
+bool
+ShapedPropertyMapThing::resizeDictionary(RunContext *cx, uint32_t capacity)
 {
-    WH_ASSERT(idx < numSlots());
-    if (idx < numFixedSlots())
-        return fixedSlotValue(idx);
+    Root<Tuple *> newDict(cx);
+    if (!cx->inHatchery().createTuple(capacity * DictionaryEntrySize, newDict))
+        return false;
 
-    return dynamicSlotValue(idx - numFixedSlots());
+    // Names are distinct, so deleted entries are simply dropped.
+    Tuple *dict = dynamicSlots_;
+    uint32_t oldCapacity = dictionaryCapacity();
+    for (uint32_t i = 0; i < oldCapacity; i++) {
+        uint32_t offset = i * DictionaryEntrySize;
+        Handle<Value> name = dict->get(offset);
+        if (!name->isString())
+            continue;
+
+        uint32_t entry = ProbeDictionary(cx, newDict, name, true);
+        SetDictionaryEntry(newDict, entry, name, dict->get(offset + 1),
+                           dict->get(offset + 2)->int32Value());
+    }
+
+    dynamicSlots_.set(newDict, this);
+    dictionaryUsed_ = dictionaryEntries_;
+    return true;
+}
+
+bool
+ShapedPropertyMapThing::addDictionaryEntry(RunContext *cx, const Value &name,
+                                           const Value &val,
+                                           uint32_t attributes)
+{
+    WH_ASSERT(inDictionaryMode());
+
+    // Keep the dictionary at most three quarters full, counting deleted
+    // entries.  If it is mostly deleted entries, rehash at the same
+    // capacity instead of growing.
+    uint32_t capacity = dictionaryCapacity();
+    if ((dictionaryUsed_ + 1) * 4 > capacity * 3) {
+        if ((dictionaryEntries_ + 1) * 2 > capacity)
+            capacity *= 2;
+        if (!resizeDictionary(cx, capacity))
+            return false;
+    }
+
+    Tuple *dict = dynamicSlots_;
+    uint32_t entry = ProbeDictionary(cx, dict, name, true);
+    Handle<Value> entryName = dict->get(entry * DictionaryEntrySize);
+    WH_ASSERT(entryName->isUndefined() || entryName->isFalse());
+    if (entryName->isUndefined())
+        dictionaryUsed_++;
+
+    SetDictionaryEntry(dict, entry, name, val, attributes);
+    dictionaryEntries_++;
+    return true;
+}
+
+//
+// PropertyTraps
+//
+
+PropertyTraps::PropertyTraps()
+{}
+
+//
+// TrappedPropertyMapThing
+//
+
+TrappedPropertyMapThing::TrappedPropertyMapThing(PropertyTraps *traps)
+  : traps_(traps)
+{
+    WH_ASSERT(traps);
+}
+
+Handle<PropertyTraps *>
+TrappedPropertyMapThing::traps() const
+{
+    return traps_;
+}
+
+//
+// PropertyMapThing
+//
+
+/*static*/ bool
+PropertyMapThing::IsShaped(HeapType ht)
+{
+    switch (ht) {
+#define CASE_(type) \
+      case HeapType::type: \
+        return PropertyMapTypeTraits<HeapType::type>::IsShaped;
+    WHISPER_DEFN_PROPMAP_TYPES(CASE_)
+#undef CASE_
+      default:
+        WH_UNREACHABLE("Invalid PropertyMapThing HeapType.");
+        return false;
+    }
+}
+
+/*static*/ uint32_t
+PropertyMapThing::BaseSize(HeapType ht)
+{
+    switch (ht) {
+#define CASE_(type) \
+      case HeapType::type: \
+        return PropertyMapTypeTraits<HeapType::type>::BaseSize;
+    WHISPER_DEFN_PROPMAP_TYPES(CASE_)
+#undef CASE_
+      default:
+        WH_UNREACHABLE("Invalid PropertyMapThing HeapType.");
+        return UINT32_MAX;
+    }
+}
+
+bool
+PropertyMapThing::isShaped() const
+{
+    return IsShaped(type());
+}
+
+bool
+PropertyMapThing::isTrapped() const
+{
+    return !IsShaped(type());
+}
+
+uint32_t
+PropertyMapThing::baseSize() const
+{
+    return BaseSize(type());
 }
 
 
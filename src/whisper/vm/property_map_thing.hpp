@@ -86,17 +86,57 @@ struct PropertyMapTypeTraits
      */
 };
 
+//
+// Slots are numbered with the fixed slots first, followed by the dynamic
+// slots.  The dynamic slots tuple is allocated when the first property
+// which doesn't fit in the fixed slots is added, and is grown by doubling.
+//
+// Objects with more than DictionaryModeMinProperties properties, or
+// which have had properties deleted, are switched to dictionary mode, so
+// that they don't keep adding shapes to the shape tree.  A dictionary
+// mode object has the empty root shape of its tree, and its dynamic
+// slots tuple holds a hashed dictionary of its properties instead of slot
+// values.  The dictionary follows the layout of HashObject mappings: it
+// is open-addressed, with entries of (name, value, attributes), undefined
+// names for empty entries and false names for deleted ones.  The fixed
+// slots are unused.
+//
+// Entering and leaving dictionary mode rebuild the properties in the
+// order of their dictionary entries, which is hash order.  The order in
+// which properties were added is not kept across either transition.
+//
+// Since the root shape holds no properties, property caches never
+// match dictionary mode objects, and property lookups through the shape
+// must not be used for them.
+//
 class ShapedPropertyMapThing : public ShapedHeapThing
 {
+  public:
+    static constexpr uint32_t DictionaryModeMinProperties = 64;
+
   private:
     Heap<Tuple *> dynamicSlots_;
 
-  public:
+    // The number of live entries, and of live or deleted entries, in
+    // the dictionary when in dictionary mode.
+    uint32_t dictionaryEntries_;
+    uint32_t dictionaryUsed_;
+
+    static constexpr uint32_t InitialDynamicSlots = 4;
+    static constexpr uint32_t InitialDictionaryEntries = 8;
+    static constexpr uint32_t DictionaryEntrySize = 3;
+
+  protected:
     ShapedPropertyMapThing(Shape *shape);
 
+    void initializeFixedSlots();
+
+  public:
     bool isExtensible() const;
     void preventExtensions();
 
+    bool inDictionaryMode() const;
+
     bool hasDynamicSlots() const;
     Handle<Tuple *> maybeDynamicSlots() const;
     Handle<Tuple *> dynamicSlots() const;
@@ -108,6 +148,57 @@ class ShapedPropertyMapThing : public ShapedHeapThing
     Handle<Value> fixedSlotValue(uint32_t idx) const;
     Handle<Value> dynamicSlotValue(uint32_t idx) const;
     Handle<Value> slotValue(uint32_t idx) const;
+
+    void setFixedSlotValue(uint32_t idx, const Value &val);
+    void setDynamicSlotValue(uint32_t idx, const Value &val);
+    void setSlotValue(uint32_t idx, const Value &val);
+
+    // Look up |name| in the shape lineage.  Not valid for objects in
+    // dictionary mode.  |name| must be a normalized property id.
+    bool lookupProperty(RunContext *cx, const Value &name, Shape **result);
+
+    // Generic property operations.  |name| must be a normalized
+    // property id.  setProperty has sloppy mode semantics: adding a
+    // property to a non-extensible object, or writing to a non-writable
+    // property, is silently ignored.  Strict mode code must check for
+    // these cases itself.
+    bool getProperty(RunContext *cx, Handle<Value> name,
+                     MutHandle<Value> result);
+    bool setProperty(RunContext *cx, Handle<Value> name, Handle<Value> val);
+
+    // Add a new writable, enumerable, configurable value property.
+    bool defineValueProperty(RunContext *cx, Handle<Value> name,
+                             Handle<Value> val);
+
+    // Delete a property.  Sets |deleted| to false if the property is
+    // not configurable.  Returns false only on allocation failure.
+    bool deleteProperty(RunContext *cx, Handle<Value> name, bool *deleted);
+
+    bool enterDictionaryMode(RunContext *cx);
+
+    // Go back to a shaped representation, if the object has few enough
+    // properties, all of them writable, enumerable and configurable.
+    // Otherwise the object is left in dictionary mode.  Returns false
+    // only on allocation failure.
+    bool leaveDictionaryMode(RunContext *cx);
+
+  private:
+    const Heap<Value> *fixedSlots() const;
+    Heap<Value> *fixedSlots();
+
+    static uint32_t NextSlotIndex(Shape *shape);
+    bool ensureDynamicSlots(RunContext *cx, uint32_t count);
+
+    uint32_t dictionaryCapacity() const;
+    uint32_t lookupDictionaryEntry(RunContext *cx, const Value &name) const;
+    static uint32_t ProbeDictionary(RunContext *cx, Tuple *dict,
+                                    const Value &name, bool forAdd);
+    static void SetDictionaryEntry(Tuple *dict, uint32_t entry,
+                                   const Value &name, const Value &val,
+                                   uint32_t attributes);
+    bool resizeDictionary(RunContext *cx, uint32_t capacity);
+    bool addDictionaryEntry(RunContext *cx, const Value &name,
+                            const Value &val, uint32_t attributes);
 };
 
 class PropertyTraps : public HeapThing,
@@ -136,6 +227,7 @@ class PropertyMapThing : public HeapThing
     static uint32_t BaseSize(HeapType ht);
 
     static constexpr uint32_t PreventExtensionsFlag = 0x01;
+    static constexpr uint32_t DictionaryModeFlag = 0x02;
 
   public:
     // Construct a shaped PropertyMapThing
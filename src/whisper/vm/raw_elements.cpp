@@ -0,0 +1,50 @@
+
+#include "vm/raw_elements.hpp"
+#include "vm/heap_thing_inlines.hpp"
+
+namespace Whisper {
+namespace VM {
+
+
+RawElements::RawElements()
+{}
+
+uint32_t
+RawElements::int32Capacity() const
+{
+    return objectSize() / sizeof(int32_t);
+}
+
+const int32_t *
+RawElements::int32Data() const
+{
+    return recastThis<int32_t>();
+}
+
+int32_t *
+RawElements::int32Data()
+{
+    return recastThis<int32_t>();
+}
+
+uint32_t
+RawElements::doubleCapacity() const
+{
+    return objectSize() / sizeof(double);
+}
+
+const double *
+RawElements::doubleData() const
+{
+    return recastThis<double>();
+}
+
+double *
+RawElements::doubleData()
+{
+    return recastThis<double>();
+}
+
+
+} // namespace VM
+} // namespace Whisper
@@ -0,0 +1,37 @@
+#ifndef WHISPER__VM__RAW_ELEMENTS_HPP
+#define WHISPER__VM__RAW_ELEMENTS_HPP
+
+#include "common.hpp"
+#include "debug.hpp"
+#include "vm/heap_type_defn.hpp"
+#include "vm/heap_thing.hpp"
+
+namespace Whisper {
+namespace VM {
+
+
+//
+// RawElements objects store unboxed element values for objects whose
+// elements are all int32 values, or all numbers.  They hold no values
+// or pointers, so they are not traced.
+//
+class RawElements : public HeapThing,
+                    public TypedHeapThing<HeapType::RawElements>
+{
+  public:
+    RawElements();
+
+    uint32_t int32Capacity() const;
+    const int32_t *int32Data() const;
+    int32_t *int32Data();
+
+    uint32_t doubleCapacity() const;
+    const double *doubleData() const;
+    double *doubleData();
+};
+
+
+} // namespace VM
+} // namespace Whisper
+
+#endif // WHISPER__VM__RAW_ELEMENTS_HPP
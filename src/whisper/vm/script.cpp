@@ -1,6 +1,7 @@
 #include "value_inlines.hpp"
 #include "rooting_inlines.hpp"
 #include "vm/script.hpp"
+#include "vm/shape_tree.hpp"
 #include "vm/heap_thing_inlines.hpp"
 
 namespace Whisper {
@@ -20,11 +21,15 @@ Script::initialize(const Config &config)
     initFlags(flags);
 }
 
-Script::Script(Bytecode *bytecode, Tuple *constants, const Config &config)
+Script::Script(Bytecode *bytecode, Tuple *constants, Tuple *propertyCaches,
+               const Config &config)
   : bytecode_(bytecode),
     constants_(constants),
+    propertyCaches_(propertyCaches),
     maxStackDepth_(config.maxStackDepth)
 {
+    WH_ASSERT_IF(propertyCaches,
+                 propertyCaches->size() % PropertyCacheSize == 0);
     initialize(config);
 }
 
@@ -76,6 +81,58 @@ Script::maxStackDepth() const
     return maxStackDepth_;
 }
 
+uint32_t
+Script::numPropertyCaches() const
+{
+    if (!propertyCaches_)
+        return 0;
+    return propertyCaches_->size() / PropertyCacheSize;
+}
+
+bool
+Script::lookupPropertyCache(uint32_t cacheIdx, Shape *shape,
+                            uint32_t *slotIndex, bool *isDynamic) const
+{
+    WH_ASSERT(cacheIdx < numPropertyCaches());
+
+    uint32_t start = cacheIdx * PropertyCacheSize;
+    for (uint32_t i = 0; i < PropertyCacheEntries; i++) {
+        Handle<Value> entryShape = propertyCaches_->get(start + i * 2);
+        if (entryShape->isUndefined())
+            return false;
+
+        if (entryShape->objectPtr() == shape) {
+            uint32_t slotInfo = propertyCaches_->get(start + i * 2 + 1)
+                                               ->int32Value();
+            *slotIndex = slotInfo >> 1;
+            *isDynamic = slotInfo & 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+Script::addPropertyCacheEntry(uint32_t cacheIdx, Shape *shape,
+                              uint32_t slotIndex, bool isDynamic)
+{
+    WH_ASSERT(cacheIdx < numPropertyCaches());
+    WH_ASSERT(slotIndex <= (UINT32_MAX >> 2));
+
+    uint32_t start = cacheIdx * PropertyCacheSize;
+    for (uint32_t i = 0; i < PropertyCacheEntries; i++) {
+        uint32_t entry = start + i * 2;
+        if (!propertyCaches_->get(entry)->isUndefined())
+            continue;
+
+        uint32_t slotInfo = (slotIndex << 1) | (isDynamic ? 1 : 0);
+        propertyCaches_->set(entry, Value::Object(shape));
+        propertyCaches_->set(entry + 1, Value::Int32(slotInfo));
+        return true;
+    }
+    return false;
+}
+
 
 } // namespace VM
 } // namespace Whisper
@@ -24,6 +24,14 @@ namespace VM {
 //  strict - whether the script executes in strict mode.
 //  mode - one of {TopLevel, Function, Eval}
 //
+// Each property access op in the script has an inline cache, indexed
+// by an operand of the op.  A cache holds up to PropertyCacheEntries
+// entries, each mapping a shape to the slot holding the property on
+// objects with that shape.  The caches are stored consecutively in the
+// propertyCaches tuple, as (shape, slotInfo) value pairs, where slotInfo
+// is the slot index within the fixed or dynamic slots, shifted left by
+// one, with the low bit set for dynamic slots.  Unused entries are
+// undefined.
 //
 struct Script : public HeapThing, public TypedHeapThing<HeapType::Script>
 {
@@ -44,6 +52,9 @@ struct Script : public HeapThing, public TypedHeapThing<HeapType::Script>
     static constexpr uint32_t ModeMask = 0x3;
     static constexpr unsigned ModeShift = 1;
 
+    static constexpr uint32_t PropertyCacheEntries = 4;
+    static constexpr uint32_t PropertyCacheSize = PropertyCacheEntries * 2;
+
     struct Config
     {
         bool isStrict;
@@ -58,12 +69,14 @@ struct Script : public HeapThing, public TypedHeapThing<HeapType::Script>
   private:
     Heap<Bytecode *> bytecode_;
     Heap<Tuple *> constants_;
+    Heap<Tuple *> propertyCaches_;
     uint32_t maxStackDepth_;
 
     void initialize(const Config &config);
 
   public:
-    Script(Bytecode *bytecode, Tuple *constants, const Config &config);
+    Script(Bytecode *bytecode, Tuple *constants, Tuple *propertyCaches,
+           const Config &config);
 
     bool isStrict() const;
 
@@ -77,6 +90,17 @@ struct Script : public HeapThing, public TypedHeapThing<HeapType::Script>
     Handle<Tuple *> constants() const;
 
     uint32_t maxStackDepth() const;
+
+    uint32_t numPropertyCaches() const;
+
+    // Look up |shape| in a property cache.  Returns false on a miss.
+    bool lookupPropertyCache(uint32_t cacheIdx, Shape *shape,
+                             uint32_t *slotIndex, bool *isDynamic) const;
+
+    // Add an entry to a property cache.  Returns false if the cache is
+    // full, in which case it is left unchanged.
+    bool addPropertyCacheEntry(uint32_t cacheIdx, Shape *shape,
+                               uint32_t slotIndex, bool isDynamic);
 };
 
 
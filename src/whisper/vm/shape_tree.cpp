@@ -1,11 +1,16 @@
 
 #include "value_inlines.hpp"
 #include "rooting_inlines.hpp"
+#include "runtime_inlines.hpp"
 #include "vm/shape_tree.hpp"
 #include "vm/shape_tree_inlines.hpp"
+#include "vm/string.hpp"
+#include "vm/tuple.hpp"
 #include "vm/vm_helpers.hpp"
 #include "vm/heap_thing_inlines.hpp"
 
+#include <algorithm>
+
 namespace Whisper {
 namespace VM {
 
@@ -83,6 +88,8 @@ ShapeTreeChild::child() const
 // Shape
 //
 
+/*static*/ constexpr uint32_t Shape::InitialChildTableSize;
+
 Shape::Config::Config()
   : hasValue(false),
     hasGetter(false),
@@ -141,12 +148,23 @@ Shape::Shape(ShapeTree *tree, Shape *parent, const Value &name,
     parent_(parent),
     name_(name),
     firstChild_(nullptr),
-    nextSibling_(nullptr)
+    nextSibling_(nullptr),
+    numChildren_(0),
+    childTable_(nullptr),
+    depth_(parent ? parent->depth() + 1 : 1),
+    shapeTable_(nullptr)
 {
     WH_ASSERT(tree);
-    WH_ASSERT(IsNormalizedPropertyId(name));
+    WH_ASSERT_IF(!name.isUndefined(), IsNormalizedPropertyId(name));
+    WH_ASSERT_IF(name.isUndefined(), !parent);
     WH_ASSERT_IF(config.hasValue, !config.hasGetter && !config.hasSetter);
     WH_ASSERT_IF(!config.hasValue, !config.isWritable);
+    initFlags(ConfigFlags(config));
+}
+
+/*static*/ uint32_t
+Shape::ConfigFlags(const Config &config)
+{
     uint32_t flags = 0;
     if (config.hasValue)
         flags |= HasValue;
@@ -160,7 +178,62 @@ Shape::Shape(ShapeTree *tree, Shape *parent, const Value &name,
         flags |= IsEnumerable;
     if (config.isWritable)
         flags |= IsWritable;
-    initFlags(flags);
+    return flags;
+}
+
+/*static*/ uint32_t
+Shape::HashName(RunContext *cx, const Value &name)
+{
+    uint32_t spoiler = cx->threadContext()->spoiler();
+    if (name.isImmIndexString())
+        return HashIndex(spoiler, name.immIndexStringValue());
+    return HashString(spoiler, name);
+}
+
+/*static*/ uint32_t
+Shape::HashChildKey(RunContext *cx, const Value &name, uint32_t attributes)
+{
+    return HashName(cx, name) ^ (attributes * 0x9E3779B9u);
+}
+
+// Find the first child in |table| for (name, attributes) which comes
+// after |after| in its probe sequence, or the first one if |after| is
+// null.  Children with the same key are all kept in the table, so they
+// are found one after another along the probe sequence.
+/*static*/ Shape *
+Shape::ProbeChildTable(RunContext *cx, Tuple *table, const Value &name,
+                       uint32_t attributes, Shape *after)
+{
+    uint32_t mask = table->size() - 1;
+    uint32_t slot = HashChildKey(cx, name, attributes) & mask;
+    for (;;) {
+        Handle<Value> entry = table->get(slot);
+        if (entry->isUndefined())
+            return nullptr;
+
+        Shape *shape = entry->objectPtr()->toShape();
+        if (shape->name() == name && shape->attributes() == attributes) {
+            if (!after)
+                return shape;
+            if (shape == after)
+                after = nullptr;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+// Add |child| to |table|, at the first empty slot in its probe sequence.
+/*static*/ void
+Shape::InsertChild(RunContext *cx, Tuple *table, Shape *child)
+{
+    uint32_t mask = table->size() - 1;
+    uint32_t slot = HashChildKey(cx, child->name(), child->attributes()) &
+                    mask;
+    while (!table->get(slot)->isUndefined())
+        slot = (slot + 1) & mask;
+
+    table->set(slot, Value::Object(child));
 }
 
 Handle<ShapeTree *>
@@ -194,6 +267,117 @@ Shape::name() const
     return name_;
 }
 
+uint32_t
+Shape::depth() const
+{
+    return depth_;
+}
+
+bool
+Shape::hasShapeTable() const
+{
+    return shapeTable_;
+}
+
+bool
+Shape::lookupProperty(RunContext *cx, const Value &name, Shape **result)
+{
+    // Short lineages are just walked.
+    if (depth_ <= ShapeTableMinDepth) {
+        for (Shape *shape = this; shape; shape = shape->maybeParent()) {
+            if (shape->name() == name) {
+                *result = shape;
+                return true;
+            }
+        }
+        *result = nullptr;
+        return true;
+    }
+
+    if (!shapeTable_ && !buildShapeTable(cx))
+        return false;
+
+    ProbeShapeTable(cx, shapeTable_, name, result);
+    return true;
+}
+
+// Find the slot in a shape table holding the shape for |name|, or the
+// empty slot where it would be added.
+/*static*/ uint32_t
+Shape::ProbeShapeTable(RunContext *cx, Tuple *table, const Value &name,
+                       Shape **shape)
+{
+    uint32_t mask = table->size() - 1;
+    uint32_t slot = HashName(cx, name) & mask;
+    for (;;) {
+        Handle<Value> entry = table->get(slot);
+        if (entry->isUndefined()) {
+            *shape = nullptr;
+            return slot;
+        }
+
+        Shape *entryShape = entry->objectPtr()->toShape();
+        if (entryShape->name() == name) {
+            *shape = entryShape;
+            return slot;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+bool
+Shape::buildShapeTable(RunContext *cx)
+{
+    WH_ASSERT(!shapeTable_);
+
+    // Size the table so it is at most half full with every shape in
+    // the lineage, and has room for a few more to be handed down.
+    uint32_t size = InitialChildTableSize;
+    while (size < depth_ * 2 + ShapeTableMinDepth)
+        size *= 2;
+
+    Tuple *table;
+    if (!cx->inHatchery().createTuple(size, table))
+        return false;
+
+    // Walk up from this shape, so that the nearest shape defining each
+    // name is the one kept.
+    for (Shape *shape = this; shape; shape = shape->maybeParent()) {
+        if (shape->name()->isUndefined())
+            continue;
+
+        Shape *existing;
+        uint32_t slot = ProbeShapeTable(cx, table, shape->name(), &existing);
+        if (!existing)
+            table->set(slot, Value::Object(shape));
+    }
+
+    shapeTable_.set(table, this);
+    return true;
+}
+
+bool
+Shape::handDownShapeTable(RunContext *cx, Shape *child)
+{
+    WH_ASSERT(shapeTable_);
+    WH_ASSERT(!child->shapeTable_);
+    WH_ASSERT(child->parent() == this);
+
+    // Only hand the table down if it stays at most half full.
+    Tuple *table = shapeTable_;
+    if (child->depth() * 2 > table->size())
+        return false;
+
+    Shape *existing;
+    uint32_t slot = ProbeShapeTable(cx, table, child->name(), &existing);
+    table->set(slot, Value::Object(child));
+
+    child->shapeTable_.set(table, child);
+    shapeTable_.set(nullptr, this);
+    return true;
+}
+
 bool
 Shape::hasFirstChild() const
 {
@@ -232,15 +416,75 @@ Shape::nextSibling() const
     return nextSibling_;
 }
 
-void
-Shape::addChild(Shape *child)
+uint32_t
+Shape::numChildren() const
+{
+    return numChildren_;
+}
+
+Shape *
+Shape::lookupChild(RunContext *cx, const Value &name,
+                   const Config &config, Shape *after) const
+{
+    uint32_t attributes = ConfigFlags(config);
+
+    if (childTable_)
+        return ProbeChildTable(cx, childTable_, name, attributes, after);
+
+    for (uint32_t i = 0; i < numChildren_; i++) {
+        Shape *child = inlineChildren_[i]->objectPtr()->toShape();
+        if (child->name() == name && child->attributes() == attributes) {
+            if (!after)
+                return child;
+            if (child == after)
+                after = nullptr;
+        }
+    }
+    return nullptr;
+}
+
+bool
+Shape::addChild(RunContext *cx, Shape *child)
 {
-    WH_ASSERT(child->nextSibling() == nullptr);
-    WH_ASSERT(child->firstChild() == nullptr);
+    WH_ASSERT(!child->hasNextSibling());
+    WH_ASSERT(!child->hasFirstChild());
     WH_ASSERT(child->parent() == this);
     WH_ASSERT(!child->name()->isNull());
-    child->setNextSibling(firstChild());
+
+    // Keep children inline while there is room.
+    if (!childTable_ && numChildren_ < InlineChildrenMax) {
+        inlineChildren_[numChildren_].set(Value::Object(child), this);
+    } else {
+        // Move to a new table when out of inline space, or when the
+        // table would become more than half full.
+        uint32_t size = childTable_ ? childTable_->size() : 0;
+        if ((numChildren_ + 1) * 2 > size) {
+            size = std::max(size * 2, InitialChildTableSize);
+            Tuple *table;
+            if (!cx->inHatchery().createTuple(size, table))
+                return false;
+
+            for (Shape *shape = firstChild_; shape;
+                 shape = shape->maybeNextSibling())
+            {
+                InsertChild(cx, table, shape);
+            }
+
+            childTable_.set(table, this);
+        }
+
+        InsertChild(cx, childTable_, child);
+    }
+
+    // A lineage growing one property at a time keeps using one table.
+    if (numChildren_ == 0 && shapeTable_)
+        handDownShapeTable(cx, child);
+
+    if (firstChild_)
+        child->setNextSibling(firstChild_);
     setFirstChild(child);
+    numChildren_++;
+    return true;
 }
 
 bool
@@ -279,6 +523,12 @@ Shape::isWritable() const
     return flags() & IsWritable;
 }
 
+uint32_t
+Shape::attributes() const
+{
+    return flags() & AttributeFlagsMask;
+}
+
 void
 Shape::setNextSibling(Shape *sibling)
 {
@@ -387,9 +637,24 @@ ValueShape::slotIndex() const
 bool
 ValueShape::isDynamicSlot() const
 {
-    return slotIndex_ < tree_->numFixedSlots();
+    return slotIndex_ >= tree_->numFixedSlots();
 }
 
+uint32_t
+ValueShape::dynamicSlotIndex() const
+{
+    WH_ASSERT(isDynamicSlot());
+    return slotIndex_ - tree_->numFixedSlots();
+}
+
+//
+// EmptyShape
+//
+
+EmptyShape::EmptyShape(ShapeTree *tree)
+  : Shape(tree, nullptr, Value::Undefined(), Shape::Config())
+{}
+
 //
 // ConstantShape
 //
@@ -88,8 +88,10 @@ class Object;
 class Class;
 
 class ShapeTreeChild;
+class Tuple;
 
 class Shape;
+class EmptyShape;
 class ValueShape;
 class ConstantShape;
 class GetterShape;
@@ -177,7 +179,27 @@ class ShapeTreeChild : public HeapThing,
 //  A setter shape has 1 extra heap thing field holding the setter.
 //  A getter+setter shape has 2 extra heap thing fields holding the accessors.
 //
-// The root shape for a shape tree is always an empty shape.
+// The root shape for a shape tree is always an empty shape, which has
+// an undefined name and no flags set.
+//
+// Besides the child list, each shape keeps a transition index over its
+// children, keyed by (name, attribute flags), so that finding the shape
+// to transition to when adding a property doesn't walk the siblings.
+// Every child is indexed, including constant and accessor children
+// which share a key but differ in their values.
+// The first InlineChildrenMax children are kept inline in the shape.
+// Once there are more, all children are moved into a hashed Tuple of
+// child shapes, which is open-addressed and kept at most half full.
+//
+// Looking up a property name walks up the parent chain.  Once a lineage
+// is deeper than ShapeTableMinDepth, a shape table is built instead:
+// an open-addressed Tuple mapping each name in the lineage to the
+// nearest shape defining it, which holds its slot and attributes.  The
+// table is cached on the shape it was built for.  When the first child
+// of a shape is added, the table is handed down to the child and the
+// child's own entry added, so a lineage that grows one property at a
+// time keeps reusing a single table.  The parent rebuilds its table if
+// it is looked up again.
 //
 class Shape : public HeapThing, public TypedHeapThing<HeapType::Shape>
 {
@@ -193,6 +215,11 @@ class Shape : public HeapThing, public TypedHeapThing<HeapType::Shape>
         IsWritable      = 0x20
     };
 
+    static constexpr uint32_t AttributeFlagsMask = 0x3F;
+    static constexpr uint32_t InlineChildrenMax = 4;
+    static constexpr uint32_t InitialChildTableSize = 16;
+    static constexpr uint32_t ShapeTableMinDepth = 8;
+
     struct Config
     {
         bool hasValue;
@@ -219,10 +246,38 @@ class Shape : public HeapThing, public TypedHeapThing<HeapType::Shape>
     Heap<Shape *> firstChild_;
     Heap<Shape *> nextSibling_;
 
+    // Transition index.  Children are in inlineChildren_ until there
+    // are more than InlineChildrenMax of them, and in childTable_
+    // afterward.
+    uint32_t numChildren_;
+    Heap<Value> inlineChildren_[InlineChildrenMax];
+    Heap<Tuple *> childTable_;
+
+    // Number of shapes in the lineage ending at this shape, and the
+    // lazily built shape table for that lineage.
+    uint32_t depth_;
+    Heap<Tuple *> shapeTable_;
+
     Shape(ShapeTree *tree, Shape *parent, const Value &name,
           const Config &config);
 
+    static uint32_t ConfigFlags(const Config &config);
+    static uint32_t HashChildKey(RunContext *cx, const Value &name,
+                                 uint32_t attributes);
+    static Shape *ProbeChildTable(RunContext *cx, Tuple *table,
+                                  const Value &name, uint32_t attributes,
+                                  Shape *after);
+    static void InsertChild(RunContext *cx, Tuple *table, Shape *child);
+    static uint32_t ProbeShapeTable(RunContext *cx, Tuple *table,
+                                    const Value &name, Shape **shape);
+
+    bool buildShapeTable(RunContext *cx);
+    bool handDownShapeTable(RunContext *cx, Shape *child);
+
   public:
+    // Hash a normalized property name.
+    static uint32_t HashName(RunContext *cx, const Value &name);
+
     Handle<ShapeTree *> tree() const;
 
     bool hasParent() const;
@@ -231,6 +286,14 @@ class Shape : public HeapThing, public TypedHeapThing<HeapType::Shape>
 
     Handle<Value> name() const;
 
+    uint32_t depth() const;
+    bool hasShapeTable() const;
+
+    // Find the nearest shape in this shape's lineage defining |name|.
+    // Sets |result| to null if there is none.  Returns false only if a
+    // shape table could not be allocated.
+    bool lookupProperty(RunContext *cx, const Value &name, Shape **result);
+
     bool hasFirstChild() const;
     Handle<Shape *> maybeFirstChild() const;
     Handle<Shape *> firstChild() const;
@@ -239,7 +302,17 @@ class Shape : public HeapThing, public TypedHeapThing<HeapType::Shape>
     Handle<Shape *> maybeNextSibling() const;
     Handle<Shape *> nextSibling() const;
 
-    void addChild(Shape *child);
+    uint32_t numChildren() const;
+
+    // Find the child shape for a property |name| with the attributes
+    // in |config|, or return null.  Constant and accessor children are
+    // matched only by name and attributes, so several of them can share
+    // a key.  Callers must still check their values, passing the last
+    // child checked as |after| to find the next one with the same key.
+    Shape *lookupChild(RunContext *cx, const Value &name,
+                       const Config &config, Shape *after=nullptr) const;
+
+    bool addChild(RunContext *cx, Shape *child);
 
     bool hasValue() const;
     bool hasGetter() const;
@@ -247,6 +320,7 @@ class Shape : public HeapThing, public TypedHeapThing<HeapType::Shape>
     bool isConfigurable() const;
     bool isEnumerable() const;
     bool isWritable() const;
+    uint32_t attributes() const;
 
     ValueShape *toValueShape();
     const ValueShape *toValueShape() const;
@@ -282,6 +356,15 @@ class ValueShape : public Shape
 
     uint32_t slotIndex() const;
     bool isDynamicSlot() const;
+
+    // Index of the slot within the dynamic slots.
+    uint32_t dynamicSlotIndex() const;
+};
+
+class EmptyShape : public Shape
+{
+  public:
+    EmptyShape(ShapeTree *tree);
 };
 
 class ConstantShape : public Shape
@@ -18,10 +18,12 @@ StackFrame::CalculateSize(const Config &config)
 {
     WH_ASSERT(config.numArgs >= config.numPassedArgs);
 
+    uint32_t numSlots = config.numArgs + config.numLocals +
+                        config.maxStackDepth;
+
     uint32_t size = AlignIntUp<uint32_t>(sizeof(StackFrame), sizeof(Value));
-    size += config.numPassedArgs * sizeof(Value);
-    size += config.numLocals * sizeof(Value);
-    size += config.maxStackDepth * sizeof(Value);
+    size += numSlots * sizeof(Value);
+    size += AlignIntUp<uint32_t>(numSlots, sizeof(Value));
     return size;
 }
 
@@ -35,6 +37,10 @@ StackFrame::StackFrame(Script *script, const Config &config)
     stackDepth_(0)
 {
     WH_ASSERT(config.numPassedArgs == numPassedArgs_);
+    WH_ASSERT(config.maxStackDepth == script->maxStackDepth());
+
+    uint32_t numSlots = numArgs_ + numLocals_ + config.maxStackDepth;
+    std::fill(slotKinds(), slotKinds() + numSlots, ToUInt8(BoxedSlot));
 }
 
 bool
@@ -115,6 +121,7 @@ Handle<Value>
 StackFrame::getArg(uint32_t idx) const
 {
     WH_ASSERT(idx < numArgs());
+    WH_ASSERT(!slotIsRawDouble(argSlot(idx)));
     return argRef(idx);
 }
 
@@ -122,6 +129,7 @@ void
 StackFrame::setArg(uint32_t idx, const Value &val)
 {
     WH_ASSERT(idx < numArgs());
+    setSlotKind(argSlot(idx), BoxedSlot);
     argRef(idx).set(val, this);
 }
 
@@ -129,13 +137,15 @@ Handle<Value>
 StackFrame::getLocal(uint32_t idx) const
 {
     WH_ASSERT(idx < numLocals());
+    WH_ASSERT(!slotIsRawDouble(localSlot(idx)));
     return localRef(idx);
 }
 
 void
 StackFrame::setLocal(uint32_t idx, const Value &val)
 {
-    WH_ASSERT(idx < numArgs());
+    WH_ASSERT(idx < numLocals());
+    setSlotKind(localSlot(idx), BoxedSlot);
     localRef(idx).set(val, this);
 }
 
@@ -143,6 +153,7 @@ Handle<Value>
 StackFrame::getStack(uint32_t offset) const
 {
     WH_ASSERT(offset < stackDepth_);
+    WH_ASSERT(!slotIsRawDouble(numArgs_ + numLocals_ + offset));
     return stackRef(offset);
 }
 
@@ -150,6 +161,7 @@ void
 StackFrame::setStack(uint32_t offset, const Value &val)
 {
     WH_ASSERT(offset < stackDepth_);
+    setSlotKind(numArgs_ + numLocals_ + offset, BoxedSlot);
     stackRef(offset).set(val, this);
 }
 
@@ -165,6 +177,10 @@ StackFrame::popStack(uint32_t count)
     Value *start = &stackAt(stackDepth_ - count);
     Value *end = start + count;
     std::fill(start, end, Value::Undefined());
+
+    uint8_t *kindStart = &slotKinds()[stackSlot(count - 1)];
+    std::fill(kindStart, kindStart + count, ToUInt8(BoxedSlot));
+
     stackDepth_ -= count;
 }
 
@@ -172,14 +188,16 @@ void
 StackFrame::pushStack(const Value &val)
 {
     WH_ASSERT(stackDepth_ < maxStackDepth());
-    stackRef(stackDepth_).set(val, this);
     stackDepth_++;
+    setSlotKind(stackSlot(0), BoxedSlot);
+    stackRef(stackDepth_ - 1).set(val, this);
 }
 
 Handle<Value>
 StackFrame::peekStack(uint32_t offset) const
 {
     WH_ASSERT(offset < stackDepth_);
+    WH_ASSERT(!slotIsRawDouble(stackSlot(offset)));
     return stackRef(stackDepth_ - (offset + 1));
 }
 
@@ -187,9 +205,101 @@ void
 StackFrame::pokeStack(uint32_t offset, const Value &val)
 {
     WH_ASSERT(offset < stackDepth_);
+    setSlotKind(stackSlot(offset), BoxedSlot);
     stackRef(stackDepth_ - (offset + 1)).set(val, this);
 }
 
+uint32_t
+StackFrame::argSlot(uint32_t idx) const
+{
+    WH_ASSERT(idx < numArgs());
+    return idx;
+}
+
+uint32_t
+StackFrame::localSlot(uint32_t idx) const
+{
+    WH_ASSERT(idx < numLocals());
+    return numArgs_ + idx;
+}
+
+uint32_t
+StackFrame::stackSlot(uint32_t offset) const
+{
+    WH_ASSERT(offset < stackDepth_);
+    return numArgs_ + numLocals_ + (stackDepth_ - (offset + 1));
+}
+
+StackFrame::SlotKind
+StackFrame::slotKind(uint32_t slot) const
+{
+    WH_ASSERT(slot < numArgs_ + numLocals_ + maxStackDepth());
+    return static_cast<SlotKind>(slotKinds()[slot]);
+}
+
+bool
+StackFrame::slotIsRawDouble(uint32_t slot) const
+{
+    return slotKind(slot) == RawDoubleSlot;
+}
+
+double
+StackFrame::getSlotRawDouble(uint32_t slot) const
+{
+    WH_ASSERT(slotIsRawDouble(slot));
+    return *reinterpret_cast<const double *>(&slotAt(slot));
+}
+
+void
+StackFrame::setSlotRawDouble(uint32_t slot, double d)
+{
+    setSlotKind(slot, RawDoubleSlot);
+    *reinterpret_cast<double *>(&slotAt(slot)) = d;
+}
+
+void
+StackFrame::pushStackRawDouble(double d)
+{
+    WH_ASSERT(stackDepth_ < maxStackDepth());
+    stackDepth_++;
+    setSlotRawDouble(stackSlot(0), d);
+}
+
+const uint8_t *
+StackFrame::slotKinds() const
+{
+    const Value *end = stackStart() + maxStackDepth();
+    return reinterpret_cast<const uint8_t *>(end);
+}
+
+uint8_t *
+StackFrame::slotKinds()
+{
+    Value *end = stackStart() + maxStackDepth();
+    return reinterpret_cast<uint8_t *>(end);
+}
+
+void
+StackFrame::setSlotKind(uint32_t slot, SlotKind kind)
+{
+    WH_ASSERT(slot < numArgs_ + numLocals_ + maxStackDepth());
+    slotKinds()[slot] = kind;
+}
+
+const Value &
+StackFrame::slotAt(uint32_t slot) const
+{
+    WH_ASSERT(slot < numArgs_ + numLocals_ + maxStackDepth());
+    return argStart()[slot];
+}
+
+Value &
+StackFrame::slotAt(uint32_t slot)
+{
+    WH_ASSERT(slot < numArgs_ + numLocals_ + maxStackDepth());
+    return argStart()[slot];
+}
+
 const Value *
 StackFrame::argStart() const
 {
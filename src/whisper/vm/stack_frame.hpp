@@ -38,12 +38,26 @@ namespace VM {
 //      | ...                   |
 //      | StackVal              |
 //      +-----------------------+
+//      | SlotKind bytes        |
+//      +-----------------------+
 //
 // CallerFrame - points to the caller StackFrame.  For the initial stack
 //  frame, this is null.
 //
 // Callee - the Script or function object that's executing in this frame.
 //
+// SlotKind bytes - one byte for each arg, local, and stack slot, in
+//  that order, describing the contents of the slot.  A slot is either
+//  a boxed Value, or a raw (unboxed) double.  Raw doubles let the
+//  interpreter keep the results of arithmetic in the frame without
+//  allocating HeapDoubles.  They are boxed only when they escape the
+//  frame, e.g. when read by a generic operation.  Tracing must skip
+//  raw double slots.
+//
+// Frame slots are addressed either by their space-relative index
+// (e.g. getArg, peekStack), or by an absolute slot number (see argSlot,
+// localSlot, stackSlot).
+//
 struct StackFrame : public HeapThing,
                     public TypedHeapThing<HeapType::StackFrame>
 {
@@ -58,6 +72,12 @@ struct StackFrame : public HeapThing,
 
     static uint32_t CalculateSize(const Config &config);
 
+    enum SlotKind : uint8_t
+    {
+        BoxedSlot       = 0,
+        RawDoubleSlot   = 1
+    };
+
   private:
     // Pointer to caller frame.
     Heap<StackFrame *> callerFrame_;
@@ -114,7 +134,25 @@ struct StackFrame : public HeapThing,
     Handle<Value> peekStack(uint32_t offset) const;
     void pokeStack(uint32_t offset, const Value &val);
 
+    uint32_t argSlot(uint32_t idx) const;
+    uint32_t localSlot(uint32_t idx) const;
+    uint32_t stackSlot(uint32_t offset) const;
+
+    SlotKind slotKind(uint32_t slot) const;
+    bool slotIsRawDouble(uint32_t slot) const;
+    double getSlotRawDouble(uint32_t slot) const;
+    void setSlotRawDouble(uint32_t slot, double d);
+
+    void pushStackRawDouble(double d);
+
   private:
+    const uint8_t *slotKinds() const;
+    uint8_t *slotKinds();
+    void setSlotKind(uint32_t slot, SlotKind kind);
+
+    const Value &slotAt(uint32_t slot) const;
+    Value &slotAt(uint32_t slot);
+
     const Value *argStart() const;
     Value *argStart();
 
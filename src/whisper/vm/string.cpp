@@ -1,11 +1,23 @@
 
 #include "value_inlines.hpp"
 #include "rooting_inlines.hpp"
+#include "runtime_inlines.hpp"
 #include "string_table.hpp"
 #include "vm/heap_thing_inlines.hpp"
 #include "vm/string.hpp"
 
 #include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) && defined(__x86_64__)
+# include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__SSE2__) && defined(__x86_64__)
+# define WHISPER_VECTOR_STRING_COMPARE
+# include <immintrin.h>
+#endif
 
 namespace Whisper {
 namespace VM {
@@ -34,7 +46,8 @@ HeapString::toHeapThing()
 bool
 HeapString::isValidString() const
 {
-    return isLinearString();
+    return isLinearString() || isConcatString() || isDependentString() ||
+           isExternalString();
 }
 #endif
 
@@ -58,18 +71,152 @@ HeapString::toLinearString()
     return reinterpret_cast<LinearString *>(this);
 }
 
+bool
+HeapString::isConcatString() const
+{
+    return toHeapThing()->type() == HeapType::ConcatString;
+}
+
+const ConcatString *
+HeapString::toConcatString() const
+{
+    WH_ASSERT(isConcatString());
+    return reinterpret_cast<const ConcatString *>(this);
+}
+
+ConcatString *
+HeapString::toConcatString()
+{
+    WH_ASSERT(isConcatString());
+    return reinterpret_cast<ConcatString *>(this);
+}
+
+bool
+HeapString::isDependentString() const
+{
+    return toHeapThing()->type() == HeapType::DependentString;
+}
+
+const DependentString *
+HeapString::toDependentString() const
+{
+    WH_ASSERT(isDependentString());
+    return reinterpret_cast<const DependentString *>(this);
+}
+
+DependentString *
+HeapString::toDependentString()
+{
+    WH_ASSERT(isDependentString());
+    return reinterpret_cast<DependentString *>(this);
+}
+
+bool
+HeapString::isExternalString() const
+{
+    return toHeapThing()->type() == HeapType::ExternalString;
+}
+
+const ExternalString *
+HeapString::toExternalString() const
+{
+    WH_ASSERT(isExternalString());
+    return reinterpret_cast<const ExternalString *>(this);
+}
+
+ExternalString *
+HeapString::toExternalString()
+{
+    WH_ASSERT(isExternalString());
+    return reinterpret_cast<ExternalString *>(this);
+}
+
+bool
+HeapString::isFlat() const
+{
+    if (isLinearString())
+        return true;
+
+    if (isConcatString())
+        return toConcatString()->isFlattened();
+
+    if (isExternalString())
+        return false;
+
+    const DependentString *depStr = toDependentString();
+    return depStr->offset() == 0 &&
+           depStr->length() == depStr->base()->length();
+}
+
+const LinearString *
+HeapString::flatString() const
+{
+    WH_ASSERT(isFlat());
+    if (isLinearString())
+        return toLinearString();
+
+    if (isConcatString())
+        return toConcatString()->left()->toLinearString();
+
+    return toDependentString()->base();
+}
+
+LinearString *
+HeapString::flatString()
+{
+    WH_ASSERT(isFlat());
+    if (isLinearString())
+        return toLinearString();
+
+    if (isConcatString())
+        return toConcatString()->left()->toLinearString();
+
+    return toDependentString()->base();
+}
+
+bool
+HeapString::isEightBit() const
+{
+    if (isLinearString())
+        return toLinearString()->isEightBit();
+
+    if (isConcatString())
+        return toConcatString()->isEightBit();
+
+    if (isExternalString())
+        return toExternalString()->isEightBit();
+
+    return toDependentString()->isEightBit();
+}
+
 uint32_t
 HeapString::length() const
 {
-    WH_ASSERT(isLinearString());
-    return toLinearString()->length();
+    if (isLinearString())
+        return toLinearString()->length();
+
+    if (isConcatString())
+        return toConcatString()->length();
+
+    if (isExternalString())
+        return toExternalString()->length();
+
+    return toDependentString()->length();
 }
 
 uint16_t
 HeapString::getChar(uint32_t idx) const
 {
-    WH_ASSERT(isLinearString());
-    return toLinearString()->getChar(idx);
+    if (isLinearString())
+        return toLinearString()->getChar(idx);
+
+    if (isConcatString())
+        return toConcatString()->getChar(idx);
+
+    if (isExternalString())
+        return toExternalString()->getChar(idx);
+
+    return toDependentString()->getChar(idx);
 }
 
 bool
@@ -80,18 +227,22 @@ HeapString::fitsImmediate() const
     if (len <= Value::ImmString16MaxLength)
         return true;
 
-    if (len > Value::ImmString8MaxLength)
+    if (len > Value::ImmStringMaxLength)
         return false;
 
-    // Maybe fits in an 8-bit immediate string.  Check to see if all
-    // chars are 8-bit.
+    // Maybe fits in an 8-bit or 6-bit immediate string.  Check to see
+    // if all chars are 8-bit, or all chars are identifier chars.
+    bool isEightBit = (len <= Value::ImmString8MaxLength);
+    bool isSixBit = (len <= Value::ImmString6MaxLength);
     for (uint32_t i = 0; i < len; i++) {
         uint16_t ch = getChar(i);
         if (ch > 0xFFu)
-            return false;
+            isEightBit = false;
+        if (Value::ImmString6Digit(ch) == 0)
+            isSixBit = false;
     }
 
-    return true;
+    return isEightBit || isSixBit;
 }
 
 uint32_t
@@ -100,8 +251,44 @@ HeapString::extract(uint32_t buflen, uint16_t *buf)
     if (isLinearString())
         return toLinearString()->extract(buflen, buf);
 
-    WH_UNREACHABLE("Only linearstrings should exist!");
-    return UINT32_MAX;
+    if (isConcatString())
+        return toConcatString()->extract(buflen, buf);
+
+    if (isExternalString())
+        return toExternalString()->extract(buflen, buf);
+
+    return toDependentString()->extract(buflen, buf);
+}
+
+// Copy all the chars of a string into |buf|.  If |buf| holds 8-bit
+// chars, the string must be eight-bit.
+template <typename CharT>
+static void
+CopyStringChars(const HeapString *str, CharT *buf)
+{
+    WH_ASSERT_IF(sizeof(CharT) == 1, str->isEightBit());
+
+    for (;;) {
+        StringUnpack unpack(str);
+        if (unpack.hasEightBit()) {
+            const uint8_t *data = unpack.eightBitData();
+            std::copy(data, data + unpack.length(), buf);
+            return;
+        }
+        if (unpack.hasSixteenBit()) {
+            const uint16_t *data = unpack.sixteenBitData();
+            std::copy(data, data + unpack.length(), buf);
+            return;
+        }
+
+        // Ropes built by repeated appends lean left, so recurse on the
+        // right string and iterate on the left.  The recursion depth is
+        // bounded by ConcatString::MaxDepth.
+        const ConcatString *rope = str->toConcatString();
+        const HeapString *left = rope->left();
+        CopyStringChars(rope->right(), buf + left->length());
+        str = left;
+    }
 }
 
 //
@@ -109,51 +296,113 @@ HeapString::extract(uint32_t buflen, uint16_t *buf)
 //
 
 void
-LinearString::initializeFlags(bool interned)
+LinearString::initializeFlags(bool interned, bool eightBit)
 {
     uint32_t flags = 0;
     if (interned)
         flags |= InternedFlagMask;
+    if (eightBit)
+        flags |= EightBitFlagMask;
     initFlags(flags);
 }
 
+uint32_t
+LinearString::dataSize() const
+{
+    return objectSize() - sizeof(LinearString);
+}
+
+uint8_t *
+LinearString::writableEightBitData()
+{
+    WH_ASSERT(isEightBit());
+    return reinterpret_cast<uint8_t *>(this + 1);
+}
+
 uint16_t *
-LinearString::writableData()
+LinearString::writableSixteenBitData()
 {
-    return recastThis<uint16_t>();
+    WH_ASSERT(!isEightBit());
+    return reinterpret_cast<uint16_t *>(this + 1);
 }
 
-LinearString::LinearString(const HeapString *str, bool interned)
+/*static*/ uint32_t
+LinearString::CalculateSize(const uint8_t *, uint32_t length)
 {
-    WH_ASSERT(length() == str->length());
+    return sizeof(LinearString) + length;
+}
 
-    initializeFlags(interned);
+/*static*/ uint32_t
+LinearString::CalculateSize(const uint16_t *data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++) {
+        if (data[i] > 0xFFu)
+            return sizeof(LinearString) + length * 2;
+    }
+    return sizeof(LinearString) + length;
+}
 
-    // Only LinearString possible for now.
-    WH_ASSERT(str->isLinearString());
-    const LinearString *linStr = str->toLinearString();
+/*static*/ uint32_t
+LinearString::CalculateSize(const HeapString *str)
+{
+    uint32_t length = str->length();
+    return sizeof(LinearString) + (str->isEightBit() ? length : length * 2);
+}
 
-    const uint16_t *data = linStr->data();
-    std::copy(data, data + length(), writableData());
+LinearString::LinearString(const HeapString *str, bool interned)
+  : hash_(0),
+    hashSpoiler_(0)
+{
+    initializeFlags(interned, str->isEightBit());
+    WH_ASSERT(length() == str->length());
 
+    if (isEightBit())
+        CopyStringChars(str, writableEightBitData());
+    else
+        CopyStringChars(str, writableSixteenBitData());
 }
 
 LinearString::LinearString(const uint8_t *data, bool interned)
+  : hash_(0),
+    hashSpoiler_(0)
 {
-    initializeFlags(interned);
-    std::copy(data, data + length(), writableData());
+    initializeFlags(interned, /*eightBit=*/true);
+    std::copy(data, data + length(), writableEightBitData());
 }
 
-LinearString::LinearString(const uint16_t *data, bool interned)
+LinearString::LinearString(const uint16_t *data, uint32_t length,
+                           bool interned)
+  : hash_(0),
+    hashSpoiler_(0)
 {
-    initializeFlags(interned);
-    std::copy(data, data + length(), writableData());
+    // The size chosen by CalculateSize determines the representation.
+    WH_ASSERT(dataSize() == length || dataSize() == length * 2);
+    initializeFlags(interned, dataSize() == length);
+
+    if (isEightBit())
+        std::copy(data, data + length, writableEightBitData());
+    else
+        std::copy(data, data + length, writableSixteenBitData());
+}
+
+bool
+LinearString::isEightBit() const
+{
+    return flags() & EightBitFlagMask;
+}
+
+const uint8_t *
+LinearString::eightBitData() const
+{
+    WH_ASSERT(isEightBit());
+    return reinterpret_cast<const uint8_t *>(this + 1);
 }
 
 const uint16_t *
-LinearString::data() const
+LinearString::sixteenBitData() const
 {
-    return recastThis<uint16_t>();
+    WH_ASSERT(!isEightBit());
+    return reinterpret_cast<const uint16_t *>(this + 1);
 }
 
 bool
@@ -162,18 +411,41 @@ LinearString::isInterned() const
     return flags() & InternedFlagMask;
 }
 
+uint32_t
+LinearString::hash(uint32_t spoiler) const
+{
+    if ((flags() & HashCachedFlagMask) && hashSpoiler_ == spoiler)
+        return hash_;
+
+    uint32_t hash = isEightBit()
+        ? HashString(spoiler, eightBitData(), length())
+        : HashString(spoiler, sixteenBitData(), length());
+
+    // Caching the hash doesn't change the value of the string.
+    LinearString *self = const_cast<LinearString *>(this);
+    self->hash_ = hash;
+    self->hashSpoiler_ = spoiler;
+    self->addFlags(HashCachedFlagMask);
+    return hash;
+}
+
 uint32_t
 LinearString::length() const
 {
-    WH_ASSERT(objectSize() % 2 == 0);
-    return objectSize() / 2;
+    if (isEightBit())
+        return dataSize();
+
+    WH_ASSERT(dataSize() % 2 == 0);
+    return dataSize() / 2;
 }
 
 uint16_t
 LinearString::getChar(uint32_t idx) const
 {
     WH_ASSERT(idx < length());
-    return data()[idx];
+    if (isEightBit())
+        return eightBitData()[idx];
+    return sixteenBitData()[idx];
 }
 
 uint32_t
@@ -183,8 +455,305 @@ LinearString::extract(uint32_t buflen, uint16_t *buf)
     if (len > buflen)
         len = buflen;
 
-    const uint16_t *d = data();
-    std::copy(d, d + len, buf);
+    if (isEightBit()) {
+        const uint8_t *d = eightBitData();
+        std::copy(d, d + len, buf);
+    } else {
+        const uint16_t *d = sixteenBitData();
+        std::copy(d, d + len, buf);
+    }
+    return len;
+}
+
+//
+// ConcatString
+//
+
+ConcatString::ConcatString(HeapString *left, HeapString *right)
+  : left_(left),
+    right_(right),
+    length_(left->length() + right->length()),
+    depth_(std::max(DepthOf(left), DepthOf(right)) + 1)
+{
+    WH_ASSERT(length_ >= left->length());
+    WH_ASSERT(depth_ <= MaxDepth);
+
+    uint32_t flags = 0;
+    if (left->isEightBit() && right->isEightBit())
+        flags |= EightBitFlagMask;
+    initFlags(flags);
+}
+
+/*static*/ uint32_t
+ConcatString::DepthOf(const HeapString *str)
+{
+    if (!str->isConcatString())
+        return 0;
+
+    return str->toConcatString()->depth();
+}
+
+bool
+ConcatString::isFlattened() const
+{
+    return flags() & FlattenedFlagMask;
+}
+
+void
+ConcatString::setFlattened(LinearString *flat)
+{
+    WH_ASSERT(!isFlattened());
+    WH_ASSERT(flat->length() == length());
+    left_.set(flat, this);
+    right_.set(nullptr, this);
+    depth_ = 0;
+    addFlags(FlattenedFlagMask);
+}
+
+bool
+ConcatString::isEightBit() const
+{
+    return flags() & EightBitFlagMask;
+}
+
+Handle<HeapString *>
+ConcatString::left() const
+{
+    return left_;
+}
+
+Handle<HeapString *>
+ConcatString::right() const
+{
+    WH_ASSERT(!isFlattened());
+    return right_;
+}
+
+uint32_t
+ConcatString::length() const
+{
+    return length_;
+}
+
+uint32_t
+ConcatString::depth() const
+{
+    return depth_;
+}
+
+uint16_t
+ConcatString::getChar(uint32_t idx) const
+{
+    WH_ASSERT(idx < length());
+
+    const HeapString *str = this;
+    while (str->isConcatString() && !str->isFlat()) {
+        const ConcatString *rope = str->toConcatString();
+        const HeapString *left = rope->left();
+        uint32_t leftLength = left->length();
+        if (idx < leftLength) {
+            str = left;
+        } else {
+            str = rope->right();
+            idx -= leftLength;
+        }
+    }
+
+    if (str->isFlat())
+        return str->flatString()->getChar(idx);
+    return str->getChar(idx);
+}
+
+uint32_t
+ConcatString::extract(uint32_t buflen, uint16_t *buf) const
+{
+    uint32_t len = length();
+    if (len <= buflen) {
+        CopyStringChars(this, buf);
+        return len;
+    }
+
+    for (uint32_t i = 0; i < buflen; i++)
+        buf[i] = getChar(i);
+    return buflen;
+}
+
+//
+// DependentString
+//
+
+DependentString::DependentString(LinearString *base, uint32_t offset,
+                                 uint32_t length)
+  : base_(base),
+    offset_(offset),
+    length_(length)
+{
+    WH_ASSERT(offset <= base->length());
+    WH_ASSERT(length <= base->length() - offset);
+
+    // A substring of a 16-bit string may still have only 8-bit chars.
+    bool eightBit = base->isEightBit();
+    if (!eightBit) {
+        const uint16_t *data = base->sixteenBitData() + offset;
+        eightBit = std::all_of(data, data + length,
+                               [](uint16_t ch) { return ch <= 0xFFu; });
+    }
+
+    initFlags(eightBit ? EightBitFlagMask : 0);
+}
+
+bool
+DependentString::isEightBit() const
+{
+    return flags() & EightBitFlagMask;
+}
+
+void
+DependentString::setFlattened(LinearString *flat)
+{
+    WH_ASSERT(flat->length() == length());
+    base_.set(flat, this);
+    offset_ = 0;
+}
+
+Handle<LinearString *>
+DependentString::base() const
+{
+    return base_;
+}
+
+uint32_t
+DependentString::offset() const
+{
+    return offset_;
+}
+
+uint32_t
+DependentString::length() const
+{
+    return length_;
+}
+
+uint16_t
+DependentString::getChar(uint32_t idx) const
+{
+    WH_ASSERT(idx < length());
+    return base_->getChar(offset_ + idx);
+}
+
+uint32_t
+DependentString::extract(uint32_t buflen, uint16_t *buf) const
+{
+    uint32_t len = length();
+    if (len > buflen)
+        len = buflen;
+
+    for (uint32_t i = 0; i < len; i++)
+        buf[i] = getChar(i);
+    return len;
+}
+
+//
+// ExternalString
+//
+
+ExternalString::ExternalString(const uint8_t *chars, uint32_t length,
+                               ReleaseCallback release, void *closure)
+  : chars_(chars),
+    length_(length),
+    release_(release),
+    closure_(closure)
+{
+    WH_ASSERT(length <= MaxLength);
+    initFlags(EightBitFlagMask);
+}
+
+ExternalString::ExternalString(const uint16_t *chars, uint32_t length,
+                               ReleaseCallback release, void *closure)
+  : chars_(chars),
+    length_(length),
+    release_(release),
+    closure_(closure)
+{
+    WH_ASSERT(length <= MaxLength);
+
+    // The chars stay in 16 bits, but equal strings must agree on
+    // isEightBit, so check whether they would fit in 8.
+    bool eightBit = std::all_of(chars, chars + length,
+                                [](uint16_t ch) { return ch <= 0xFFu; });
+
+    initFlags(SixteenBitDataFlagMask | (eightBit ? EightBitFlagMask : 0));
+}
+
+bool
+ExternalString::isEightBit() const
+{
+    return flags() & EightBitFlagMask;
+}
+
+bool
+ExternalString::hasSixteenBitData() const
+{
+    return flags() & SixteenBitDataFlagMask;
+}
+
+const uint8_t *
+ExternalString::eightBitData() const
+{
+    WH_ASSERT(!hasSixteenBitData());
+    WH_ASSERT(!isReleased());
+    return reinterpret_cast<const uint8_t *>(chars_);
+}
+
+const uint16_t *
+ExternalString::sixteenBitData() const
+{
+    WH_ASSERT(hasSixteenBitData());
+    WH_ASSERT(!isReleased());
+    return reinterpret_cast<const uint16_t *>(chars_);
+}
+
+bool
+ExternalString::isReleased() const
+{
+    return flags() & ReleasedFlagMask;
+}
+
+void
+ExternalString::release()
+{
+    WH_ASSERT(!isReleased());
+    addFlags(ReleasedFlagMask);
+    if (release_)
+        release_(chars_, closure_);
+}
+
+uint32_t
+ExternalString::length() const
+{
+    return length_;
+}
+
+uint16_t
+ExternalString::getChar(uint32_t idx) const
+{
+    WH_ASSERT(idx < length());
+    if (hasSixteenBitData())
+        return sixteenBitData()[idx];
+    return eightBitData()[idx];
+}
+
+uint32_t
+ExternalString::extract(uint32_t buflen, uint16_t *buf) const
+{
+    uint32_t len = length();
+    if (len > buflen)
+        len = buflen;
+
+    if (hasSixteenBitData())
+        std::copy(sixteenBitData(), sixteenBitData() + len, buf);
+    else
+        std::copy(eightBitData(), eightBitData() + len, buf);
     return len;
 }
 
@@ -204,36 +773,76 @@ StringUnpack::StringUnpack(const Value &val)
     }
 
     if (val.isImmString8()) {
-        length_ = val.readImmIndexString(immData_.str8.data);
+        length_ = val.readImmString8(immData_.str8.data);
         flags_ = IS_LINEAR | IS_EIGHT_BIT;
         charData_ = immData_.str8.data;
         return;
     }
 
     if (val.isImmString16()) {
-        length_ = val.readImmIndexString(immData_.str16.data);
+        length_ = val.readImmString16(immData_.str16.data);
         flags_ = IS_LINEAR;
         charData_ = immData_.str16.data;
         return;
     }
 
+    if (val.isImmString6()) {
+        length_ = val.readImmString6(immData_.str6.data);
+        flags_ = IS_LINEAR | IS_EIGHT_BIT;
+        charData_ = immData_.str6.data;
+        return;
+    }
+
     WH_ASSERT(val.isHeapString());
 
     this->init(val.heapStringPtr());
 }
 
-StringUnpack::StringUnpack(HeapString *heapStr)
+StringUnpack::StringUnpack(const HeapString *heapStr)
 {
     init(heapStr);
 }
 
 void
-StringUnpack::init(HeapString *heapStr)
+StringUnpack::init(const HeapString *heapStr)
 {
-    if (heapStr->isLinearString()) {
-        flags_ = IS_LINEAR;
-        charData_ = heapStr->toLinearString()->data();
-        length_ = heapStr->toLinearString()->length();
+    if (heapStr->isDependentString()) {
+        const DependentString *depStr = heapStr->toDependentString();
+        const LinearString *base = depStr->base();
+        length_ = depStr->length();
+        if (base->isEightBit()) {
+            flags_ = IS_LINEAR | IS_EIGHT_BIT;
+            charData_ = base->eightBitData() + depStr->offset();
+        } else {
+            flags_ = IS_LINEAR;
+            charData_ = base->sixteenBitData() + depStr->offset();
+        }
+        return;
+    }
+
+    if (heapStr->isExternalString()) {
+        const ExternalString *extStr = heapStr->toExternalString();
+        length_ = extStr->length();
+        if (extStr->hasSixteenBitData()) {
+            flags_ = IS_LINEAR;
+            charData_ = extStr->sixteenBitData();
+        } else {
+            flags_ = IS_LINEAR | IS_EIGHT_BIT;
+            charData_ = extStr->eightBitData();
+        }
+        return;
+    }
+
+    if (heapStr->isFlat()) {
+        const LinearString *linStr = heapStr->flatString();
+        length_ = linStr->length();
+        if (linStr->isEightBit()) {
+            flags_ = IS_LINEAR | IS_EIGHT_BIT;
+            charData_ = linStr->eightBitData();
+        } else {
+            flags_ = IS_LINEAR;
+            charData_ = linStr->sixteenBitData();
+        }
         return;
     }
 
@@ -280,7 +889,7 @@ StringUnpack::sixteenBitData() const
     return reinterpret_cast<const uint16_t *>(charData_);
 }
 
-HeapString *
+const HeapString *
 StringUnpack::heapString() const
 {
     WH_ASSERT(isNonLinear());
@@ -311,7 +920,7 @@ static constexpr uint32_t FNV_OFFSET_BASIS = 2166136261UL;
 
 template <typename StrT>
 static inline uint32_t
-FNVHashString(uint32_t spoiler, const StrT &data, uint32_t length)
+FNVHashStringImpl(uint32_t spoiler, const StrT &data, uint32_t length)
 {
     // Start with spoiler.
     uint32_t perturb = spoiler;
@@ -334,74 +943,398 @@ FNVHashString(uint32_t spoiler, const StrT &data, uint32_t length)
         hash ^= ch_high ^ (perturb & 0xFFu);
         hash *= FNV_PRIME;
 
-        // Shift and update perturbation.
-        perturb ^= hash;
-        perturb >>= 8;
+        // Shift and update perturbation.
+        perturb ^= hash;
+        perturb >>= 8;
+    }
+    return hash;
+}
+
+//
+// Word-at-a-time hashing.  Strings are hashed as a sequence of 16-bit
+// chars packed four to a 64-bit word, first char in the low bits, so
+// a string hashes the same whether its chars are stored in 8 or 16 bits.
+// Pairs of words are mixed into the state with a 64x64->128 bit
+// multiply, in the style of wyhash.
+//
+
+static constexpr uint64_t WORD_HASH_P0 = 0xa0761d6478bd642fULL;
+static constexpr uint64_t WORD_HASH_P1 = 0xe7037ed1a0b428dbULL;
+static constexpr uint64_t WORD_HASH_P2 = 0x8ebc6af09c88c6e3ULL;
+static constexpr uint64_t WORD_HASH_P3 = 0x589965cc75374cc3ULL;
+
+// Number of chars consumed by each step of the hash.
+static constexpr uint32_t WORD_HASH_STEP = 8;
+
+// Multiply two words, and fold the 128-bit product to 64 bits.
+static inline uint64_t
+WordHashMix(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = a;
+    product *= b;
+    return static_cast<uint64_t>(product) ^
+           static_cast<uint64_t>(product >> 64);
+#else
+    uint64_t aLo = a & 0xFFFFFFFFu, aHi = a >> 32;
+    uint64_t bLo = b & 0xFFFFFFFFu, bHi = b >> 32;
+    uint64_t loLo = aLo * bLo, loHi = aLo * bHi;
+    uint64_t hiLo = aHi * bLo, hiHi = aHi * bHi;
+    uint64_t mid = (loLo >> 32) + (loHi & 0xFFFFFFFFu) + (hiLo & 0xFFFFFFFFu);
+    uint64_t lo = (loLo & 0xFFFFFFFFu) | (mid << 32);
+    uint64_t hi = hiHi + (loHi >> 32) + (hiLo >> 32) + (mid >> 32);
+    return lo ^ hi;
+#endif
+}
+
+// Load the WORD_HASH_STEP chars at |idx| as two words.
+template <typename StrT>
+static inline void
+LoadHashWords(const StrT &str, uint32_t idx, uint64_t *w0, uint64_t *w1)
+{
+    uint64_t words[2] = { 0, 0 };
+    for (uint32_t i = 0; i < WORD_HASH_STEP; i++)
+        words[i / 4] |= ToUInt64(str[idx + i]) << (16 * (i % 4));
+    *w0 = words[0];
+    *w1 = words[1];
+}
+
+#if defined(__SSE2__) && defined(__x86_64__)
+
+// Widen 8-bit chars to 16-bit lanes, which on x86 gives exactly the
+// packed layout above.
+static inline void
+LoadHashWords(const uint8_t *str, uint32_t idx, uint64_t *w0, uint64_t *w1)
+{
+    __m128i bytes = _mm_loadl_epi64(
+                        reinterpret_cast<const __m128i *>(str + idx));
+    __m128i chars = _mm_unpacklo_epi8(bytes, _mm_setzero_si128());
+    *w0 = _mm_cvtsi128_si64(chars);
+    *w1 = _mm_cvtsi128_si64(_mm_unpackhi_epi64(chars, chars));
+}
+
+static inline void
+LoadHashWords(const uint16_t *str, uint32_t idx, uint64_t *w0, uint64_t *w1)
+{
+    __m128i chars = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i *>(str + idx));
+    *w0 = _mm_cvtsi128_si64(chars);
+    *w1 = _mm_cvtsi128_si64(_mm_unpackhi_epi64(chars, chars));
+}
+
+#endif // defined(__SSE2__) && defined(__x86_64__)
+
+template <typename StrT>
+static inline uint32_t
+WordHashStringImpl(uint32_t spoiler, const StrT &data, uint32_t length)
+{
+    uint64_t state = ((ToUInt64(spoiler) << 32) | spoiler) ^ WORD_HASH_P0;
+
+    uint32_t idx = 0;
+    for (; length - idx >= WORD_HASH_STEP; idx += WORD_HASH_STEP) {
+        uint64_t w0, w1;
+        LoadHashWords(data, idx, &w0, &w1);
+        state = WordHashMix(w0 ^ WORD_HASH_P1, w1 ^ state);
+    }
+
+    // Mix in remaining chars, padded with zeroes.  Padding can't cause
+    // collisions, since the length is mixed in below.
+    uint64_t words[2] = { 0, 0 };
+    for (uint32_t i = 0; idx + i < length; i++)
+        words[i / 4] |= ToUInt64(data[idx + i]) << (16 * (i % 4));
+    state = WordHashMix(words[0] ^ WORD_HASH_P1, words[1] ^ state);
+
+    uint64_t hash = WordHashMix(state ^ WORD_HASH_P2,
+                                ToUInt64(length) ^ WORD_HASH_P3);
+    return ToUInt32(hash ^ (hash >> 32));
+}
+
+template <typename StrT>
+static inline uint32_t
+HashStringImpl(uint32_t spoiler, const StrT &data, uint32_t length)
+{
+#if defined(ENABLE_FNV_STRING_HASH)
+    return FNVHashStringImpl(spoiler, data, length);
+#else
+    return WordHashStringImpl(spoiler, data, length);
+#endif
+}
+
+uint32_t
+HashString(uint32_t spoiler, const Value &strVal)
+{
+    WH_ASSERT(strVal.isString());
+
+    if (strVal.isImmString()) {
+        uint16_t buf[Value::ImmStringMaxLength];
+        uint32_t length = strVal.readImmString(buf);
+        return HashString(spoiler, buf, length);
+    }
+
+    WH_ASSERT(strVal.isHeapString());
+    return HashString(spoiler, strVal.heapStringPtr());
+}
+
+uint32_t
+HashString(uint32_t spoiler, const HeapString *heapStr)
+{
+    // Flat strings cache their hash.
+    if (heapStr->isFlat())
+        return heapStr->flatString()->hash(spoiler);
+
+    StringUnpack unpack(heapStr);
+    if (unpack.hasEightBit()) {
+        return HashStringImpl(spoiler, unpack.eightBitData(),
+                              unpack.length());
+    }
+    if (unpack.hasSixteenBit()) {
+        return HashStringImpl(spoiler, unpack.sixteenBitData(),
+                              unpack.length());
+    }
+
+    return HashStringImpl(spoiler, StrWrap(heapStr), heapStr->length());
+}
+
+uint32_t
+HashString(uint32_t spoiler, const uint8_t *str, uint32_t length)
+{
+    return HashStringImpl(spoiler, str, length);
+}
+
+uint32_t
+HashString(uint32_t spoiler, const uint16_t *str, uint32_t length)
+{
+    return HashStringImpl(spoiler, str, length);
+}
+
+uint32_t
+HashIndex(uint32_t spoiler, uint32_t idx)
+{
+    uint64_t seed = ((ToUInt64(spoiler) << 32) | spoiler) ^ WORD_HASH_P0;
+    uint64_t hash = WordHashMix(ToUInt64(idx) ^ WORD_HASH_P1, seed);
+    return ToUInt32(hash ^ (hash >> 32));
+}
+
+//
+// String comparison.
+//
+
+template <typename StrT1, typename StrT2>
+static int
+CompareStringsImpl(const StrT1 &str1, uint32_t len1,
+                   const StrT2 &str2, uint32_t len2)
+{
+    for (uint32_t i = 0; i < len1; i++) {
+        // Check if str2 is prefix of str1.
+        if (i >= len2)
+            return 1;
+
+        // Check characters.
+        uint16_t ch1 = str1[i];
+        uint16_t ch2 = str2[i];
+        if (ch1 < ch2)
+            return -1;
+        if (ch1 > ch2)
+            return 1;
+    }
+
+    // Check if str1 is a prefix of str2
+    if (len2 > len1)
+        return -1;
+
+    return 0;
+}
+
+//
+// Find the index of the first char at which two char arrays of the
+// given length differ, or |length| if they are identical.  On x86-64
+// this uses SSE2, or AVX2 when the CPU supports it.
+//
+
+template <typename CharT1, typename CharT2>
+static inline uint32_t
+FindMismatchScalar(const CharT1 *str1, const CharT2 *str2,
+                   uint32_t start, uint32_t length)
+{
+    for (uint32_t i = start; i < length; i++) {
+        if (str1[i] != str2[i])
+            return i;
+    }
+    return length;
+}
+
+#if defined(WHISPER_VECTOR_STRING_COMPARE)
+
+static bool
+CpuHasAVX2()
+{
+    static const bool HasAVX2 = __builtin_cpu_supports("avx2");
+    return HasAVX2;
+}
+
+// Index of the first unequal 16-bit lane, given the movemask of
+// a lane-wise equality comparison.
+static inline uint32_t
+FirstUnequalChar16(uint32_t eqMask)
+{
+    return __builtin_ctz(~eqMask) / 2;
+}
+
+static uint32_t
+FindMismatchSSE2(const uint16_t *str1, const uint16_t *str2,
+                 uint32_t length)
+{
+    uint32_t i = 0;
+    for (; length - i >= 8; i += 8) {
+        __m128i a = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i *>(str1 + i));
+        __m128i b = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i *>(str2 + i));
+        uint32_t eqMask = _mm_movemask_epi8(_mm_cmpeq_epi16(a, b));
+        if (eqMask != 0xFFFFu)
+            return i + FirstUnequalChar16(eqMask);
     }
-    return hash;
+    return FindMismatchScalar(str1, str2, i, length);
 }
 
-uint32_t
-FNVHashString(uint32_t spoiler, const Value &strVal)
+static uint32_t
+FindMismatchSSE2(const uint8_t *str1, const uint16_t *str2, uint32_t length)
 {
-    WH_ASSERT(strVal.isString());
+    // Widen 8 Latin-1 chars at a time to 16 bits.
+    __m128i zero = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; length - i >= 8; i += 8) {
+        __m128i a = _mm_unpacklo_epi8(
+                        _mm_loadl_epi64(
+                            reinterpret_cast<const __m128i *>(str1 + i)),
+                        zero);
+        __m128i b = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i *>(str2 + i));
+        uint32_t eqMask = _mm_movemask_epi8(_mm_cmpeq_epi16(a, b));
+        if (eqMask != 0xFFFFu)
+            return i + FirstUnequalChar16(eqMask);
+    }
+    return FindMismatchScalar(str1, str2, i, length);
+}
 
-    if (strVal.isImmString()) {
-        uint16_t buf[Value::ImmStringMaxLength];
-        uint32_t length = strVal.readImmString(buf);
-        return FNVHashString(spoiler, buf, length);
+__attribute__((target("avx2")))
+static uint32_t
+FindMismatchAVX2(const uint16_t *str1, const uint16_t *str2, uint32_t length)
+{
+    uint32_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        __m256i a = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i *>(str1 + i));
+        __m256i b = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i *>(str2 + i));
+        uint32_t eqMask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(a, b));
+        if (eqMask != 0xFFFFFFFFu)
+            return i + FirstUnequalChar16(eqMask);
     }
+    return i + FindMismatchSSE2(str1 + i, str2 + i, length - i);
+}
 
-    WH_ASSERT(strVal.isHeapString());
-    return FNVHashString(spoiler, strVal.heapStringPtr());
+__attribute__((target("avx2")))
+static uint32_t
+FindMismatchAVX2(const uint8_t *str1, const uint16_t *str2, uint32_t length)
+{
+    uint32_t i = 0;
+    for (; length - i >= 16; i += 16) {
+        __m256i a = _mm256_cvtepu8_epi16(
+                        _mm_loadu_si128(
+                            reinterpret_cast<const __m128i *>(str1 + i)));
+        __m256i b = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i *>(str2 + i));
+        uint32_t eqMask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(a, b));
+        if (eqMask != 0xFFFFFFFFu)
+            return i + FirstUnequalChar16(eqMask);
+    }
+    return i + FindMismatchSSE2(str1 + i, str2 + i, length - i);
 }
 
-uint32_t
-FNVHashString(uint32_t spoiler, const HeapString *heapStr)
+#endif // defined(WHISPER_VECTOR_STRING_COMPARE)
+
+template <typename CharT1>
+static inline uint32_t
+FindMismatch(const CharT1 *str1, const uint16_t *str2, uint32_t length)
 {
-    return FNVHashString(spoiler, StrWrap(heapStr), heapStr->length());
+#if defined(WHISPER_VECTOR_STRING_COMPARE)
+    if (length >= 16 && CpuHasAVX2())
+        return FindMismatchAVX2(str1, str2, length);
+    return FindMismatchSSE2(str1, str2, length);
+#else
+    return FindMismatchScalar(str1, str2, 0, length);
+#endif
 }
 
-uint32_t
-FNVHashString(uint32_t spoiler, const uint8_t *str, uint32_t length)
+template <typename CharT1>
+static int
+CompareCharsImpl(const CharT1 *str1, uint32_t len1,
+                 const uint16_t *str2, uint32_t len2)
 {
-    return FNVHashString(spoiler, str, length);
+    uint32_t minLength = std::min(len1, len2);
+    uint32_t idx = FindMismatch(str1, str2, minLength);
+    if (idx < minLength)
+        return (str1[idx] < str2[idx]) ? -1 : 1;
+
+    if (len1 == len2)
+        return 0;
+    return (len1 < len2) ? -1 : 1;
 }
 
-uint32_t
-FNVHashString(uint32_t spoiler, const uint16_t *str, uint32_t length)
+static int
+CompareStringsImpl(const uint8_t *str1, uint32_t len1,
+                   const uint8_t *str2, uint32_t len2)
 {
-    return FNVHashString(spoiler, str, length);
+    // Latin-1 chars order the same way as unsigned bytes.
+    int cmp = memcmp(str1, str2, std::min(len1, len2));
+    if (cmp != 0)
+        return (cmp < 0) ? -1 : 1;
+
+    if (len1 == len2)
+        return 0;
+    return (len1 < len2) ? -1 : 1;
 }
 
-//
-// String comparison.
-//
+static int
+CompareStringsImpl(const uint16_t *str1, uint32_t len1,
+                   const uint16_t *str2, uint32_t len2)
+{
+    // Byte order makes memcmp unusable for ordering 16-bit chars.
+    return CompareCharsImpl(str1, len1, str2, len2);
+}
 
-template <typename StrT1, typename StrT2>
 static int
-CompareStringsImpl(const StrT1 &str1, uint32_t len1,
-                   const StrT2 &str2, uint32_t len2)
+CompareStringsImpl(const uint8_t *str1, uint32_t len1,
+                   const uint16_t *str2, uint32_t len2)
 {
-    for (uint32_t i = 0; i < len1; i++) {
-        // Check if str2 is prefix of str1.
-        if (i >= len2)
-            return 1;
+    return CompareCharsImpl(str1, len1, str2, len2);
+}
 
-        // Check characters.
-        uint16_t ch1 = str1[i];
-        uint16_t ch2 = str2[i];
-        if (ch1 < ch2)
-            return -1;
-        if (ch1 > ch2)
-            return 1;
-    }
+static int
+CompareStringsImpl(const uint16_t *str1, uint32_t len1,
+                   const uint8_t *str2, uint32_t len2)
+{
+    return -CompareCharsImpl(str2, len2, str1, len1);
+}
 
-    // Check if str1 is a prefix of str2
-    if (len2 > len1)
-        return -1;
+// Compare a heap string against a string, using its linear chars
+// directly if it has them.
+template <typename StrT>
+static int
+CompareHeapStringImpl(const HeapString *str1, const StrT &str2, uint32_t len2)
+{
+    StringUnpack unpack(str1);
+    if (unpack.hasEightBit()) {
+        return CompareStringsImpl(unpack.eightBitData(), unpack.length(),
+                                  str2, len2);
+    }
+    if (unpack.hasSixteenBit()) {
+        return CompareStringsImpl(unpack.sixteenBitData(), unpack.length(),
+                                  str2, len2);
+    }
 
-    return 0;
+    return CompareStringsImpl(StrWrap(str1), str1->length(), str2, len2);
 }
 
 int
@@ -450,7 +1383,7 @@ int
 CompareStrings(const HeapString *strA,
                const uint8_t *strB, uint32_t lengthB)
 {
-    return CompareStringsImpl(StrWrap(strA), strA->length(), strB, lengthB);
+    return CompareHeapStringImpl(strA, strB, lengthB);
 }
 
 int
@@ -464,7 +1397,7 @@ int
 CompareStrings(const HeapString *strA,
                const uint16_t *strB, uint32_t lengthB)
 {
-    return CompareStringsImpl(StrWrap(strA), strA->length(), strB, lengthB);
+    return CompareHeapStringImpl(strA, strB, lengthB);
 }
 
 int
@@ -482,8 +1415,7 @@ CompareStrings(const Value &strA, const HeapString *strB)
     if (strA.isImmString()) {
         uint16_t bufA[Value::ImmStringMaxLength];
         uint32_t lengthA = strA.readImmString(bufA);
-        return CompareStringsImpl(bufA, lengthA,
-                                  StrWrap(strB), strB->length());
+        return -CompareHeapStringImpl(strB, bufA, lengthA);
     }
 
     WH_ASSERT(strA.isHeapString());
@@ -501,6 +1433,12 @@ CompareStrings(const Value &strA, const Value &strB)
 {
     WH_ASSERT(strA.isString());
 
+    // Identical values are identical strings.  Immediate strings are
+    // canonical, so distinct immediates are always distinct strings,
+    // but their order still requires comparing chars.
+    if (strA == strB)
+        return 0;
+
     if (strA.isImmString()) {
         uint16_t bufA[Value::ImmStringMaxLength];
         uint32_t lengthA = strA.readImmString(bufA);
@@ -515,8 +1453,17 @@ CompareStrings(const Value &strA, const Value &strB)
 int
 CompareStrings(const HeapString *strA, const HeapString *strB)
 {
-    return CompareStringsImpl(StrWrap(strA), strA->length(),
-                              StrWrap(strB), strB->length());
+    StringUnpack unpackB(strB);
+    if (unpackB.hasEightBit()) {
+        return CompareHeapStringImpl(strA, unpackB.eightBitData(),
+                                     unpackB.length());
+    }
+    if (unpackB.hasSixteenBit()) {
+        return CompareHeapStringImpl(strA, unpackB.sixteenBitData(),
+                                     unpackB.length());
+    }
+
+    return CompareHeapStringImpl(strA, StrWrap(strB), strB->length());
 }
 
 int
@@ -547,6 +1494,121 @@ CompareStrings(const uint16_t *strA, uint32_t lengthA,
     return CompareStringsImpl(strA, lengthA, strB, lengthB);
 }
 
+//
+// String equality.  Strings of different lengths, or where only one
+// has chars outside of Latin-1, are rejected without touching chars.
+//
+
+static bool
+EqualCharsImpl(const uint8_t *str1, const uint8_t *str2, uint32_t length)
+{
+    return memcmp(str1, str2, length) == 0;
+}
+
+static bool
+EqualCharsImpl(const uint16_t *str1, const uint16_t *str2, uint32_t length)
+{
+    return memcmp(str1, str2, length * sizeof(uint16_t)) == 0;
+}
+
+static bool
+EqualCharsImpl(const uint8_t *str1, const uint16_t *str2, uint32_t length)
+{
+    return FindMismatch(str1, str2, length) == length;
+}
+
+static bool
+EqualCharsImpl(const uint16_t *str1, const uint8_t *str2, uint32_t length)
+{
+    return FindMismatch(str2, str1, length) == length;
+}
+
+template <typename CharT>
+static bool
+EqualHeapStringImpl(const HeapString *str1, const CharT *str2,
+                    uint32_t length)
+{
+    WH_ASSERT(str1->length() == length);
+
+    StringUnpack unpack(str1);
+    if (unpack.hasEightBit())
+        return EqualCharsImpl(unpack.eightBitData(), str2, length);
+    if (unpack.hasSixteenBit())
+        return EqualCharsImpl(unpack.sixteenBitData(), str2, length);
+
+    return CompareStringsImpl(StrWrap(str1), length, str2, length) == 0;
+}
+
+bool
+EqualStrings(const HeapString *strA, const uint8_t *strB, uint32_t lengthB)
+{
+    if (strA->length() != lengthB || !strA->isEightBit())
+        return false;
+
+    return EqualHeapStringImpl(strA, strB, lengthB);
+}
+
+bool
+EqualStrings(const HeapString *strA, const uint16_t *strB, uint32_t lengthB)
+{
+    if (strA->length() != lengthB)
+        return false;
+
+    return EqualHeapStringImpl(strA, strB, lengthB);
+}
+
+bool
+EqualStrings(const HeapString *strA, const HeapString *strB)
+{
+    if (strA == strB)
+        return true;
+
+    if (strA->length() != strB->length())
+        return false;
+    if (strA->isEightBit() != strB->isEightBit())
+        return false;
+
+    StringUnpack unpackB(strB);
+    if (unpackB.hasEightBit()) {
+        return EqualHeapStringImpl(strA, unpackB.eightBitData(),
+                                   unpackB.length());
+    }
+    if (unpackB.hasSixteenBit()) {
+        return EqualHeapStringImpl(strA, unpackB.sixteenBitData(),
+                                   unpackB.length());
+    }
+
+    return CompareStrings(strA, strB) == 0;
+}
+
+bool
+EqualStrings(const Value &strA, const Value &strB)
+{
+    WH_ASSERT(strA.isString());
+    WH_ASSERT(strB.isString());
+
+    // Immediate strings are canonical, so distinct immediates are
+    // always distinct strings.
+    if (strA == strB)
+        return true;
+    if (strA.isImmString() && strB.isImmString())
+        return false;
+
+    if (strA.isImmString()) {
+        uint16_t bufA[Value::ImmStringMaxLength];
+        uint32_t lengthA = strA.readImmString(bufA);
+        return EqualStrings(strB.heapStringPtr(), bufA, lengthA);
+    }
+
+    if (strB.isImmString()) {
+        uint16_t bufB[Value::ImmStringMaxLength];
+        uint32_t lengthB = strB.readImmString(bufB);
+        return EqualStrings(strA.heapStringPtr(), bufB, lengthB);
+    }
+
+    return EqualStrings(strA.heapStringPtr(), strB.heapStringPtr());
+}
+
 //
 // Check if a string is an positive int32_t value.
 //
@@ -611,9 +1673,14 @@ IsInt32IdString(const uint16_t *str, uint32_t length, int32_t *val)
 bool
 IsInt32IdString(HeapString *str, int32_t *val)
 {
-    if (str->isLinearString()) {
-        return IsInt32IdStringImpl(str->toLinearString()->data(),
-                                   str->toLinearString()->length(), val);
+    StringUnpack unpack(str);
+    if (unpack.hasEightBit()) {
+        return IsInt32IdStringImpl(unpack.eightBitData(), unpack.length(),
+                                   val);
+    }
+    if (unpack.hasSixteenBit()) {
+        return IsInt32IdStringImpl(unpack.sixteenBitData(), unpack.length(),
+                                   val);
     }
 
     return IsInt32IdStringImpl(StrWrap(str), str->length(), val);
@@ -632,53 +1699,364 @@ IsInt32IdString(const Value &strval, int32_t *val)
         return true;
     }
 
-    WH_ASSERT_IF(strval.isImmString(),
-                 strval.isImmString8() || strval.isImmString16());
-    if (strval.isImmString8()) {
-        uint8_t buf[Value::ImmString8MaxLength];
-        uint32_t length  = strval.readImmString8(buf);
-        return IsInt32IdString(buf, length, val);
+    // Immediate strings are canonical, so other immediate strings are
+    // never int32 ids.
+    if (strval.isImmString())
+        return false;
+
+    WH_ASSERT(strval.isHeapString());
+    return IsInt32IdString(strval.heapStringPtr(), val);
+}
+
+bool
+FlattenString(ThreadContext *cx, Handle<HeapString *> str,
+              MutHandle<LinearString *> result)
+{
+    if (str->isFlat()) {
+        result = str->flatString();
+        return true;
     }
 
-    if (strval.isImmString16()) {
-        uint16_t buf[Value::ImmString16MaxLength];
-        uint32_t length  = strval.readImmString16(buf);
-        return IsInt32IdString(buf, length, val);
+    result = cx->inHatchery().createSized<LinearString>(
+                        LinearString::CalculateSize(str), str.get());
+    if (!result)
+        return false;
+
+    // Make the string refer to its flattened copy, so later linear
+    // accesses don't repeat the copy.  ExternalStrings are already
+    // linear, and keep referring to the embedder's chars.
+    if (str->isConcatString())
+        str->toConcatString()->setFlattened(result);
+    else if (str->isDependentString())
+        str->toDependentString()->setFlattened(result);
+    return true;
+}
+
+bool
+FlattenString(RunContext *cx, Handle<HeapString *> str,
+              MutHandle<LinearString *> result)
+{
+    Root<LinearString *> flat(cx);
+    if (!FlattenString(cx->threadContext(), str, &flat))
+        return false;
+
+    result = flat;
+    return true;
+}
+
+static uint32_t
+StringLength(const Value &strval)
+{
+    WH_ASSERT(strval.isString());
+
+    if (strval.isImmString())
+        return strval.immStringLength();
+
+    return strval.heapStringPtr()->length();
+}
+
+static uint32_t
+ExtractString(const Value &strval, uint32_t buflen, uint16_t *buf)
+{
+    WH_ASSERT(strval.isString());
+
+    if (strval.isImmString()) {
+        WH_ASSERT(buflen >= strval.immStringLength());
+        return strval.readImmString(buf);
     }
 
-    WH_ASSERT(strval.isHeapString());
-    return IsInt32IdString(strval.heapStringPtr(), val);
+    return strval.heapStringPtr()->extract(buflen, buf);
 }
 
+// Get a heap string holding the chars of a string value, allocating
+// one for immediate strings.
+static bool
+ToHeapString(RunContext *cx, Handle<Value> strval,
+             MutHandle<HeapString *> result)
+{
+    WH_ASSERT(strval->isString());
+
+    if (strval->isHeapString()) {
+        HeapString *heapStr = strval->heapStringPtr();
+        result = heapStr->isFlat() ? heapStr->flatString() : heapStr;
+        return true;
+    }
+
+    uint16_t buf[Value::ImmStringMaxLength];
+    uint32_t length = strval->readImmString(buf);
+    result = cx->inHatchery().createSized<LinearString>(
+                        LinearString::CalculateSize(buf, length), buf, length);
+    return result.get() != nullptr;
+}
 
 bool
-NormalizeString(RunContext *cx, const uint8_t *str, uint32_t length,
-                MutHandle<Value> result)
+Substring(RunContext *cx, Handle<Value> strval,
+          uint32_t start, uint32_t length, MutHandle<Value> result)
 {
-    int32_t idVal;
-    if (IsInt32IdString(str, length, &idVal)) {
-        result = Value::ImmIndexString(idVal);
+    WH_ASSERT(strval->isString());
+
+    uint32_t strLength = StringLength(strval);
+    WH_ASSERT(start <= strLength);
+    WH_ASSERT(length <= strLength - start);
+
+    if (length == strLength) {
+        result = strval.get();
         return true;
     }
 
-    Root<LinearString *> linStr(cx);
-    if (!cx->stringTable().addString(str, length, &linStr))
+    // Short substrings are copied into a flat string.
+    if (length < DependentString::MinLength) {
+        uint16_t buf[DependentString::MinLength];
+        StringUnpack unpack(strval);
+        if (unpack.hasEightBit()) {
+            const uint8_t *data = unpack.eightBitData() + start;
+            std::copy(data, data + length, buf);
+        } else if (unpack.hasSixteenBit()) {
+            const uint16_t *data = unpack.sixteenBitData() + start;
+            std::copy(data, data + length, buf);
+        } else {
+            const HeapString *heapStr = unpack.heapString();
+            for (uint32_t i = 0; i < length; i++)
+                buf[i] = heapStr->getChar(start + i);
+        }
+        return cx->inHatchery().createString(length, buf, result.get());
+    }
+
+    // Immediate strings are always shorter than MinLength.
+    WH_ASSERT(strval->isHeapString());
+    Root<HeapString *> heapStr(cx, strval->heapStringPtr());
+
+    // Copy just the substring out of an external string, rather than
+    // flattening all of it into a base.
+    if (heapStr->isExternalString()) {
+        const ExternalString *extStr = heapStr->toExternalString();
+        if (extStr->hasSixteenBitData()) {
+            return cx->inHatchery().createString(
+                length, extStr->sixteenBitData() + start, result.get());
+        }
+        return cx->inHatchery().createString(
+            length, extStr->eightBitData() + start, result.get());
+    }
+
+    // Find the base LinearString holding the chars.  Substrings of
+    // dependent strings share their base, and ropes are flattened.
+    Root<LinearString *> base(cx);
+    uint32_t offset = start;
+    if (heapStr->isDependentString()) {
+        base = heapStr->toDependentString()->base();
+        offset += heapStr->toDependentString()->offset();
+    } else {
+        if (!FlattenString(cx, heapStr, &base))
+            return false;
+    }
+
+    DependentString *depStr = cx->inHatchery().create<DependentString>(
+                                                base.get(), offset, length);
+    if (!depStr)
         return false;
 
-    result = Value::HeapString(linStr);
+    result = Value::HeapString(depStr);
     return true;
 }
 
 bool
-NormalizeString(RunContext *cx, const uint16_t *str, uint32_t length,
-                MutHandle<Value> result)
+ConcatenateStrings(RunContext *cx, Handle<Value> lhs, Handle<Value> rhs,
+                   MutHandle<Value> result)
+{
+    WH_ASSERT(lhs->isString() && rhs->isString());
+
+    uint32_t lhsLength = StringLength(lhs);
+    uint32_t rhsLength = StringLength(rhs);
+
+    if (rhsLength == 0) {
+        result = lhs.get();
+        return true;
+    }
+    if (lhsLength == 0) {
+        result = rhs.get();
+        return true;
+    }
+
+    if (lhsLength > HeapString::MaxLength - rhsLength)
+        return false;
+    uint32_t length = lhsLength + rhsLength;
+
+    // Short results are copied into a flat string.
+    if (length < ConcatString::MinLength) {
+        uint16_t buf[ConcatString::MinLength];
+        ExtractString(lhs, lhsLength, buf);
+        ExtractString(rhs, rhsLength, buf + lhsLength);
+        return cx->inHatchery().createString(length, buf, result.get());
+    }
+
+    Root<HeapString *> left(cx);
+    Root<HeapString *> right(cx);
+    if (!ToHeapString(cx, lhs, &left) || !ToHeapString(cx, rhs, &right))
+        return false;
+
+    // Flatten any child that is already at the depth limit, so that
+    // the new rope doesn't exceed it.
+    if (ConcatString::DepthOf(left) >= ConcatString::MaxDepth) {
+        Root<LinearString *> flat(cx);
+        if (!FlattenString(cx, left, &flat))
+            return false;
+        left = flat.get();
+    }
+    if (ConcatString::DepthOf(right) >= ConcatString::MaxDepth) {
+        Root<LinearString *> flat(cx);
+        if (!FlattenString(cx, right, &flat))
+            return false;
+        right = flat.get();
+    }
+
+    ConcatString *rope = cx->inHatchery().create<ConcatString>(left.get(),
+                                                               right.get());
+    if (!rope)
+        return false;
+
+    result = Value::HeapString(rope);
+    return true;
+}
+
+// Decode UTF-8 into UTF-16, returning the number of chars written.
+// Invalid sequences decode to U+FFFD.
+static uint32_t
+DecodeUtf8(const uint8_t *str, uint32_t length, uint16_t *out)
+{
+    static constexpr uint16_t ReplacementChar = 0xFFFD;
+
+    uint32_t pos = 0;
+    uint32_t outLength = 0;
+    while (pos < length) {
+        uint32_t ch = str[pos++];
+        if (ch <= 0x7F) {
+            out[outLength++] = ch;
+            continue;
+        }
+
+        uint32_t extra;
+        uint32_t minChar;
+        if (ch >= 0xC2 && ch <= 0xDF) {
+            ch &= 0x1F;
+            extra = 1;
+            minChar = 0x80;
+        } else if (ch >= 0xE0 && ch <= 0xEF) {
+            ch &= 0x0F;
+            extra = 2;
+            minChar = 0x800;
+        } else if (ch >= 0xF0 && ch <= 0xF4) {
+            ch &= 0x07;
+            extra = 3;
+            minChar = 0x10000;
+        } else {
+            out[outLength++] = ReplacementChar;
+            continue;
+        }
+
+        uint32_t i = 0;
+        for (; i < extra && pos < length; i++, pos++) {
+            if ((str[pos] & 0xC0) != 0x80)
+                break;
+            ch = (ch << 6) | (str[pos] & 0x3F);
+        }
+
+        if (i < extra || ch < minChar || ch > 0x10FFFF ||
+            (ch >= 0xD800 && ch <= 0xDFFF))
+        {
+            out[outLength++] = ReplacementChar;
+            continue;
+        }
+
+        if (ch > 0xFFFF) {
+            ch -= 0x10000;
+            out[outLength++] = 0xD800 | (ch >> 10);
+            out[outLength++] = 0xDC00 | (ch & 0x3FF);
+            continue;
+        }
+        out[outLength++] = ch;
+    }
+
+    return outLength;
+}
+
+bool
+CreateExternalString(RunContext *cx, ExternalString::Encoding encoding,
+                     const void *chars, uint32_t length,
+                     ExternalString::ReleaseCallback release,
+                     void *closure, MutHandle<Value> result)
+{
+    WH_ASSERT(length <= HeapString::MaxLength);
+
+    ExternalString *extStr = nullptr;
+    if (encoding == ExternalString::Utf16) {
+        const uint16_t *str = static_cast<const uint16_t *>(chars);
+        extStr = cx->inHatchery().create<ExternalString>(str, length,
+                                                         release, closure);
+    } else {
+        const uint8_t *str = static_cast<const uint8_t *>(chars);
+
+        // ASCII is valid Latin-1, so all-ASCII UTF-8 can be referred
+        // to directly.  Otherwise, decode a copy.  The decoded string
+        // never has more chars than the buffer has bytes.
+        if (encoding == ExternalString::Utf8 &&
+            !std::all_of(str, str + length,
+                         [](uint8_t ch) { return ch <= 0x7Fu; }))
+        {
+            std::vector<uint16_t> buf(length);
+            uint32_t decodedLength = DecodeUtf8(str, length, buf.data());
+            if (release)
+                release(chars, closure);
+            return cx->inHatchery().createString(decodedLength, buf.data(),
+                                                 result.get());
+        }
+
+        extStr = cx->inHatchery().create<ExternalString>(str, length,
+                                                         release, closure);
+    }
+
+    if (!extStr) {
+        if (release)
+            release(chars, closure);
+        return false;
+    }
+
+    if (!cx->threadContext()->registerExternalString(extStr)) {
+        extStr->release();
+        return false;
+    }
+
+    result = Value::HeapString(extStr);
+    return true;
+}
+
+bool
+ImmediateStringValue(const Value &strval, Value &result)
 {
-    int32_t idVal;
-    if (IsInt32IdString(str, length, &idVal)) {
-        result = Value::ImmIndexString(idVal);
+    WH_ASSERT(strval.isString());
+
+    if (strval.isImmString()) {
+        result = strval;
         return true;
     }
 
+    HeapString *heapStr = strval.heapStringPtr();
+    uint32_t length = heapStr->length();
+    if (length > Value::ImmStringMaxLength)
+        return false;
+
+    uint16_t buf[Value::ImmStringMaxLength];
+    heapStr->extract(length, buf);
+    return Value::MakeImmString(length, buf, result);
+}
+
+template <typename CharT>
+static bool
+NormalizeStringImpl(RunContext *cx, const CharT *str, uint32_t length,
+                    MutHandle<Value> result)
+{
+    if (Value::MakeImmString(length, str, result.get()))
+        return true;
+
     Root<LinearString *> linStr(cx);
     if (!cx->stringTable().addString(str, length, &linStr))
         return false;
@@ -687,15 +2065,26 @@ NormalizeString(RunContext *cx, const uint16_t *str, uint32_t length,
     return true;
 }
 
+bool
+NormalizeString(RunContext *cx, const uint8_t *str, uint32_t length,
+                MutHandle<Value> result)
+{
+    return NormalizeStringImpl(cx, str, length, result);
+}
+
+bool
+NormalizeString(RunContext *cx, const uint16_t *str, uint32_t length,
+                MutHandle<Value> result)
+{
+    return NormalizeStringImpl(cx, str, length, result);
+}
+
 bool
 NormalizeString(RunContext *cx, Handle<HeapString *> str,
                 MutHandle<Value> result)
 {
-    int32_t idVal;
-    if (IsInt32IdString(str, &idVal)) {
-        result = Value::ImmIndexString(idVal);
+    if (ImmediateStringValue(Value::HeapString(str), result.get()))
         return true;
-    }
 
     Root<LinearString *> linStr(cx);
     if (!cx->stringTable().addString(str, &linStr))
@@ -708,18 +2097,13 @@ NormalizeString(RunContext *cx, Handle<HeapString *> str,
 bool
 NormalizeString(RunContext *cx, Handle<Value> strval, MutHandle<Value> result)
 {
-    int32_t idVal;
-    if (IsInt32IdString(strval, &idVal)) {
-        result = Value::ImmIndexString(idVal);
-        return true;
-    }
+    WH_ASSERT(strval->isString());
 
-    Root<LinearString *> linStr(cx);
-    if (!cx->stringTable().addString(strval, &linStr))
-        return false;
+    if (ImmediateStringValue(strval, result.get()))
+        return true;
 
-    result = Value::HeapString(linStr);
-    return true;
+    Root<HeapString *> heapStr(cx, strval->heapStringPtr());
+    return NormalizeString(cx, heapStr, result);
 }
 
 
@@ -28,6 +28,10 @@ struct HeapString : public HeapThing
     HeapThing *toHeapThing();
 
   public:
+    // Strings longer than this can't be represented, since the size
+    // in bytes of their linear form would not fit in a header.
+    static constexpr uint32_t MaxLength = UINT32_MAX / 2;
+
 #if defined(ENABLE_DEBUG)
     bool isValidString() const;
 #endif
@@ -36,6 +40,29 @@ struct HeapString : public HeapThing
     const LinearString *toLinearString() const;
     LinearString *toLinearString();
 
+    bool isConcatString() const;
+    const ConcatString *toConcatString() const;
+    ConcatString *toConcatString();
+
+    bool isDependentString() const;
+    const DependentString *toDependentString() const;
+    DependentString *toDependentString();
+
+    bool isExternalString() const;
+    const ExternalString *toExternalString() const;
+    ExternalString *toExternalString();
+
+    // A string is flat if a LinearString holding exactly its chars is
+    // available without further allocation: it is either a LinearString,
+    // a ConcatString that has already been flattened, or a
+    // DependentString covering all of its base.
+    bool isFlat() const;
+
+    // Whether all the chars of the string fit in 8 bits.
+    bool isEightBit() const;
+    const LinearString *flatString() const;
+    LinearString *flatString();
+
     uint32_t length() const;
     uint16_t getChar(uint32_t idx) const;
     uint32_t extract(uint32_t buflen, uint16_t *buf);
@@ -45,19 +72,32 @@ struct HeapString : public HeapThing
 
 
 //
-// LinearString is a string representation which embeds all the 16-bit
+// LinearString is a string representation which embeds all the
 // characters within the object.
 //
 //      +-----------------------+
 //      | Header                |
 //      +-----------------------+
+//      | Hash      | Spoiler   |
+//      +-----------------------+
 //      | String Data           |
 //      | ...                   |
 //      | ...                   |
 //      +-----------------------+
 //
+// Characters are stored in 8 bits (Latin-1) if they all fit, and in
+// 16 bits otherwise.  Since the choice depends only on the chars, equal
+// LinearStrings always have the same representation.  CalculateSize
+// gives the size to allocate for a given string.
+//
+// The hash of the string is computed lazily and cached, along with the
+// spoiler it was computed with.  The cached hash is only used if the
+// spoiler matches.
+//
 //  Flags
 //      Interned - indicates if string is interned in the string table.
+//      EightBit - indicates if the chars are stored in 8 bits.
+//      HashCached - indicates if the hash and spoiler words are valid.
 //
 class LinearString : public HeapString,
                      public TypedHeapThing<HeapType::LinearString>
@@ -65,26 +105,240 @@ class LinearString : public HeapString,
   friend class HeapString;
   public:
     static constexpr uint32_t InternedFlagMask = 0x1;
+    static constexpr uint32_t EightBitFlagMask = 0x2;
+    static constexpr uint32_t HashCachedFlagMask = 0x4;
 
   private:
-    void initializeFlags(bool interned);
-    uint16_t *writableData();
+    uint32_t hash_;
+    uint32_t hashSpoiler_;
+
+    void initializeFlags(bool interned, bool eightBit);
+    uint32_t dataSize() const;
+    uint8_t *writableEightBitData();
+    uint16_t *writableSixteenBitData();
     
   public:
+    static uint32_t CalculateSize(const uint8_t *data, uint32_t length);
+    static uint32_t CalculateSize(const uint16_t *data, uint32_t length);
+    static uint32_t CalculateSize(const HeapString *str);
+
     LinearString(const HeapString *str, bool interned = false);
     LinearString(const uint8_t *data, bool interned = false);
-    LinearString(const uint16_t *data, bool interned = false);
+    LinearString(const uint16_t *data, uint32_t length, bool interned = false);
 
-    const uint16_t *data() const;
+    bool isEightBit() const;
+    const uint8_t *eightBitData() const;
+    const uint16_t *sixteenBitData() const;
 
     bool isInterned() const;
 
+    // Get the hash of the string for |spoiler|, computing and caching
+    // it if needed.
+    uint32_t hash(uint32_t spoiler) const;
+
     uint32_t length() const;
     uint16_t getChar(uint32_t idx) const;
     uint32_t extract(uint32_t buflen, uint16_t *buf);
 };
 
 
+//
+// ConcatString is a rope: a lazy concatenation of two heap strings.
+//
+//      +-----------------------+
+//      | Header                |
+//      +-----------------------+
+//      | Left String           |
+//      +-----------------------+
+//      | Right String          |
+//      +-----------------------+
+//      | Length    | Depth     |
+//      +-----------------------+
+//
+// Concatenation creates a ConcatString in constant time, instead of
+// copying the chars of both strings.  When linear access to the chars
+// is needed (e.g. for hashing or interning), the rope is flattened
+// into a new LinearString.  The rope is then updated to hold the
+// flattened string as its left string, with no right string, so that
+// later accesses don't copy the chars again.
+//
+// The depth of a rope is the length of the longest path from it to
+// a flat string.  Ropes deeper than MaxDepth are never created, which
+// bounds the recursion needed to walk one.
+//
+//  Flags
+//      Flattened - indicates if the rope has been flattened.
+//      EightBit - indicates if all chars in the rope fit in 8 bits.
+//
+class ConcatString : public HeapString,
+                     public TypedHeapThing<HeapType::ConcatString>
+{
+  friend class HeapString;
+  public:
+    static constexpr uint32_t FlattenedFlagMask = 0x1;
+    static constexpr uint32_t EightBitFlagMask = 0x2;
+
+    // Concatenations shorter than this produce flat strings.
+    static constexpr uint32_t MinLength = 24;
+
+    static constexpr uint32_t MaxDepth = 256;
+
+  private:
+    Heap<HeapString *> left_;
+    Heap<HeapString *> right_;
+    uint32_t length_;
+    uint32_t depth_;
+
+  public:
+    ConcatString(HeapString *left, HeapString *right);
+
+    static uint32_t DepthOf(const HeapString *str);
+
+    bool isFlattened() const;
+    void setFlattened(LinearString *flat);
+
+    bool isEightBit() const;
+
+    Handle<HeapString *> left() const;
+    Handle<HeapString *> right() const;
+
+    uint32_t length() const;
+    uint32_t depth() const;
+
+    uint16_t getChar(uint32_t idx) const;
+    uint32_t extract(uint32_t buflen, uint16_t *buf) const;
+};
+
+
+//
+// DependentString is a substring which refers to the chars of a base
+// LinearString, instead of copying them.
+//
+//      +-----------------------+
+//      | Header                |
+//      +-----------------------+
+//      | Base String           |
+//      +-----------------------+
+//      | Offset    | Length    |
+//      +-----------------------+
+//
+// The base of a DependentString is always a LinearString, so chains of
+// dependent strings never form.
+//
+// A DependentString keeps its whole base alive, even when it covers
+// only a small part of it.
+//
+//  Flags
+//      EightBit - indicates if all chars in the substring fit in 8 bits.
+//
+class DependentString : public HeapString,
+                        public TypedHeapThing<HeapType::DependentString>
+{
+  friend class HeapString;
+  public:
+    static constexpr uint32_t EightBitFlagMask = 0x1;
+
+    // Substrings shorter than this are copied, since the copy is no
+    // larger than a DependentString.
+    static constexpr uint32_t MinLength = 16;
+
+  private:
+    Heap<LinearString *> base_;
+    uint32_t offset_;
+    uint32_t length_;
+
+  public:
+    DependentString(LinearString *base, uint32_t offset, uint32_t length);
+
+    bool isEightBit() const;
+    void setFlattened(LinearString *flat);
+
+    Handle<LinearString *> base() const;
+    uint32_t offset() const;
+
+    uint32_t length() const;
+    uint16_t getChar(uint32_t idx) const;
+    uint32_t extract(uint32_t buflen, uint16_t *buf) const;
+};
+
+
+//
+// ExternalString is a string whose chars live in a buffer owned by the
+// embedder, instead of being copied into the heap.
+//
+//      +-----------------------+
+//      | Header                |
+//      +-----------------------+
+//      | Chars                 |
+//      +-----------------------+
+//      | Length    | (unused)  |
+//      +-----------------------+
+//      | Release Callback      |
+//      +-----------------------+
+//      | Closure               |
+//      +-----------------------+
+//
+// The chars are either 8-bit (Latin-1) or 16-bit (UTF-16), as provided
+// by the embedder.  The buffer must stay alive and unchanged until the
+// release callback is invoked with it, which happens once the string
+// is dead (see ThreadContext::releaseExternalStrings).
+//
+// ExternalStrings are linear, so they are hashed, compared and copied
+// directly from the embedder's buffer.  They are not flat: interning
+// one, or taking a long substring of it, copies its chars into a
+// LinearString.
+//
+//  Flags
+//      EightBit - indicates if all chars in the string fit in 8 bits.
+//      SixteenBitData - indicates if the chars are stored in 16 bits.
+//      Released - indicates if the release callback has been invoked.
+//
+class ExternalString : public HeapString,
+                       public TypedHeapThing<HeapType::ExternalString>
+{
+  friend class HeapString;
+  public:
+    static constexpr uint32_t EightBitFlagMask = 0x1;
+    static constexpr uint32_t SixteenBitDataFlagMask = 0x2;
+    static constexpr uint32_t ReleasedFlagMask = 0x4;
+
+    // Called with the chars of the string and the closure given at
+    // creation, once the string no longer needs them.
+    typedef void (*ReleaseCallback)(const void *chars, void *closure);
+
+    enum Encoding : uint8_t
+    {
+        Latin1,
+        Utf8,
+        Utf16
+    };
+
+  private:
+    const void *chars_;
+    uint32_t length_;
+    ReleaseCallback release_;
+    void *closure_;
+
+  public:
+    ExternalString(const uint8_t *chars, uint32_t length,
+                   ReleaseCallback release, void *closure);
+    ExternalString(const uint16_t *chars, uint32_t length,
+                   ReleaseCallback release, void *closure);
+
+    bool isEightBit() const;
+    bool hasSixteenBitData() const;
+    const uint8_t *eightBitData() const;
+    const uint16_t *sixteenBitData() const;
+
+    bool isReleased() const;
+    void release();
+
+    uint32_t length() const;
+    uint16_t getChar(uint32_t idx) const;
+    uint32_t extract(uint32_t buflen, uint16_t *buf) const;
+};
+
+
 //
 // Unpacking helper class for strings.
 //
@@ -102,6 +356,9 @@ class StringUnpack
         struct {
             uint8_t data[Value::ImmIndexStringMaxLength];
         } idxStr;
+        struct {
+            uint8_t data[Value::ImmString6MaxLength];
+        } str6;
     } immData_;
 
     static constexpr uint8_t IS_LINEAR = 0x01;
@@ -111,16 +368,16 @@ class StringUnpack
 
     union {
         const void *charData_;
-        HeapString *heapStr_;
+        const HeapString *heapStr_;
     };
     uint32_t length_;
 
   private:
-    void init(HeapString *heapStr);
+    void init(const HeapString *heapStr);
 
   public:
     StringUnpack(const Value &val);
-    StringUnpack(HeapString *heapStr);
+    StringUnpack(const HeapString *heapStr);
 
     uint32_t length() const;
 
@@ -130,18 +387,24 @@ class StringUnpack
 
     const uint8_t *eightBitData() const;
     const uint16_t *sixteenBitData() const;
-    HeapString *heapString() const;
+    const HeapString *heapString() const;
 };
 
 
 //
-// String hashing.
+// String hashing.  Strings with the same chars hash the same, regardless
+// of representation.  The hash function is word-at-a-time, or FNV if
+// ENABLE_FNV_STRING_HASH is defined.
 //
 
-uint32_t FNVHashString(uint32_t spoiler, const Value &strVal);
-uint32_t FNVHashString(uint32_t spoiler, const HeapString *heapStr);
-uint32_t FNVHashString(uint32_t spoiler, const uint8_t *str, uint32_t length);
-uint32_t FNVHashString(uint32_t spoiler, const uint16_t *str, uint32_t length);
+uint32_t HashString(uint32_t spoiler, const Value &strVal);
+uint32_t HashString(uint32_t spoiler, const HeapString *heapStr);
+uint32_t HashString(uint32_t spoiler, const uint8_t *str, uint32_t length);
+uint32_t HashString(uint32_t spoiler, const uint16_t *str, uint32_t length);
+
+// Hash an integer index with the word hash mixer, for tables keyed by
+// element indexes.
+uint32_t HashIndex(uint32_t spoiler, uint32_t idx);
 
 //
 // String comparison.
@@ -183,6 +446,18 @@ int CompareStrings(const uint8_t *strA, uint32_t lengthA,
 int CompareStrings(const uint16_t *strA, uint32_t lengthA,
                    const uint8_t *strB, uint32_t lengthB);
 
+//
+// String equality.  Cheaper than a full comparison when the ordering
+// is not needed.
+//
+
+bool EqualStrings(const HeapString *strA,
+                  const uint8_t *strB, uint32_t lengthB);
+bool EqualStrings(const HeapString *strA,
+                  const uint16_t *strB, uint32_t lengthB);
+bool EqualStrings(const HeapString *strA, const HeapString *strB);
+bool EqualStrings(const Value &strA, const Value &strB);
+
 //
 // Check string for id.
 //
@@ -195,8 +470,49 @@ bool IsInt32IdString(const Value &strval, int32_t *val=nullptr);
 
 
 //
-// Normalize a string.  Return either an immediate index string, or
-// an interned linear property name string.
+// Flatten a string, returning a LinearString with its chars.
+//
+bool FlattenString(ThreadContext *cx, Handle<HeapString *> str,
+                   MutHandle<LinearString *> result);
+bool FlattenString(RunContext *cx, Handle<HeapString *> str,
+                   MutHandle<LinearString *> result);
+
+//
+// Get the substring of |length| chars at |start| in a string.  Long
+// substrings are created as DependentStrings, and short ones are copied.
+//
+bool Substring(RunContext *cx, Handle<Value> strval,
+               uint32_t start, uint32_t length, MutHandle<Value> result);
+
+//
+// Concatenate two strings.  Long results are created as ropes (see
+// ConcatString), and short ones as flat strings.
+//
+bool ConcatenateStrings(RunContext *cx, Handle<Value> lhs, Handle<Value> rhs,
+                        MutHandle<Value> result);
+
+//
+// Create a string referring to |length| code units of an embedder-owned
+// buffer in |encoding|.  UTF-8 buffers are referred to directly if they
+// are all ASCII.  Otherwise their chars are decoded into a LinearString,
+// and the buffer is released immediately.
+//
+// |release| is invoked with |chars| and |closure| once the string no
+// longer needs the buffer, including when creation fails.
+//
+bool CreateExternalString(RunContext *cx, ExternalString::Encoding encoding,
+                          const void *chars, uint32_t length,
+                          ExternalString::ReleaseCallback release,
+                          void *closure, MutHandle<Value> result);
+
+//
+// Get the canonical immediate value of a string, if it has one.
+//
+bool ImmediateStringValue(const Value &strval, Value &result);
+
+//
+// Normalize a string.  Return either an immediate string (including
+// index strings), or an interned linear property name string.
 //
 bool NormalizeString(RunContext *cx, const uint8_t *str, uint32_t length,
                      MutHandle<Value> result);
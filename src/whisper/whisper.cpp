@@ -125,10 +125,16 @@ int main(int argc, char **argv) {
     if (!bcgen.constants(constants))
         return false;
 
+    // Get property cache tuple.
+    Root<VM::Tuple *> propertyCaches(cx);
+    if (!bcgen.propertyCaches(propertyCaches))
+        return false;
+
     VM::Script::Config scriptCfg(false, VM::Script::TopLevel,
                                     bcgen.maxStackDepth());
     Root<VM::Script *> script(cx,
-            cx->inHatchery().create<VM::Script>(bc, constants, scriptCfg));
+            cx->inHatchery().create<VM::Script>(bc, constants, propertyCaches,
+                                                scriptCfg));
     std::cerr << "Created script with max stack depth " <<
                  script->maxStackDepth() << std::endl;
 